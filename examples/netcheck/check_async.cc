@@ -0,0 +1,153 @@
+/* Copyright (c) 2018 Francis James Franklin
+ * 
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided
+ * that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and
+ *    the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ *    the following disclaimer in the documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Checks of IP_AsyncConnection (C++20): a coroutine on A echoes whatever a coroutine on B writes to it; the default
+ * FIFO are much smaller than each write, so both ends have to wait for space as well as for data.
+ */
+
+#include "netcheck.hh"
+
+#include <netip/ip_async.hh>
+
+#define CHECK_ASYNC_CHUNK 100 // bytes written by the client at a time
+#define CHECK_ASYNC_TOTAL 2000
+
+struct Progress {
+  bool  bOpened;
+  bool  bFinished; // the coroutine has returned
+  u32_t written;
+  u32_t echoed;
+  u32_t errors;
+
+  Progress () :
+    bOpened(false),
+    bFinished(false),
+    written(0),
+    echoed(0),
+    errors(0)
+  {
+    // ...
+  }
+};
+
+/* Echo everything back to one client, then close
+ */
+static IP_Task echo (IP_AsyncConnection & connection, Progress & progress) {
+  connection.open ();
+
+  if (co_await connection.opened ()) {
+    progress.bOpened = true;
+
+    u8_t data[64];
+
+    while (u16_t count = co_await connection.read (data, sizeof (data))) {
+      progress.written += co_await connection.write (data, count);
+    }
+    connection.close ();
+    co_await connection.closed ();
+  }
+  progress.bFinished = true;
+}
+
+/* Write a pattern a chunk at a time, reading each chunk back before writing the next, then close
+ */
+static IP_Task client (IP_AsyncConnection & connection, const IP_Address & address, u16_t port, Progress & progress) {
+  if (co_await connection.connect (address, port)) {
+    progress.bOpened = true;
+
+    u8_t chunk[CHECK_ASYNC_CHUNK];
+    u8_t pattern = 0;
+
+    while (progress.written < CHECK_ASYNC_TOTAL) {
+      for (u16_t c = 0; c < sizeof (chunk); c++) {
+	chunk[c] = pattern + c;
+      }
+      u16_t count = co_await connection.write (std::span<const u8_t> (chunk, sizeof (chunk)));
+
+      if (count < sizeof (chunk)) {
+	break;
+      }
+      progress.written += count;
+
+      u16_t offset = 0;
+
+      while (offset < sizeof (chunk)) {
+	u8_t data[32];
+
+	u16_t length = co_await connection.read (std::span<u8_t> (data, sizeof (data)));
+
+	if (!length) {
+	  break;
+	}
+	for (u16_t c = 0; c < length; c++) {
+	  if (data[c] != (u8_t) (pattern + offset + c)) {
+	    ++progress.errors;
+	  }
+	}
+	offset += length;
+	progress.echoed += length;
+      }
+      if (offset < sizeof (chunk)) {
+	break;
+      }
+      pattern += sizeof (chunk);
+    }
+    connection.close ();
+    co_await connection.closed ();
+  }
+  progress.bFinished = true;
+}
+
+void check_async () {
+  CheckPair * P = new CheckPair;
+
+  P->learn_routes ();
+
+  IP_AsyncConnection server(p_TCP, 86);
+  IP_AsyncConnection remote(p_TCP, 86);
+
+  P->A.connection_add (&server);
+  P->B.connection_add (&remote);
+
+  Progress at_server;
+  Progress at_client;
+
+  echo (server, at_server);
+
+  check ("server waits to be connected to", !at_server.bOpened && !at_server.bFinished);
+
+  client (remote, P->A.host, 86, at_client);
+
+  check_run (P->A, P->B, 10000, &at_server.bFinished);
+  check_run (P->A, P->B, 1000, &at_client.bFinished);
+
+  check ("connection opened at both ends", at_server.bOpened && at_client.bOpened);
+  check ("all data written, waiting for space as necessary", at_client.written == CHECK_ASYNC_TOTAL);
+  check ("all data echoed back intact", (at_server.written == CHECK_ASYNC_TOTAL) && (at_client.echoed == CHECK_ASYNC_TOTAL) && !at_client.errors);
+  check ("both coroutines finished after closing", at_server.bFinished && at_client.bFinished && remote.is_idle ());
+
+  P->A.connection_remove (&server);
+  P->B.connection_remove (&remote);
+
+  delete P;
+}
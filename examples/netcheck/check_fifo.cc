@@ -0,0 +1,306 @@
+/* Copyright (c) 2018 Francis James Franklin
+ * 
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided
+ * that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and
+ *    the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ *    the following disclaimer in the documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Checks of FIFO, and of IP_Ring, between two threads, one the producer and the other the consumer, streaming enough
+ * that the free-running (u16_t) indices wrap around several times.
+ */
+
+#include <atomic>
+#include <thread>
+
+#include "netcheck.hh"
+
+#include <netip/ip_thread.hh>
+
+#define CHECK_FIFO_TOTAL 200000 // bytes streamed; the indices wrap around three times
+#define CHECK_FIFO_LIMIT 10000  // time limit (in milliseconds) for each stream
+#define CHECK_FIFO_MARKS 4096   // spacing of the producer's marks; a power of two, so that one falls at each wrap
+
+/* A pseudo-random sequence of lengths, from 1 to max, so that reads and writes straddle the end of the ring
+ */
+class Lengths {
+private:
+  u32_t state;
+  u16_t max;
+
+public:
+  Lengths (u32_t seed, u16_t max_length) :
+    state(seed),
+    max(max_length)
+  {
+    // ...
+  }
+
+  inline u16_t next () {
+    state = state * 1103515245 + 12345;
+    return (u16_t) (1 + (state >> 16) % max);
+  }
+};
+
+static inline u8_t stream_byte (u32_t position) {
+  return (u8_t) (position % 251); // 251 is prime, so the pattern doesn't line up with the ring
+}
+
+/* Whether a position is near where the indices wrap around, where bytes are pushed & popped one at a time, and
+ * the consumer waits for the FIFO (or IP_Ring) to be full before each pop
+ */
+static inline bool near_wrap (u32_t position) {
+  return (u16_t) (position + 256) < 512;
+}
+
+/* Shared by the producer & consumer threads; marks are handed over as by IP_ThreadedConnection's io_discard()
+ */
+struct Stream {
+  FIFO & fifo;
+
+  std::atomic<bool> bStop; // the consumer has given up
+
+  std::atomic<bool>  bDiscardRequested; // set by the producer, and cleared by the consumer once it has drained
+  std::atomic<u16_t> discard_mark;      // the producer's mark() ...
+  std::atomic<u32_t> mark_position;     // ... and its position in the stream
+  std::atomic<u32_t> mark_errors;       // number of marks that weren't the producer's position
+
+  Stream (FIFO & ring) :
+    fifo(ring),
+    bStop(false),
+    bDiscardRequested(false),
+    discard_mark(0),
+    mark_position(0),
+    mark_errors(0)
+  {
+    // ...
+  }
+};
+
+/* The producer's thread: write the pattern in chunks of various lengths; single bytes (and all of them near the
+ * wrap) with push(). Every so often, mark the position for the consumer to discard what comes before it.
+ */
+static void fifo_produce (Stream * stream) {
+  Lengths lengths(1, 97);
+
+  u8_t  data[97];
+  u32_t position = 0;
+  u32_t next_mark = CHECK_FIFO_MARKS;
+
+  while ((position < CHECK_FIFO_TOTAL) && !stream->bStop.load ()) {
+    if ((position >= next_mark) && !stream->bDiscardRequested.load (std::memory_order_acquire)) {
+      u16_t mark = stream->fifo.mark ();
+
+      if (mark != (u16_t) position) {
+	++stream->mark_errors;
+      }
+      stream->discard_mark.store (mark, std::memory_order_relaxed);
+      stream->mark_position.store (position, std::memory_order_relaxed);
+      stream->bDiscardRequested.store (true, std::memory_order_release);
+
+      next_mark += CHECK_FIFO_MARKS;
+    }
+    u16_t length = near_wrap (position) ? 1 : lengths.next ();
+
+    if (length > CHECK_FIFO_TOTAL - position) {
+      length = (u16_t) (CHECK_FIFO_TOTAL - position);
+    }
+    for (u16_t c = 0; c < length; c++) {
+      data[c] = stream_byte (position + c);
+    }
+
+    u16_t offset = 0;
+
+    while ((offset < length) && !stream->bStop.load ()) {
+      u16_t count;
+
+      if (length == 1) {
+	count = stream->fifo.push (data[0]) ? 1 : 0;
+      } else {
+	count = stream->fifo.write (data + offset, length - offset);
+      }
+      if (!count) {
+	std::this_thread::yield ();
+      }
+      offset += count;
+    }
+    position += length;
+  }
+}
+
+static void check_fifo_stream () {
+  u8_t storage[64];
+  FIFO fifo(storage, sizeof (storage));
+
+  Stream stream(fifo);
+
+  std::thread producer(fifo_produce, &stream);
+
+  Lengths lengths(2, 61);
+
+  u8_t  data[61];
+  u32_t position = 0;
+  u32_t errors = 0;
+  u32_t start = ip_arch_millis ();
+
+  u32_t discards = 0;  // marks drained to, discarding data
+  u32_t discarded = 0; // bytes discarded
+  u32_t passed = 0;    // marks already read past, so nothing was discarded
+  bool  bLate = false; // whether to read past the next mark before draining to it
+
+  while (position < CHECK_FIFO_TOTAL) { // the consumer's thread
+    if (ip_arch_millis () - start > CHECK_FIFO_LIMIT) {
+      break;
+    }
+    if (stream.bDiscardRequested.load (std::memory_order_acquire)) {
+      u16_t mark = stream.discard_mark.load (std::memory_order_relaxed);
+      u32_t mark_at = stream.mark_position.load (std::memory_order_relaxed);
+
+      if (!bLate || (position > mark_at)) { // every other mark, read past it first
+	stream.bDiscardRequested.store (false, std::memory_order_release);
+
+	fifo.drain_to (mark);
+
+	if (mark_at > position) { // the next byte read should be the one at the mark
+	  ++discards;
+	  discarded += mark_at - position;
+	  position = mark_at;
+	} else {
+	  ++passed;
+	}
+	bLate = !bLate;
+      }
+    }
+    if (near_wrap (position) && fifo.available ()) { // let the producer fill the FIFO, to be full across the wrap
+      std::this_thread::yield ();
+      continue;
+    }
+    u16_t length = near_wrap (position) ? 1 : lengths.next ();
+    u16_t count;
+
+    if (length == 1) {
+      count = fifo.pop (data[0]) ? 1 : 0;
+    } else {
+      count = fifo.read (data, length);
+    }
+    if (!count) {
+      std::this_thread::yield ();
+    }
+    for (u16_t c = 0; c < count; c++) {
+      if (data[c] != stream_byte (position + c)) {
+	++errors;
+      }
+    }
+    position += count;
+  }
+  stream.bStop.store (true);
+  producer.join ();
+
+  check ("stream read in order, past the indices wrapping around", (position == CHECK_FIFO_TOTAL) && !errors);
+  check ("FIFO empty at the end", fifo.is_empty () && !fifo.count () && (fifo.available () == fifo.capacity ()));
+  check ("mark() is the producer's position", !stream.mark_errors.load ());
+  check ("drain_to() discards up to the mark, and only that", discards && discarded && !errors);
+  check ("drain_to() leaves alone a mark already read past", passed && !errors);
+}
+
+/* Shared by the producer & consumer threads
+ */
+struct Handover {
+  IP_Ring<IP_Thread_Ring> ring;
+
+  IP_Buffer pool[2 * IP_Thread_Ring]; // twice the ring, so that a buffer isn't reused while still being checked
+
+  std::atomic<bool>  bStop;  // the consumer has given up
+  std::atomic<u32_t> pushed; // number of buffers pushed so far
+
+  Handover () :
+    bStop(false),
+    pushed(0)
+  {
+    // ...
+  }
+};
+
+/* The producer's thread: hand over the pool of buffers in turn, each numbered
+ */
+static void ring_produce (Handover * handover) {
+  const u32_t pool_size = sizeof (handover->pool) / sizeof (handover->pool[0]);
+
+  for (u32_t n = 0; n < CHECK_FIFO_TOTAL; n++) {
+    IP_Buffer & buffer = handover->pool[n % pool_size];
+
+    buffer.clear ();
+    buffer[(u16_t) 0] = (u8_t) n;
+    buffer[(u16_t) 1] = (u8_t) (n >> 8);
+    buffer[(u16_t) 2] = (u8_t) (n >> 16);
+
+    while (!handover->ring.push (&buffer)) { // full
+      if (handover->bStop.load ()) {
+	return;
+      }
+      std::this_thread::yield ();
+    }
+    handover->pushed.store (n + 1);
+  }
+}
+
+static void check_fifo_ring () {
+  static Handover handover;
+
+  const u32_t pool_size = sizeof (handover.pool) / sizeof (handover.pool[0]);
+
+  std::thread producer(ring_produce, &handover);
+
+  u32_t n = 0;
+  u32_t errors = 0;
+  u32_t start = ip_arch_millis ();
+
+  while (n < CHECK_FIFO_TOTAL) { // the consumer's thread
+    if (ip_arch_millis () - start > CHECK_FIFO_LIMIT) {
+      break;
+    }
+    if (near_wrap (n) && (handover.pushed.load () - n < IP_Thread_Ring)) { // let the ring fill, to be full across the wrap
+      std::this_thread::yield ();
+      continue;
+    }
+    IP_Buffer * buffer = handover.ring.pop ();
+
+    if (!buffer) {
+      std::this_thread::yield ();
+      continue;
+    }
+    const IP_Buffer & b = *buffer;
+
+    if ((buffer != &handover.pool[n % pool_size]) || (b.length () != 3)) {
+      ++errors;
+    } else if ((u32_t) (b[(u16_t) 0] | (b[(u16_t) 1] << 8) | (b[(u16_t) 2] << 16)) != (n & 0xFFFFFF)) {
+      ++errors;
+    }
+    ++n;
+  }
+  handover.bStop.store (true);
+  producer.join ();
+
+  check ("IP_Ring: buffers handed over in order, and intact, past the indices wrapping around", (n == CHECK_FIFO_TOTAL) && !errors);
+  check ("IP_Ring empty at the end", !handover.ring.pop ());
+}
+
+void check_fifo () {
+  check_fifo_stream ();
+  check_fifo_ring ();
+}
@@ -0,0 +1,232 @@
+/* Copyright (c) 2018 Francis James Franklin
+ * 
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided
+ * that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and
+ *    the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ *    the following disclaimer in the documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Checks of IP_GatewayBridge: B sends UDP datagrams through its gateway, A, to a socket on the host's loopback
+ * interface, which replies to whichever address & port each datagram came from.
+ */
+
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "netcheck.hh"
+
+#include <netip/ip_gateway.hh>
+
+/* The host end: a UDP socket on the loopback interface
+ */
+class Echo {
+public:
+  int fd;
+  u16_t port;
+
+  u8_t  data[2048];
+  u16_t length;      // length of the last datagram received; 0 if none
+  u16_t from_port;   // host port it came from, i.e., the gateway's translation of the flow
+
+  Echo () :
+    fd(-1),
+    port(0),
+    length(0),
+    from_port(0)
+  {
+    fd = socket (AF_INET, SOCK_DGRAM, 0);
+
+    struct sockaddr_in sa;
+    memset (&sa, 0, sizeof (sa));
+
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+
+    socklen_t sa_length = sizeof (sa);
+
+    if ((fd >= 0) && !bind (fd, (struct sockaddr *) &sa, sizeof (sa)) && !getsockname (fd, (struct sockaddr *) &sa, &sa_length)) {
+      fcntl (fd, F_SETFL, O_NONBLOCK);
+      port = ntohs (sa.sin_port);
+    }
+  }
+
+  ~Echo () {
+    if (fd >= 0) {
+      close (fd);
+    }
+  }
+
+  /* Receive any datagram waiting, and reply with the specified message
+   */
+  void update (const char * reply) {
+    struct sockaddr_in sa;
+    socklen_t sa_length = sizeof (sa);
+
+    ssize_t count = recvfrom (fd, data, sizeof (data), 0, (struct sockaddr *) &sa, &sa_length);
+
+    if (count > 0) {
+      length = (u16_t) count;
+      from_port = ntohs (sa.sin_port);
+
+      sendto (fd, reply, strlen (reply), 0, (struct sockaddr *) &sa, sa_length);
+    }
+  }
+};
+
+/* The local end: an unconnected UDP endpoint in datagram mode, noting the source of each reply
+ */
+class Replies : public CheckSink {
+public:
+  char  data[64];
+  u16_t length;
+
+  IP_Address source;
+  u16_t      source_port;
+
+  Replies () :
+    length(0),
+    source_port(0)
+  {
+    // ...
+  }
+
+  virtual void connection_has_data (const IP_Connection & connection) {
+    length = const_cast<IP_Connection &> (connection).receive_from ((u8_t *) data, sizeof (data) - 1, source, source_port);
+    data[length] = 0;
+  }
+};
+
+/* Notes where the last UDP datagram from A to B was addressed
+ */
+class Watch : public CheckLink::Filter {
+public:
+  IP_Address destination;
+  u16_t      port;
+
+  Watch () :
+    port(0)
+  {
+    // ...
+  }
+
+  virtual CheckLink::Action link_filter (const CheckLink & link, IP_Buffer & packet) {
+    (void) link;
+
+    if (packet.ip().is_UDP ()) {
+      destination = packet.ip().destination ();
+      port = packet.udp().destination ();
+    }
+    return CheckLink::a_Deliver;
+  }
+};
+
+void check_gateway () {
+  CheckPair * P = new CheckPair;
+
+  IP_GatewayBridge gateway;
+  P->A.set_gateway (&gateway);
+
+  Echo echo;
+  check ("host socket on the loopback interface", echo.port != 0);
+
+  Watch watch;
+  P->AB.set_filter (&watch);
+
+  Replies replies;
+
+  IP_Connection local(p_UDP, 1001);
+  local.set_event_listener (&replies);
+  local.set_datagram_mode (true);
+  P->B.connection_add (&local);
+  local.open ();
+
+  P->learn_routes ();
+
+  const IP_Address loopback(127,0,0,1);
+
+  u32_t start;
+
+  /* a datagram to the host socket, and the reply back
+   */
+  const char * hello = "netcheck: hello";
+
+  local.send_to (loopback, echo.port, (const u8_t *) hello, strlen (hello));
+
+  start = ip_arch_millis ();
+
+  while (!replies.length && (ip_arch_millis () - start < 2000)) {
+    P->A.cycle ();
+    P->B.cycle ();
+    echo.update ("netcheck: reply");
+  }
+  check ("datagram sent through the gateway", (echo.length == strlen (hello)) && !memcmp (echo.data, hello, echo.length));
+  check ("sent from the flow's translated port", echo.from_port && (echo.from_port == gateway.host_port (P->B.host, 1001)));
+  check ("reply addressed to the originating address & port", (watch.destination == P->B.host) && (watch.port == 1001));
+  check ("reply received from the host socket", !strcmp (replies.data, "netcheck: reply") && (replies.source == loopback) && (replies.source_port == echo.port));
+  check ("one flow active", gateway.flows_active () == 1);
+
+  /* the flow should be closed once idle
+   */
+  gateway.set_idle_timeout (1);
+
+  start = ip_arch_millis ();
+
+  while (gateway.flows_active () && (ip_arch_millis () - start < 3000)) {
+    P->A.cycle ();
+    P->B.cycle ();
+  }
+  check ("idle flow expired", !gateway.flows_active () && (gateway.flows_expired () == 1) && !gateway.host_port (P->B.host, 1001));
+
+  /* a datagram too long for a buffer is sent as fragments, which the gateway must reassemble before bridging
+   */
+  static u8_t pattern[1000];
+
+  for (u16_t i = 0; i < sizeof (pattern); i++) {
+    pattern[i] = (u8_t) (i % 251);
+  }
+
+  u32_t out = gateway.datagrams_out ();
+  u32_t dropped = gateway.packets_dropped ();
+
+  echo.length = 0;
+  replies.length = 0;
+
+  check ("fragmented datagram sent", local.send_to (loopback, echo.port, pattern, sizeof (pattern)));
+
+  start = ip_arch_millis ();
+
+  while (!replies.length && (ip_arch_millis () - start < 2000)) {
+    P->A.cycle ();
+    P->B.cycle ();
+    echo.update ("netcheck: reply");
+  }
+  check ("fragments reassembled before bridging", (echo.length == sizeof (pattern)) && !memcmp (echo.data, pattern, sizeof (pattern)));
+  check ("bridged as one datagram", (gateway.datagrams_out () == out + 1) && (gateway.packets_dropped () == dropped));
+  check ("reply to the fragmented datagram received", !strcmp (replies.data, "netcheck: reply") && (replies.source_port == echo.port));
+
+  P->A.set_gateway (0);
+  P->B.connection_remove (&local);
+
+  delete P;
+}
@@ -0,0 +1,397 @@
+/* Copyright (c) 2018 Francis James Franklin
+ * 
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided
+ * that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and
+ *    the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ *    the following disclaimer in the documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Checks of TCP (see IP_Connection): a client on A sends a byte pattern to a server on B, while a filter on the
+ * links watches the connection's segments, and drops, reorders or renumbers the ones chosen by each check.
+ */
+
+#include <cstdio>
+#include <cstring>
+
+#include "netcheck.hh"
+
+#define CHECK_TCP_FIFO 1024
+
+/* Watches one connection (identified by the client's port), numbering the client's data segments in the order they
+ * are first sent; one of these, the target, can be dropped or held back for some number of its transmissions. The
+ * client's sequence numbers can also be shifted on the wire, e.g., so that they wrap around.
+ */
+class Segments : public CheckLink::Filter {
+public:
+  const CheckLink * outward; // the client's link
+  u16_t port;                // the client's port; other connections are let through
+
+  u32_t highest;  // the end of the client's data sent so far
+  u16_t count;    // number of data segments sent so far, not counting retransmissions
+  u32_t resent;   // number of data segments retransmitted
+  u32_t acked;    // the latest acknowledgement from the server
+  u32_t flight;   // the most data ever unacknowledged
+  u16_t largest;  // the longest data segment
+
+  u16_t target;             // number (from 1) of the data segment to act on; 0 for none
+  CheckLink::Action action; // what to do with it ...
+  u8_t  times;              // ... for how many of its transmissions
+  u32_t target_seq;
+
+  u32_t sent_at[8];         // times at which the target was (re)transmitted
+  u8_t  sent_count;
+
+  u32_t sacks;    // number of the server's ACKs with SACK blocks
+
+  u32_t shift;    // added to the client's sequence numbers on the wire
+  u32_t wrap_at;  // if non-zero, the shift puts the wrap this many bytes into the data
+  bool  bBefore;  // whether sequence numbers were seen on the wire just before the wrap ...
+  bool  bAfter;   // ... and just after
+
+  u32_t fin_end;  // the sequence number just after the server's FIN, if seen
+  u32_t fins;     // number of FINs from the server
+  u32_t fin_acks; // number of the client's ACKs of the server's FIN
+  bool  bDropFinAck;
+
+  Segments (const CheckLink & link, u16_t client_port) :
+    outward(&link),
+    port(client_port),
+    highest(0),
+    count(0),
+    resent(0),
+    acked(0),
+    flight(0),
+    largest(0),
+    target(0),
+    action(CheckLink::a_Deliver),
+    times(0),
+    target_seq(0),
+    sent_count(0),
+    sacks(0),
+    shift(0),
+    wrap_at(0),
+    bBefore(false),
+    bAfter(false),
+    fin_end(0),
+    fins(0),
+    fin_acks(0),
+    bDropFinAck(false)
+  {
+    // ...
+  }
+
+  virtual CheckLink::Action link_filter (const CheckLink & link, IP_Buffer & packet) {
+    if (!packet.ip().is_TCP ()) {
+      return CheckLink::a_Deliver;
+    }
+
+    IP_Header_TCP & tcp = packet.tcp ();
+
+    bool bOutward = (&link == outward);
+
+    if ((u16_t) (bOutward ? tcp.source () : tcp.destination ()) != port) {
+      return CheckLink::a_Deliver;
+    }
+
+    CheckLink::Action result = CheckLink::a_Deliver;
+
+    u32_t seq_no = tcp.seq_no ();
+    u16_t length = packet.tcp_data_length ();
+
+    if (bOutward) {
+      if (tcp.flag_syn ()) {
+	highest = tcp_seq_add (seq_no, 1);
+
+	if (wrap_at) {
+	  shift = (u32_t) 0 - wrap_at - highest;
+	}
+      }
+      if (length) {
+	if (largest < length) {
+	  largest = length;
+	}
+	if (tcp_seq_lt (seq_no, highest)) {
+	  ++resent;
+	} else {
+	  highest = tcp_seq_add (seq_no, length);
+
+	  if (++count == target) {
+	    target_seq = seq_no;
+	  }
+	  if (acked && (flight < tcp_seq_diff (highest, acked))) {
+	    flight = tcp_seq_diff (highest, acked);
+	  }
+	}
+	if (target && (count >= target) && (seq_no == target_seq)) {
+	  if (sent_count < sizeof (sent_at) / sizeof (sent_at[0])) {
+	    sent_at[sent_count++] = ip_arch_millis ();
+	  }
+	  if (sent_count <= times) {
+	    result = action;
+	  }
+	}
+      }
+      if (fin_end && tcp.flag_ack () && !tcp.flag_fin () && !length && (tcp.ack_no () == fin_end)) {
+	if (!fin_acks++ && bDropFinAck) {
+	  result = CheckLink::a_Drop;
+	}
+      }
+      if (shift) {
+	u32_t wire = tcp_seq_add (seq_no, shift);
+
+	if (length && (wire >= 0xFFFF0000UL)) {
+	  bBefore = true;
+	}
+	if (length && (wire < 0x10000UL)) {
+	  bAfter = true;
+	}
+	tcp.seq_no () = wire;
+	packet.tcp_finalise ();
+      }
+    } else {
+      if (tcp.flag_fin ()) {
+	fin_end = tcp_seq_add (seq_no, length + 1);
+	++fins;
+      }
+
+      u8_t option_length;
+      const u8_t * option = packet.tcp_option (IP_TCP_Option_SACK, option_length);
+
+      if (option) {
+	++sacks;
+      }
+      if (shift) {
+	tcp.ack_no () = tcp_seq_add (tcp.ack_no (), (u32_t) 0 - shift);
+
+	for (u8_t edge = 0; option && (edge + 4 <= option_length); edge += 4) {
+	  ns32_t & value = *((ns32_t *) (option + edge));
+	  value = tcp_seq_add (value, (u32_t) 0 - shift);
+	}
+	packet.tcp_finalise ();
+      }
+      if (tcp.flag_ack ()) {
+	acked = tcp.ack_no ();
+      }
+    }
+    return result;
+  }
+};
+
+/* A client on A, connected to a server on B, with the filter on both links
+ */
+struct Session {
+  CheckPair & P;
+
+  u16_t port; // the server's, and also the client's
+
+  IP_Connection_Sized<CHECK_TCP_FIFO> client;
+  IP_Connection_Sized<CHECK_TCP_FIFO> server;
+
+  CheckSink client_sink;
+  CheckSink server_sink;
+
+  Segments segments;
+
+  u8_t pattern; // the next byte the client writes
+
+  Session (CheckPair & pair, u16_t server_port) :
+    P(pair),
+    port(server_port),
+    client(p_TCP, server_port),
+    server(p_TCP, server_port),
+    segments(pair.AB, server_port),
+    pattern(0)
+  {
+    P.AB.set_filter (&segments);
+    P.BA.set_filter (&segments);
+
+    server.set_event_listener (&server_sink);
+    P.B.connection_add (&server);
+    server.open ();
+
+    client.set_event_listener (&client_sink);
+    P.A.connection_add (&client);
+  }
+
+  ~Session () {
+    P.AB.set_filter (0);
+    P.BA.set_filter (0);
+
+    P.A.connection_remove (&client);
+    P.B.connection_remove (&server);
+  }
+
+  bool open () {
+    client.connect (P.B.host, port);
+
+    u32_t start = ip_arch_millis ();
+
+    while (!(client_sink.bOpened && server_sink.bOpened) && (ip_arch_millis () - start < 3000)) {
+      P.A.cycle ();
+      P.B.cycle ();
+    }
+    return client_sink.bOpened && server_sink.bOpened;
+  }
+
+  /* Write count bytes of the pattern, and wait (up to the time limit) for the server to have received them all,
+   * and for the client to have had them all acknowledged
+   */
+  bool send (u32_t count, u32_t milliseconds) {
+    u32_t total = server_sink.received + count;
+    u32_t start = ip_arch_millis ();
+
+    while (((server_sink.received < total) || (segments.acked != segments.highest)) && (ip_arch_millis () - start < milliseconds)) {
+      u8_t data[64];
+
+      u16_t length = (count < sizeof (data)) ? (u16_t) count : (u16_t) sizeof (data);
+
+      for (u16_t c = 0; c < length; c++) {
+	data[c] = pattern + c;
+      }
+      length = client.write (data, length);
+
+      pattern += length;
+      count   -= length;
+
+      P.A.cycle ();
+      P.B.cycle ();
+    }
+    check_run (P.A, P.B, 10); // for the client to take in the last ACK
+
+    return (server_sink.received == total) && !server_sink.errors;
+  }
+};
+
+/* Sliding window: several segments in flight at once, with the sequence numbers wrapping around part way through
+ */
+static void check_tcp_window (CheckPair & P) {
+  Session S(P, 81);
+
+  S.segments.wrap_at = 2000;
+
+  check ("connection opened", S.open ());
+  check ("data received intact across the sequence number wrap", S.send (8000, 5000));
+  check ("sequence numbers wrapped around on the wire", S.segments.bBefore && S.segments.bAfter);
+  check ("more than one segment in flight", S.segments.flight > S.segments.largest);
+  check ("nothing retransmitted", !S.segments.resent && !S.client.retransmissions () && !S.client.fast_retransmissions ());
+}
+
+/* Retransmission timeout: a segment lost three times is resent after exponentially increasing timeouts, and its
+ * eventual acknowledgement gives no round-trip time sample, since it's ambiguous which transmission it's for (Karn)
+ */
+static void check_tcp_timeout (CheckPair & P) {
+  Session S(P, 82);
+
+  check ("connection opened", S.open ());
+  check ("round-trip time measured", S.send (1000, 3000) && S.client.rtt_samples ());
+
+  u32_t samples = S.client.rtt_samples ();
+  u16_t rtt_max = S.client.rtt_max ();
+
+  S.segments.target = S.segments.count + 1;
+  S.segments.action = CheckLink::a_Drop;
+  S.segments.times  = 3;
+
+  check ("segment delivered after three timeouts", S.send (40, 10000) && (S.client.retransmissions () == 3) && (S.segments.sent_count == 4));
+
+  u32_t gap_1 = S.segments.sent_at[1] - S.segments.sent_at[0];
+  u32_t gap_2 = S.segments.sent_at[2] - S.segments.sent_at[1];
+  u32_t gap_3 = S.segments.sent_at[3] - S.segments.sent_at[2];
+
+  check ("timeout doubled after each retransmission", (2 * gap_2 >= 3 * gap_1) && (2 * gap_3 >= 3 * gap_2));
+  check ("no sample from the retransmitted segment", (S.client.rtt_samples () == samples) && (S.client.rtt_max () == rtt_max));
+
+  u16_t backed_off = S.client.retransmit_timeout ();
+
+  check ("next segment delivered first time", S.send (40, 3000) && (S.client.retransmissions () == 3));
+  check ("new sample taken, and the backoff cleared", (S.client.rtt_samples () > samples) && (S.client.retransmit_timeout () < backed_off));
+}
+
+/* Out-of-order delivery: a segment overtaken by the next is held by the server, which reports what it holds in SACK
+ * blocks, and passes both on in order once the gap is filled; nothing needs to be resent
+ */
+static void check_tcp_reorder (CheckPair & P) {
+  Session S(P, 83);
+
+  S.segments.target = 3;
+  S.segments.action = CheckLink::a_Hold;
+  S.segments.times  = 1;
+
+  check ("connection opened", S.open ());
+  check ("data received intact and in order", S.send (2000, 3000));
+  check ("segment overtaken by the next", S.segments.sent_count == 1);
+  check ("out-of-order segment reported in SACK blocks", S.segments.sacks > 0);
+  check ("nothing retransmitted", !S.segments.resent && !S.client.retransmissions () && !S.client.fast_retransmissions ());
+}
+
+/* Fast retransmit: a lost segment is resent on the third duplicate ACK, well before the retransmission timeout. The
+ * loss is the first of a full window sent after a pause, so that each of the three segments after it provokes a
+ * duplicate ACK.
+ */
+static void check_tcp_fast (CheckPair & P) {
+  Session S(P, 84);
+
+  check ("connection opened", S.open ());
+  check ("congestion window opened", S.send (2000, 3000));
+
+  S.segments.target = S.segments.count + 1;
+  S.segments.action = CheckLink::a_Drop;
+  S.segments.times  = 1;
+
+  check ("data received intact", S.send (2000, 3000));
+  check ("segment lost once", S.segments.sent_count == 2);
+  check ("lost segment resent on duplicate ACKs", (S.client.fast_retransmissions () == 1) && !S.client.retransmissions ());
+  check ("resent before the retransmission timeout", S.segments.sent_at[1] - S.segments.sent_at[0] < IP_TCP_RTO_Min);
+}
+
+/* Teardown: the client closes first, and its connection goes into the manager's TIME_WAIT table; the client's last
+ * ACK is lost, so the server resends its FIN, which is answered from the TIME_WAIT table
+ */
+static void check_tcp_time_wait (CheckPair & P) {
+  Session S(P, 85);
+
+  check ("connection opened", S.open ());
+  check ("data received intact", S.send (500, 3000));
+
+  u32_t added = P.A.time_wait ().added ();
+
+  S.segments.bDropFinAck = true;
+
+  S.client.close ();
+
+  check_run (P.A, P.B, 5000, &S.server_sink.bClosed);
+
+  check ("client closed, and in TIME_WAIT", S.client_sink.bClosed && (P.A.time_wait ().added () == added + 1) && P.A.time_wait ().count ());
+  check ("server's FIN resent after the final ACK was lost", S.segments.fins == 2);
+  check ("resent FIN acknowledged from TIME_WAIT", S.segments.fin_acks == 2);
+  check ("server closed", S.server_sink.bFinished && S.server_sink.bClosed);
+}
+
+void check_tcp () {
+  CheckPair * P = new CheckPair;
+
+  P->learn_routes ();
+
+  check_tcp_window (*P);
+  check_tcp_timeout (*P);
+  check_tcp_reorder (*P);
+  check_tcp_fast (*P);
+  check_tcp_time_wait (*P);
+
+  delete P;
+}
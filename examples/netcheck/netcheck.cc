@@ -0,0 +1,306 @@
+/* Copyright (c) 2018 Francis James Franklin
+ * 
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided
+ * that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and
+ *    the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ *    the following disclaimer in the documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* netcheck: self-checks of NetIP, run over in-process links (and, for the gateway, the host's loopback interface).
+ *
+ * usage: netcheck [group ...]
+ *
+ * Each group of checks is run in turn (by default, all of them), and each check reports ok or FAIL; netcheck
+ * fails (exit status 1) if any check does.
+ */
+
+#include <cstdio>
+#include <cstring>
+
+#include "netcheck.hh"
+
+#define CHECK_LINK_SPACING 2 // minimum time (in milliseconds) between packets arriving
+
+static int check_count = 0;
+static int check_failures = 0;
+
+void check (const char * what, bool bOkay) {
+  ++check_count;
+
+  if (!bOkay) {
+    ++check_failures;
+  }
+  printf ("  %-4s %s\n", bOkay ? "ok" : "FAIL", what);
+}
+
+void check_run (IP_Manager & A, IP_Manager & B, u32_t milliseconds, const bool * bDone) {
+  u32_t start = ip_arch_millis ();
+
+  while (ip_arch_millis () - start < milliseconds) {
+    if (bDone && *bDone) {
+      break;
+    }
+    A.cycle ();
+    B.cycle ();
+  }
+}
+
+CheckLink::CheckLink () :
+  peer(0),
+  filter(0),
+  bHeld(false),
+  bOvertaken(false),
+  held_time(0),
+  inbox_start(0),
+  inbox_count(0),
+  inbox_sent(0),
+  arrival_time(0),
+  packets_delivered(0),
+  packets_dropped(0)
+{
+  // ...
+}
+
+void CheckLink::connect (CheckLink * other) {
+  peer = other;
+  other->peer = this;
+}
+
+void CheckLink::deliver (const IP_Buffer & packet) {
+  if (peer->inbox_count == sizeof (peer->inbox) / sizeof (peer->inbox[0])) { // the far end isn't keeping up
+    ++packets_dropped;
+    return;
+  }
+  IP_Buffer & arrival = peer->inbox[(peer->inbox_start + peer->inbox_count++) % (sizeof (peer->inbox) / sizeof (peer->inbox[0]))];
+
+  arrival.clear ();
+  memcpy (arrival.tail (), packet.bytes (), packet.length ());
+  arrival.extend (packet.length ());
+
+  ++packets_delivered;
+}
+
+void CheckLink::update () {
+  const u8_t * byte;
+  u8_t flags;
+
+  while (slip_next_to_send (byte, flags)) {
+    if (flags & IP_SLIP_PACKET_FIRST) {
+      frame.clear ();
+      frame.bind (&manager ()); // so that a filter can finalise the packet again
+    }
+    if (flags & IP_SLIP_PACKET_LAST) { // the frame end; the packet is complete
+      switch (filter ? filter->link_filter (*this, frame) : a_Deliver) {
+      case a_Deliver:
+	if (bHeld && bOvertaken) { // only the one packet overtakes it
+	  bHeld = false;
+	  deliver (held);
+	}
+	deliver (frame);
+
+	if (bHeld) {
+	  bOvertaken = true;
+	}
+	break;
+
+      case a_Drop:
+	++packets_dropped;
+	break;
+
+      case a_Hold:
+	if (bHeld) { // only one packet is held at a time
+	  deliver (held);
+	}
+	held.clear ();
+	memcpy (held.tail (), frame.bytes (), frame.length ());
+	held.extend (frame.length ());
+	held_time = ip_arch_millis ();
+	bHeld = true;
+	bOvertaken = false;
+	break;
+      }
+      continue;
+    }
+
+    u8_t b = byte[0];
+
+    if (flags & IP_SLIP_ESCAPE) {
+      b = (byte[1] == IP_SLIP_ESC_END) ? IP_SLIP_END : IP_SLIP_ESC;
+    }
+    frame[frame.length ()] = b;
+  }
+
+  if (bHeld && bOvertaken && (ip_arch_millis () - held_time >= 10)) { // give the far end a chance to react first
+    bHeld = false;
+    deliver (held);
+  }
+
+  /* packets arrive one at a time, as on a serial line, so that the manager handles each before the next arrives
+   */
+  u32_t now = ip_arch_millis ();
+
+  if (!inbox_sent && (now - arrival_time < CHECK_LINK_SPACING)) {
+    return;
+  }
+
+  while (inbox_count && slip_can_receive ()) { // SLIP-encode the packets again, for the channel to decode
+    const IP_Buffer & arrival = inbox[inbox_start];
+
+    if (inbox_sent == arrival.length ()) {
+      slip_receive (IP_SLIP_END);
+
+      inbox_start = (inbox_start + 1) % (sizeof (inbox) / sizeof (inbox[0]));
+      inbox_sent = 0;
+      --inbox_count;
+
+      arrival_time = now;
+      break;
+    }
+
+    u8_t b = arrival[inbox_sent++];
+
+    if (b == IP_SLIP_END) {
+      slip_receive (IP_SLIP_ESC);
+      slip_receive (IP_SLIP_ESC_END);
+    } else if (b == IP_SLIP_ESC) {
+      slip_receive (IP_SLIP_ESC);
+      slip_receive (IP_SLIP_ESC_ESC);
+    } else {
+      slip_receive (b);
+    }
+  }
+}
+
+CheckPair::CheckPair () {
+  A.set_local_network_id (1);
+  B.set_local_network_id (2);
+
+  AB.connect (&BA);
+
+  A.channel_add (&AB);
+  B.channel_add (&BA);
+
+  A.buffers_add (pool_A, sizeof (pool_A) / sizeof (pool_A[0]));
+  B.buffers_add (pool_B, sizeof (pool_B) / sizeof (pool_B[0]));
+}
+
+/* The managers learn the routes from each other's pings, which start after a second or two
+ */
+void CheckPair::learn_routes () {
+  check_run (A, B, 3000);
+}
+
+CheckSink::CheckSink () :
+  expect(0),
+  received(0),
+  errors(0),
+  bOpened(false),
+  bFinished(false),
+  bClosed(false)
+{
+  // ...
+}
+
+bool CheckSink::buffer_received (const IP_Connection & connection, const IP_Buffer & buffer) {
+  (void) connection;
+  (void) buffer;
+  return false; // use the FIFO
+}
+
+bool CheckSink::buffer_to_send (const IP_Connection & connection, IP_Buffer & buffer) {
+  (void) connection;
+  (void) buffer;
+  return false;
+}
+
+void CheckSink::connection_has_data (const IP_Connection & connection) {
+  u8_t data[64];
+  u16_t count;
+
+  while ((count = const_cast<IP_Connection &> (connection).read (data, sizeof (data)))) {
+    for (u16_t c = 0; c < count; c++) {
+      if (data[c] != expect++) {
+	++errors;
+      }
+    }
+    received += count;
+  }
+}
+
+void CheckSink::connection_has_opened (const IP_Connection & connection) {
+  (void) connection;
+  bOpened = true;
+}
+
+void CheckSink::connection_has_closed (const IP_Connection & connection) {
+  (void) connection;
+  bClosed = true;
+}
+
+void CheckSink::connection_has_finished (const IP_Connection & connection) {
+  bFinished = true;
+  const_cast<IP_Connection &> (connection).close ();
+}
+
+struct CheckGroup {
+  const char * name;
+  void (*run) ();
+};
+
+static const CheckGroup groups[] = {
+  { "gateway", check_gateway },
+  { "tcp",     check_tcp     },
+  { "fifo",    check_fifo    },
+  { "async",   check_async   }
+};
+
+int main (int argc, char ** argv) {
+  const int group_count = sizeof (groups) / sizeof (groups[0]);
+
+  for (int arg = 1; arg < argc; arg++) {
+    bool bKnown = false;
+
+    for (int g = 0; g < group_count; g++) {
+      if (strcmp (argv[arg], groups[g].name) == 0) {
+	bKnown = true;
+      }
+    }
+    if (!bKnown) {
+      fprintf (stderr, "netcheck: unknown group of checks \"%s\"\n", argv[arg]);
+      return 1;
+    }
+  }
+
+  for (int g = 0; g < group_count; g++) {
+    bool bRun = (argc < 2);
+
+    for (int arg = 1; arg < argc; arg++) {
+      if (strcmp (argv[arg], groups[g].name) == 0) {
+	bRun = true;
+      }
+    }
+    if (bRun) {
+      printf ("%s:\n", groups[g].name);
+      groups[g].run ();
+    }
+  }
+
+  printf ("%d checks, %d failed\n", check_count, check_failures);
+
+  return check_failures ? 1 : 0;
+}
@@ -0,0 +1,147 @@
+/* Copyright (c) 2018 Francis James Franklin
+ * 
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided
+ * that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and
+ *    the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ *    the following disclaimer in the documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __netcheck_hh__
+#define __netcheck_hh__
+
+#include <netip/ip_manager.hh>
+
+/* Record the outcome of a check; failures are counted, and netcheck exits non-zero if there are any
+ */
+void check (const char * what, bool bOkay);
+
+/* Run the managers' cycles for (up to) the specified time, stopping early once bDone (if given) is true
+ */
+void check_run (IP_Manager & A, IP_Manager & B, u32_t milliseconds, const bool * bDone = 0);
+
+/* A lossless point-to-point link that passes whole packets to its peer, but lets a filter see each packet on the
+ * way, and drop it, or hold it back until the next one has been delivered (and had a few milliseconds to arrive).
+ */
+class CheckLink : public IP_Channel {
+public:
+  enum Action {
+    a_Deliver = 0,
+    a_Drop,
+    a_Hold
+  };
+
+  class Filter {
+  public:
+    /* offered each packet sent on the link; the packet may be modified, but must then be finalised again
+     */
+    virtual Action link_filter (const CheckLink & link, IP_Buffer & packet) = 0;
+
+    virtual ~Filter () {
+      // ...
+    }
+  };
+
+private:
+  CheckLink * peer;
+  Filter *    filter;
+
+  IP_Buffer frame; // the packet being sent
+  IP_Buffer held;  // a packet held back by the filter
+  bool      bHeld;
+  bool      bOvertaken; // whether a later packet has been delivered
+  u32_t     held_time;
+
+  IP_Buffer inbox[16]; // packets arriving, waiting to be received by our channel
+  u8_t  inbox_start;
+  u8_t  inbox_count;
+  u16_t inbox_sent;    // bytes of the first packet passed to the channel so far
+  u32_t arrival_time;  // time the last packet was passed to the channel
+
+  void deliver (const IP_Buffer & packet);
+
+public:
+  u32_t packets_delivered;
+  u32_t packets_dropped;
+
+  CheckLink ();
+
+  virtual ~CheckLink () {
+    // ...
+  }
+
+  void connect (CheckLink * other);
+
+  inline void set_filter (Filter * link_filter) {
+    filter = link_filter;
+  }
+
+  virtual void update ();
+};
+
+/* Two managers joined by a pair of links; A & B have local network IDs 1 & 2, so A is B's gateway
+ */
+struct CheckPair {
+  IP_Manager A;
+  IP_Manager B;
+
+  CheckLink AB;
+  CheckLink BA;
+
+  IP_Buffer pool_A[32];
+  IP_Buffer pool_B[32];
+
+  CheckPair ();
+
+  void learn_routes ();
+};
+
+/* Receives (and checks) a byte pattern on a connection, and closes the connection when the remote does.
+ */
+class CheckSink : public IP_Connection::EventListener {
+public:
+  u8_t  expect;
+  u32_t received;
+  u32_t errors;
+
+  bool bOpened;
+  bool bFinished;
+  bool bClosed;
+
+  CheckSink ();
+
+  virtual ~CheckSink () {
+    // ...
+  }
+
+  virtual bool buffer_received (const IP_Connection & connection, const IP_Buffer & buffer);
+  virtual bool buffer_to_send (const IP_Connection & connection, IP_Buffer & buffer);
+
+  virtual void connection_has_data (const IP_Connection & connection);
+  virtual void connection_has_opened (const IP_Connection & connection);
+  virtual void connection_has_closed (const IP_Connection & connection);
+  virtual void connection_has_finished (const IP_Connection & connection);
+};
+
+/* The groups of checks
+ */
+void check_gateway ();
+void check_tcp ();
+void check_fifo ();
+void check_async (); // built as C++20
+
+#endif /* ! __netcheck_hh__ */
@@ -219,9 +219,15 @@ public:
     case IP_Buffer::hs_IPv6_PacketTooShort:
       fputs ("hs_IPv6_PacketTooShort\n", stderr);
       break;
+    case IP_Buffer::hs_IPv6_Prefix:
+      fputs ("hs_IPv6_Prefix\n", stderr);
+      break;
     case IP_Buffer::hs_Protocol_Unsupported:
       fputs ("hs_Protocol_Unsupported\n", stderr);
       break;
+    case IP_Buffer::hs_Fragment:
+      fputs ("hs_Fragment\n", stderr);
+      break;
     case IP_Buffer::hs_Protocol_FrameError:
       fputs ("hs_Protocol_FrameError\n", stderr);
       break;
@@ -149,9 +149,9 @@ void setup () {
   IP_Manager & IP = IP_Manager::manager ();
 
 #ifndef ARDUINO_SAM_DUE // Arduino Due doesn't support EEPROM
-  IP.host.set_local_network_id (EEPROM.read (0));
+  IP.set_local_network_id (EEPROM.read (0));
 #else
-  IP.host.set_local_network_id (2); // clumsy workaround
+  IP.set_local_network_id (2); // clumsy workaround
 #endif
 
   IP_SerialChannel ser0(Serial);
@@ -0,0 +1,429 @@
+/* Copyright (c) 2018 Francis James Franklin
+ * 
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided
+ * that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and
+ *    the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ *    the following disclaimer in the documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* simnet: a simulated multi-hop serial network, for comparing TCP congestion control algorithms.
+ *
+ * Three IP_Manager instances run in the one process: a sender (A), a router (R) and a receiver (B). A and R are
+ * connected by a fast link, R and B by a slow one, so R's output queue towards B is the bottleneck. Several TCP
+ * connections stream data from A to B at the same time, and the goodput and R's queueing delay are reported for
+ * each algorithm in turn, followed by each flow's goodput.
+ *
+ * usage: simnet [reno|delay|both] [flows [seconds [fast-baud [slow-baud]]]]
+ *
+ * Each unacknowledged segment holds one of the sender's buffers, so every manager is given enough extra buffers (see
+ * IP_Manager::buffers_add()) for each flow's window; otherwise the first flow takes them all, and the others never
+ * get going. The connections have FIFOs large enough to fill a segment, so that it's the congestion window, and not
+ * the application, that limits the data in flight.
+ *
+ * simnet fails (exit status 1) if any flow doesn't open, or doesn't deliver any data, or - when both algorithms are
+ * run - if the delay-based algorithm doesn't improve on Reno, i.e., unless its average queueing delay at the
+ * bottleneck is lower, for at least SIMNET_GOODPUT_MIN percent of Reno's goodput.
+ */
+
+#include <cstdio>
+#include <cstring>
+
+#include <netip/ip_manager.hh>
+
+#include <stdlib.h>
+
+/* A point-to-point link with a fixed byte rate; bytes are passed to the peer's wire, and read from our own.
+ */
+class SimLink : public IP_Channel {
+private:
+  SimLink * peer;
+
+  u32_t rate;   // bytes per second
+  u32_t credit; // bytes we may send now, in units of 1/1000 byte
+  u32_t last;   // time of the last update
+
+  u8_t  wire[4096];
+  u16_t wire_start;
+  u16_t wire_count;
+
+  void deliver (u8_t byte) {
+    if (wire_count < sizeof (wire)) {
+      wire[(wire_start + wire_count++) % sizeof (wire)] = byte;
+    }
+  }
+
+public:
+  SimLink (u32_t bytes_per_second) :
+    peer(0),
+    rate(bytes_per_second),
+    credit(0),
+    last(ip_arch_millis ()),
+    wire_start(0),
+    wire_count(0)
+  {
+    // ...
+  }
+
+  virtual ~SimLink () {
+    // ...
+  }
+
+  void connect (SimLink * other) {
+    peer = other;
+    other->peer = this;
+  }
+
+  virtual void update () {
+    u32_t now = ip_arch_millis ();
+
+    credit += (now - last) * rate;
+    last = now;
+
+    const u8_t * byte;
+    u8_t flags;
+
+    while ((credit >= 1000) && slip_next_to_send (byte, flags)) {
+      peer->deliver (byte[0]);
+      credit -= 1000;
+
+      if (flags & IP_SLIP_ESCAPE) {
+	peer->deliver (byte[1]);
+	credit = (credit > 1000) ? (credit - 1000) : 0;
+      }
+    }
+    if (credit > 16000) { // idle; don't save up for a burst
+      credit = 16000;
+    }
+
+    while (wire_count && slip_can_receive ()) {
+      slip_receive (wire[wire_start]);
+
+      wire_start = (wire_start + 1) % sizeof (wire);
+      --wire_count;
+    }
+  }
+};
+
+/* Counts (and checks) the data received by a server connection.
+ */
+class Sink : public IP_Connection::EventListener {
+private:
+  u8_t expect;
+
+public:
+  u32_t received;
+  u32_t errors;
+
+  Sink () :
+    expect(0),
+    received(0),
+    errors(0)
+  {
+    // ...
+  }
+
+  virtual ~Sink () {
+    // ...
+  }
+
+  virtual bool buffer_received (const IP_Connection & connection, const IP_Buffer & buffer) {
+    (void) connection;
+    (void) buffer;
+    return false; // use the FIFO
+  }
+
+  virtual bool buffer_to_send (const IP_Connection & connection, IP_Buffer & buffer) {
+    (void) connection;
+    (void) buffer;
+    return false;
+  }
+
+  virtual void connection_has_data (const IP_Connection & connection) {
+    u8_t data[64];
+    u16_t count;
+
+    while ((count = const_cast<IP_Connection &> (connection).read (data, sizeof (data)))) {
+      for (u16_t c = 0; c < count; c++) {
+	if (data[c] != expect++) {
+	  ++errors;
+	}
+      }
+      received += count;
+    }
+  }
+
+  virtual void connection_has_opened (const IP_Connection & connection) {
+    (void) connection;
+  }
+
+  virtual void connection_has_closed (const IP_Connection & connection) {
+    (void) connection;
+  }
+};
+
+#define SIMNET_FLOWS_MAX 8
+#define SIMNET_FIFO_SIZE 256
+
+#define SIMNET_GOODPUT_MIN 90 // percent of Reno's goodput the delay-based algorithm must achieve
+
+#define SIMNET_BUFFERS_PER_FLOW (IP_TCP_Window_Segments + 2) // a full window, plus receiving & acknowledgements
+#define SIMNET_BUFFERS_MAX      (SIMNET_FLOWS_MAX * SIMNET_BUFFERS_PER_FLOW)
+
+struct SimNet {
+  IP_Manager A;
+  IP_Manager R;
+  IP_Manager B;
+
+  SimLink AR;
+  SimLink RA;
+  SimLink RB;
+  SimLink BR;
+
+  IP_Connection_Sized<SIMNET_FIFO_SIZE> client[SIMNET_FLOWS_MAX];
+  IP_Connection_Sized<SIMNET_FIFO_SIZE> server[SIMNET_FLOWS_MAX];
+
+  IP_Congestion_Reno  reno[SIMNET_FLOWS_MAX];
+  IP_Congestion_Delay delay[SIMNET_FLOWS_MAX];
+
+  Sink sink[SIMNET_FLOWS_MAX];
+
+  u8_t pattern[SIMNET_FLOWS_MAX];
+
+  IP_Buffer pool_A[SIMNET_BUFFERS_MAX];
+  IP_Buffer pool_R[SIMNET_BUFFERS_MAX];
+  IP_Buffer pool_B[SIMNET_BUFFERS_MAX];
+
+  SimNet (int flows, u32_t fast, u32_t slow) :
+    AR(fast),
+    RA(fast),
+    RB(slow),
+    BR(slow)
+  {
+    A.host.set_local_network_id (2);
+    R.host.set_local_network_id (3);
+    B.host.set_local_network_id (4);
+
+    AR.connect (&RA);
+    RB.connect (&BR);
+
+    A.channel_add (&AR);
+    R.channel_add (&RA);
+    R.channel_add (&RB);
+    B.channel_add (&BR);
+
+    u8_t extra = (u8_t) (flows * SIMNET_BUFFERS_PER_FLOW);
+
+    A.buffers_add (pool_A, extra);
+    R.buffers_add (pool_R, extra);
+    B.buffers_add (pool_B, extra);
+
+    /* CoDel's target should be at least the time to send a whole packet, which on a slow link is much longer
+     * than the default target
+     */
+    u32_t packet_time = ((IP_Buffer_WordCount << 1) * 1000) / slow;
+
+    RB.queue().set_codel ((u16_t) (packet_time << 1), (u16_t) (packet_time * 20));
+  }
+
+  void cycle () {
+    A.cycle ();
+    R.cycle ();
+    B.cycle ();
+  }
+};
+
+/* The headline results of a simulation, for comparing the algorithms
+ */
+struct SimResult {
+  u32_t  goodput;   // bytes per second, all flows together
+  double queue_avg; // average queueing delay at the bottleneck (in milliseconds)
+};
+
+static bool simulate (bool bDelay, int flows, int seconds, u32_t fast, u32_t slow, SimResult & result) {
+  SimNet * net = new SimNet (flows, fast, slow);
+
+  for (int f = 0; f < flows; f++) {
+    net->server[f].reset (p_TCP, 80 + f);
+    net->server[f].set_event_listener (net->sink + f);
+    net->B.connection_add (net->server + f);
+    net->server[f].open ();
+
+    net->client[f].reset (p_TCP, 1001 + f);
+    net->client[f].set_congestion_control (bDelay ? (IP_Congestion *) (net->delay + f) : (IP_Congestion *) (net->reno + f));
+    net->A.connection_add (net->client + f);
+
+    net->pattern[f] = 0;
+  }
+
+  /* The routers learn the routes from each other's pings, which start after a second or two
+   */
+  u32_t start = ip_arch_millis ();
+
+  while (ip_arch_millis () - start < 3000) {
+    net->cycle ();
+  }
+  for (int f = 0; f < flows; f++) {
+    net->client[f].connect (net->B.host, 80 + f);
+  }
+
+  /* Every flow must open before the measurement starts; anything else isn't a comparison
+   */
+  int opened = 0;
+
+  start = ip_arch_millis ();
+
+  while ((opened < flows) && (ip_arch_millis () - start < 5000)) {
+    net->cycle ();
+
+    opened = 0;
+    for (int f = 0; f < flows; f++) {
+      if (net->client[f].is_open ()) {
+	++opened;
+      }
+    }
+  }
+  if (opened < flows) {
+    for (int f = 0; f < flows; f++) {
+      if (!net->client[f].is_open ()) {
+	fprintf (stderr, "simnet: %s: flow %d (port %d) didn't open\n", bDelay ? "delay" : "reno", f, 80 + f);
+      }
+    }
+    delete net;
+    return false;
+  }
+
+  IP_Queue & bottleneck = net->RB.queue ();
+
+  u32_t samples = 0;
+  u32_t delay_total = 0;
+  u32_t last = 0;
+
+  start = ip_arch_millis ();
+
+  while (ip_arch_millis () - start < (u32_t) seconds * 1000) {
+    for (int f = 0; f < flows; f++) {
+      u8_t data[64];
+
+      for (u16_t c = 0; c < sizeof (data); c++) {
+	data[c] = net->pattern[f] + c;
+      }
+      net->pattern[f] += net->client[f].write (data, sizeof (data));
+    }
+    net->cycle ();
+
+    u32_t now = ip_arch_millis ();
+
+    if (last != now) { // sample the bottleneck's queueing delay once a millisecond
+      last = now;
+
+      delay_total += bottleneck.sojourn ();
+      ++samples;
+    }
+  }
+
+  u32_t received = 0;
+  u32_t errors = 0;
+  u32_t retransmits = 0;
+  u32_t recoveries = 0;
+
+  for (int f = 0; f < flows; f++) {
+    received    += net->sink[f].received;
+    errors      += net->sink[f].errors;
+    retransmits += net->client[f].retransmissions ();
+    recoveries  += net->client[f].fast_retransmissions () + net->client[f].partial_retransmissions ();
+  }
+
+  result.goodput   = received / seconds;
+  result.queue_avg = samples ? (double) delay_total / samples : 0.0;
+
+  printf ("%-6s %8lu %6.1f%% %8.1f %6u %6lu %6lu %6lu %6u %6lu\n",
+	  bDelay ? "delay" : "reno",
+	  (unsigned long) result.goodput,
+	  (100.0 * received) / ((double) slow * seconds),
+	  result.queue_avg,
+	  (unsigned) bottleneck.sojourn_max (),
+	  (unsigned long) retransmits,
+	  (unsigned long) recoveries,
+	  (unsigned long) (bottleneck.dropped () + bottleneck.overflowed ()),
+	  (unsigned) net->client[0].rtt_smoothed (),
+	  (unsigned long) errors);
+
+  bool bOK = true;
+
+  for (int f = 0; f < flows; f++) {
+    printf ("  %-4d %8lu %6.1f%% %15s %6lu %6lu %6s %6u %6lu\n",
+	    f,
+	    (unsigned long) (net->sink[f].received / seconds),
+	    received ? (100.0 * net->sink[f].received) / received : 0.0, // share of the total
+	    "",
+	    (unsigned long) net->client[f].retransmissions (),
+	    (unsigned long) (net->client[f].fast_retransmissions () + net->client[f].partial_retransmissions ()),
+	    "",
+	    (unsigned) net->client[f].rtt_smoothed (),
+	    (unsigned long) net->sink[f].errors);
+
+    if (!net->sink[f].received) {
+      fprintf (stderr, "simnet: %s: flow %d didn't deliver any data\n", bDelay ? "delay" : "reno", f);
+      bOK = false;
+    }
+  }
+
+  delete net;
+
+  return bOK;
+}
+
+int main (int argc, char ** argv) {
+  const char * which = (argc > 1) ? argv[1] : "both";
+
+  int flows   = (argc > 2) ? atoi (argv[2]) : 2;
+  int seconds = (argc > 3) ? atoi (argv[3]) : 10;
+
+  u32_t fast = (argc > 4) ? atol (argv[4]) / 10 : 11520; // bytes per second, at 10 bits per byte
+  u32_t slow = (argc > 5) ? atol (argv[5]) / 10 :  1920;
+
+  if ((flows < 1) || (flows > SIMNET_FLOWS_MAX) || (seconds < 1) || !fast || !slow) {
+    fprintf (stderr, "usage: simnet [reno|delay|both] [flows [seconds [fast-baud [slow-baud]]]]\n");
+    return 1;
+  }
+
+  printf ("%d flows for %d s; bottleneck %lu bytes/s\n\n", flows, seconds, (unsigned long) slow);
+  printf ("%-6s %8s %7s %8s %6s %6s %6s %6s %6s %6s\n", "algo", "goodput", "util", "q-avg", "q-max", "rto", "fast", "qdrop", "srtt", "errors");
+
+  bool bReno  = strcmp (which, "delay");
+  bool bDelay = strcmp (which, "reno");
+  bool bOK    = true;
+
+  SimResult reno;
+  SimResult delay;
+
+  if (bReno) {
+    bOK = simulate (false, flows, seconds, fast, slow, reno) && bOK;
+  }
+  if (bDelay) {
+    bOK = simulate (true, flows, seconds, fast, slow, delay) && bOK;
+  }
+  if (bOK && bReno && bDelay) {
+    if ((delay.queue_avg >= reno.queue_avg) || (delay.goodput * 100.0 < reno.goodput * (double) SIMNET_GOODPUT_MIN)) {
+      fprintf (stderr, "simnet: delay-based doesn't improve on reno: queueing %.1f vs %.1f ms, goodput %lu vs %lu bytes/s\n",
+	       delay.queue_avg, reno.queue_avg, (unsigned long) delay.goodput, (unsigned long) reno.goodput);
+      bOK = false;
+    }
+  }
+  return bOK ? 0 : 1;
+}
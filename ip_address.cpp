@@ -0,0 +1,108 @@
+/* Copyright (c) 2018 Francis James Franklin
+ * 
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided
+ * that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and
+ *    the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ *    the following disclaimer in the documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*! \file ip_address.cpp
+    \brief The IPv6 prefix table used by IP_Address.
+    
+    IPv6 addresses are stored as an index into a small static table of /64 prefixes plus the interface
+    identifier; see IP_Address. Each prefix in the table counts the addresses that refer to it, and its slot is
+    free for another prefix once there are none. The table is shared by all IP_Manager instances (and threads), so
+    it's guarded by a lock; a prefix's bytes don't change while it's referred to, so they can be read without one.
+*/
+
+#include "netip/ip_address.hh"
+
+#if IP_USE_IPv6
+
+static struct {
+  u8_t  bytes[8]; ///< The /64 prefix.
+  u16_t refs;     ///< The number of addresses referring to it; the slot is free if 0.
+} s_prefix[IP_Prefix_Count];
+
+static ip_arch_lock_t s_prefix_lock; ///< Guards the reference counts, and the prefixes of free slots.
+
+u8_t IP_Address::prefix_acquire (const u8_t * prefix) {
+  u8_t index = IP_Prefix_None;
+
+  ip_arch_lock (s_prefix_lock);
+
+  for (u8_t p = 0; p < IP_Prefix_Count; p++) {
+    if (!s_prefix[p].refs) {
+      if (index == IP_Prefix_None) {
+	index = p; // the first free slot, in case the prefix isn't in the table
+      }
+    } else if (!memcmp (s_prefix[p].bytes, prefix, 8)) {
+      index = p;
+      break;
+    }
+  }
+  if (index != IP_Prefix_None) {
+    if (!s_prefix[index].refs) {
+      memcpy (s_prefix[index].bytes, prefix, 8);
+    }
+    ++s_prefix[index].refs;
+  }
+
+  ip_arch_unlock (s_prefix_lock);
+
+  return index;
+}
+
+void IP_Address::prefix_retain (u8_t index) {
+  if (index != IP_Prefix_None) {
+    ip_arch_lock (s_prefix_lock);
+    ++s_prefix[index].refs;
+    ip_arch_unlock (s_prefix_lock);
+  }
+}
+
+void IP_Address::prefix_release (u8_t index) {
+  if (index != IP_Prefix_None) {
+    ip_arch_lock (s_prefix_lock);
+    --s_prefix[index].refs;
+    ip_arch_unlock (s_prefix_lock);
+  }
+}
+
+bool IP_Address::prefix_available (const u8_t * prefix) {
+  bool bAvailable = false;
+
+  ip_arch_lock (s_prefix_lock);
+
+  for (u8_t p = 0; p < IP_Prefix_Count; p++) {
+    if (!s_prefix[p].refs || !memcmp (s_prefix[p].bytes, prefix, 8)) {
+      bAvailable = true;
+      break;
+    }
+  }
+
+  ip_arch_unlock (s_prefix_lock);
+
+  return bAvailable;
+}
+
+const u8_t * IP_Address::prefix (u8_t index) {
+  return s_prefix[index].bytes;
+}
+
+#endif /* IP_USE_IPv6 */
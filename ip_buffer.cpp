@@ -30,6 +30,12 @@
 
 #include "netip/ip_manager.hh"
 
+/** The IP_Manager the buffer belongs to; if unbound, the default IP_Manager::manager().
+ */
+IP_Manager & IP_Buffer::manager () const {
+  return owner ? *owner : IP_Manager::manager ();
+}
+
 /** Used to determine the validity of incoming packets.
  * \return hs_Okay if the packet is valid UDP/IP or TCP/IP; hs_EchoRequest or hs_EchoReply for ICMP; all other return values indicate the packet is invalid.
  */
@@ -53,62 +59,68 @@ IP_Buffer::HeaderSniff IP_Buffer::sniff () const {
 
   // DEBUG_PRINT ("IP_Buffer::sniff\n");
 
+  if (version == 6) {
 #if IP_USE_IPv6
-  DEBUG_PRINT ("IP_Buffer::sniff: IPv6\n");
-  if (version == 4) {
-    return hs_IPv4;
-  }
-
-  if (length () < 40) { // buffer needs to be at least 40, just for the IP header
-    return hs_IPv6_FrameError;
-  }
+    DEBUG_PRINT ("IP_Buffer::sniff: IPv6\n");
+    if (length () < 40) { // buffer needs to be at least 40, just for the IP header
+      return hs_IPv6_FrameError;
+    }
 
-  if (ip().total_length () != length ()) {
-    return hs_IPv6_PacketTooShort;
-  }
+    if (ip().total_length () != length ()) {
+      return hs_IPv6_PacketTooShort;
+    }
 
-  payload_offset = 40;
-  payload_length = ip().length ();
+    if (!ip().v6().prefixes_available ()) { // the prefix table is full
+      return hs_IPv6_Prefix;
+    }
 
-#else // IP_USE_IPv6
-  // DEBUG_PRINT ("IP_Buffer::sniff: IPv4\n");
-  if (version == 6) {
+    payload_offset = 40;
+    payload_length = ip().payload_length ();
+#else
     return hs_IPv6;
-  }
+#endif
+  } else {
+#if IP_USE_IPv4
+    // DEBUG_PRINT ("IP_Buffer::sniff: IPv4\n");
+    if (length () < 20) { // buffer needs to be at least 20, just for the IP header
+      return hs_IPv4_FrameError;
+    }
 
-  if (length () < 20) { // buffer needs to be at least 20, just for the IP header
-    return hs_IPv4_FrameError;
-  }
+    const IP_Header_IPv4 & v4 = ip().v4 ();
 
-  u8_t header_length = ip().header_length ();
+    u8_t header_length = v4.header_length ();
 
-  if (header_length > length ()) {
-    return hs_IPv4_FrameError;
-  }
+    if (header_length > length ()) {
+      return hs_IPv4_FrameError;
+    }
 
-  if (ip().length () != length ()) {
-    return hs_IPv4_PacketTooShort;
-  }
+    if (v4.length () != length ()) {
+      return hs_IPv4_PacketTooShort;
+    }
 
-  payload_offset = header_length;
-  payload_length = length () - payload_offset;
+    payload_offset = header_length;
+    payload_length = length () - payload_offset;
 
-  // TODO: reject fragments as unsupported
+    checksum_sent = v4.checksum ();
+    v4.header (check);
 
-  checksum_sent = ip().checksum ();
-  ip().header (check);
+    if (header_length > 20) {
+      check_16 (check, 20, header_length - 20);
+    }
+    checksum_calc = check.checksum ();
 
-  if (header_length > 20) {
-    check_16 (check, 20, header_length - 20);
-  }
-  checksum_calc = check.checksum ();
+    if (checksum_sent != checksum_calc) {
+      return hs_IPv4_Checksum;
+    }
 
-  if (checksum_sent != checksum_calc) {
-    return hs_IPv4_Checksum;
+    if (fragment_more () || fragment_offset ()) { // the protocol header (if any) can only be checked once reassembled
+      return hs_Fragment;
+    }
+#else
+    return hs_IPv4;
+#endif
   }
 
-#endif // IP_USE_IPv6
-
   /* Protocol
    */
   if (ip().is_ICMP ()) {
@@ -214,17 +226,24 @@ IP_Buffer::HeaderSniff IP_Buffer::sniff () const {
   return hs_Protocol_Unsupported;
 }
 
+void IP_Buffer::header_finalise () {
+#if IP_USE_IPv4
+  if (!ip().is_IPv6 ()) {
+    Check16 check;
+
+    ip().v4().header (check);
+    ip().v4().checksum() = check.checksum ();
+  }
+#endif
+}
+
 void IP_Buffer::tcp_finalise () {
-  ip().source() = IP_Manager::manager().host;
+  ip().set_source (manager ().host_for (ip().version ()));
   ip().set_total_length (length ());
 
-  Check16 check;
+  header_finalise ();
 
-  if (!ip().is_IPv6 ()) {
-    ip().header (check);
-    ip().checksum() = check.checksum ();
-    check.clear ();
-  }
+  Check16 check;
 
   ip().pseudo_header (check);
 
@@ -233,48 +252,99 @@ void IP_Buffer::tcp_finalise () {
 
   tcp().header (check);
 
-  if (payload_length > tcp().header_length ()) {
-    check_16 (check, payload_offset + tcp().header_length ());
+  if (payload_length > 20) { // options, if any, and data
+    check_16 (check, payload_offset + 20);
   }
   tcp().checksum() = check.checksum ();
 }
 
+bool IP_Buffer::tcp_options (const u8_t * options, u8_t count) {
+  u8_t padded = (count + 3) & ~3;
+
+  if ((tcp().header_length () != 20) || (length () != tcp_data_offset ()) || (padded > 40) || (available () < padded)) {
+    return false;
+  }
+  append (options, count);
+
+  for (u8_t i = count; i < padded; i++) {
+    append ((const u8_t *) "\0", 1); // end of options list
+  }
+  tcp().set_data_offset (5 + (padded >> 2));
+
+  return true;
+}
+
+const u8_t * IP_Buffer::tcp_option (u8_t kind, u8_t & length) const {
+  u16_t offset = ip().header_length () + 20;
+  u16_t end    = tcp_data_offset ();
+
+  while (offset < end) {
+    u8_t k = buffer[offset];
+
+    if (k == IP_TCP_Option_End) {
+      break;
+    }
+    if (k == IP_TCP_Option_NOP) {
+      ++offset;
+      continue;
+    }
+    if ((offset + 1 >= end) || (buffer[offset+1] < 2) || (offset + buffer[offset+1] > end)) { // malformed
+      break;
+    }
+    if (k == kind) {
+      length = buffer[offset+1] - 2;
+      return buffer + offset + 2;
+    }
+    offset += buffer[offset+1];
+  }
+  return 0;
+}
+
 void IP_Buffer::udp_finalise () {
-  ip().source() = IP_Manager::manager().host;
+  udp_finalise (manager ().host_for (ip().version ()));
+}
+
+void IP_Buffer::udp_finalise (const IP_Address & source) {
+  Check16 data_check;
+
+  check_16 (data_check, udp_data_offset ()); // nothing, if there's no data
+
+  udp_finalise (source, data_check);
+}
+
+void IP_Buffer::udp_finalise (const IP_Address & source, const Check16 & data_check) {
+  ip().set_source (source);
   ip().set_total_length (length ());
 
-  Check16 check;
+  header_finalise ();
 
-  if (!ip().is_IPv6 ()) {
-    ip().header (check);
-    ip().checksum() = check.checksum ();
-    check.clear ();
-  }
+  Check16 check = data_check;
 
   ip().pseudo_header (check);
 
-  u16_t payload_offset = ip().header_length ();
-  u16_t payload_length = ip().payload_length ();
-
-  udp().length() = payload_length;
+  udp().length() = ip().payload_length ();
 
   udp().header (check);
 
-  if (payload_length > udp().header_length ()) {
-    check_16 (check, payload_offset + udp().header_length ());
-  }
   udp().checksum() = check.checksum ();
 }
 
+#if IP_USE_IPv4
+void IP_Buffer::fragment_finalise () {
+  ip().set_source (manager ().host_for (IP_Family_IPv4));
+  ip().set_total_length (length ());
+
+  header_finalise ();
+}
+#endif
+
 void IP_Buffer::icmp_finalise () {
+  header_finalise ();
+
   Check16 check;
 
   if (ip().is_IPv6 ()) {
     ip().pseudo_header (check);
-  } else {
-    ip().header (check);
-    ip().checksum() = check.checksum ();
-    check.clear ();
   }
 
   u16_t payload_offset = ip().header_length ();
@@ -293,10 +363,10 @@ void IP_Buffer::icmp_finalise () {
  * \param seq_no  The sequence number to use for the Echo Request.
  */
 void IP_Buffer::ping (const IP_Address & address, u16_t seq_no) {
-  defaults (p_ICMP);
+  defaults (p_ICMP, address.family ());
 
-  ip().source() = IP_Manager::manager().host;
-  ip().destination() = address;
+  ip().set_source (manager ().host_for (address.family ()));
+  ip().set_destination (address);
   ip().set_total_length (length ());
 
   icmp().type() = ip().protocol_echo_request ();
@@ -305,14 +375,14 @@ void IP_Buffer::ping (const IP_Address & address, u16_t seq_no) {
    */
   icmp().id()      = 0x73;
   icmp().seq_no()  = seq_no;
-  icmp().payload() = IP_Manager::manager().milliseconds ();
+  icmp().payload() = manager ().milliseconds ();
 
   icmp_finalise ();
 }
 
 void IP_Buffer::ping_to_pong () { // we do this in-place, i.e., convert in incoming request buffer to an outgoing reply buffer
-  ip().destination() = ip().source ();
-  ip().source() = IP_Manager::manager().host;
+  ip().set_destination (ip().source ());
+  ip().set_source (manager ().host_for (ip().version ()));
 
   icmp().type() = ip().protocol_echo_reply ();
 
@@ -324,7 +394,7 @@ void IP_Buffer::ping_to_pong () { // we do this in-place, i.e., convert in incom
  * \param seq_no     Returns the seq_no from the Echo Request/Reply.
  */
 void IP_Buffer::pong (u32_t & round_trip, u16_t & seq_no) const {
-  u32_t time = IP_Manager::manager().milliseconds ();
+  u32_t time = manager ().milliseconds ();
 
   round_trip = time - icmp().payload ();
 
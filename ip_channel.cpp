@@ -23,6 +23,10 @@
 
 #include "netip/ip_manager.hh"
 
+IP_Manager & IP_Channel::manager () const {
+  return owner ? *owner : IP_Manager::manager ();
+}
+
 bool IP_Channel::slip_next_to_send (const u8_t *& byte, u8_t & flags) { // returns true if there are byte(s) to be sent
   static const u8_t END = IP_SLIP_END;
   static const u8_t ESC_END[2] = { IP_SLIP_ESC, IP_SLIP_ESC_END };
@@ -31,7 +35,12 @@ bool IP_Channel::slip_next_to_send (const u8_t *& byte, u8_t & flags) { // retur
   flags = IP_SLIP_NONE;
 
   if (!buffer_out) {
-    buffer_out = chain_out.chain_pop (); // which may still be 0
+    bool bDrop;
+
+    while ((buffer_out = queue_out.pop (ip_arch_millis (), bDrop)) && bDrop) { // which may still be 0
+      buffer_out->unref ();                                                    // queue management has dropped it
+      manager ().add_to_spares (buffer_out);
+    }
 
     if (buffer_out) { // we have a new buffer; reset
       bytes_sent = 0;
@@ -46,7 +55,7 @@ bool IP_Channel::slip_next_to_send (const u8_t *& byte, u8_t & flags) { // retur
     /* don't need the buffer any more; set it free...
      */
     buffer_out->unref ();
-    IP_Manager::manager().add_to_spares (buffer_out);
+    manager ().add_to_spares (buffer_out);
     buffer_out = 0;
 
     return true; // there's data to send
@@ -80,7 +89,7 @@ bool IP_Channel::slip_next_to_send (const u8_t *& byte, u8_t & flags) { // retur
 
 bool IP_Channel::slip_can_receive () {
   if (slip_read_flags == IP_SLIP_READ_COMPLETE) {
-    if (!IP_Manager::manager().queue (buffer_in)) {
+    if (!manager ().queue (buffer_in)) {
       return false; // oops, need to hang onto the buffer
     }
     // DEBUG_PRINT ("~ ");
@@ -90,26 +99,22 @@ bool IP_Channel::slip_can_receive () {
   return true;
 }
 
-void IP_Channel::slip_receive (u8_t byte) {
+bool IP_Channel::slip_decode (IP_Buffer * buffer, u8_t & read_flags, u8_t byte) { // returns true if the packet is complete
   bool bAddByte = false;
   bool bPacketComplete = false;
 
-  if (slip_read_flags == IP_SLIP_READ_COMPLETE) { // should call slip_can_receive() to check before calling slip_receive().
-    return;
-  }
-
-  if (slip_read_flags & IP_SLIP_READ_ERROR) {
+  if (read_flags & IP_SLIP_READ_ERROR) {
     if (byte == IP_SLIP_END) { // end of discarded packet; reset
-      slip_read_flags = 0;
-      buffer_in->clear ();
+      read_flags = 0;
+      buffer->clear ();
     }
-  } else if (slip_read_flags & IP_SLIP_READ_ESCAPE) {
-    slip_read_flags = 0;
+  } else if (read_flags & IP_SLIP_READ_ESCAPE) {
+    read_flags = 0;
 
     switch (byte) {
     case IP_SLIP_END: // well, this is wrong; quietly discard packet
-      slip_read_flags = 0;
-      buffer_in->clear ();
+      read_flags = 0;
+      buffer->clear ();
       break;
 
     case IP_SLIP_ESC_END:
@@ -123,7 +128,7 @@ void IP_Channel::slip_receive (u8_t byte) {
       break;
 
     default: // set error flag
-      slip_read_flags = IP_SLIP_READ_ERROR;
+      read_flags = IP_SLIP_READ_ERROR;
       break;
     }
   } else {
@@ -133,7 +138,7 @@ void IP_Channel::slip_receive (u8_t byte) {
       break;
 
     case IP_SLIP_ESC:
-      slip_read_flags = IP_SLIP_READ_ESCAPE;
+      read_flags = IP_SLIP_READ_ESCAPE;
       break;
 
     default:
@@ -143,16 +148,24 @@ void IP_Channel::slip_receive (u8_t byte) {
   }
 
   if (bAddByte) {
-    if (buffer_in->available ()) {
-      buffer_in->append (&byte, 1);
+    if (buffer->available ()) {
+      buffer->append (&byte, 1);
     } else {
-      slip_read_flags = IP_SLIP_READ_ERROR;
+      read_flags = IP_SLIP_READ_ERROR;
     }
   }
-  if (bPacketComplete) {
+  return bPacketComplete;
+}
+
+void IP_Channel::slip_receive (u8_t byte) {
+  if (slip_read_flags == IP_SLIP_READ_COMPLETE) { // should call slip_can_receive() to check before calling slip_receive().
+    return;
+  }
+
+  if (slip_decode (buffer_in, slip_read_flags, byte)) {
     buffer_in->channel (channel_number); // note the buffer's originating channel
 
-    if (IP_Manager::manager().queue (buffer_in)) {
+    if (manager ().queue (buffer_in)) {
       // DEBUG_PRINT (" ~ ");
       slip_read_flags = 0;
       buffer_in->clear ();
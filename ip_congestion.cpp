@@ -0,0 +1,126 @@
+/* Copyright (c) 2018 Francis James Franklin
+ * 
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided
+ * that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and
+ *    the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ *    the following disclaimer in the documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*! \file ip_congestion.cpp
+    \brief Implementation of the congestion control algorithms.
+    
+    All windows and thresholds are in bytes; growth in slow start is limited to one segment per acknowledgement
+    (appropriate byte counting with L = 1, RFC 3465) so that a single cumulative ACK can't release a burst.
+*/
+
+#include "netip/ip_congestion.hh"
+
+void IP_Congestion::reset (u16_t mss) {
+  cc_mss      = mss ? mss : 1;
+  cc_cwnd     = 0;
+  cc_ssthresh = 0xFFFF;
+
+  for (u8_t i = 0; i < IP_TCP_CWnd_Initial; i++) {
+    grow (cc_mss);
+  }
+}
+
+void IP_Congestion::loss (u16_t in_flight, bool bTimeout) {
+  cc_ssthresh = in_flight >> 1;
+
+  if (cc_ssthresh < (cc_mss << 1)) {
+    cc_ssthresh = cc_mss << 1;
+  }
+  cc_cwnd = bTimeout ? cc_mss : cc_ssthresh;
+}
+
+void IP_Congestion::deflate (u16_t bytes) {
+  cc_cwnd = (cc_cwnd > bytes) ? (cc_cwnd - bytes) : 0;
+
+  grow (cc_mss);
+}
+
+void IP_Congestion::recovered () {
+  cc_cwnd = cc_ssthresh;
+}
+
+void IP_Congestion_Reno::reset (u16_t mss) {
+  IP_Congestion::reset (mss);
+
+  bytes_acked = 0;
+}
+
+void IP_Congestion_Reno::acked (u16_t bytes, u16_t in_flight) {
+  if (!limited (in_flight)) { // not using the window we have; don't grow it
+    return;
+  }
+  if (slow_start ()) {
+    grow ((bytes < cc_mss) ? bytes : cc_mss);
+    return;
+  }
+
+  /* congestion avoidance: one segment per window's worth of acknowledgements
+   */
+  bytes_acked = (bytes_acked > 0xFFFF - bytes) ? 0xFFFF : (bytes_acked + bytes);
+
+  if (bytes_acked >= cc_cwnd) {
+    bytes_acked -= cc_cwnd;
+    grow (cc_mss);
+  }
+}
+
+void IP_Congestion_Reno::loss (u16_t in_flight, bool bTimeout) {
+  IP_Congestion::loss (in_flight, bTimeout);
+
+  bytes_acked = 0;
+}
+
+void IP_Congestion_Delay::reset (u16_t mss) {
+  IP_Congestion::reset (mss);
+
+  rtt_base = 0xFFFF;
+}
+
+void IP_Congestion_Delay::acked (u16_t bytes, u16_t in_flight) {
+  if (slow_start () && limited (in_flight)) { // in congestion avoidance, the window is adjusted by rtt_sample() instead
+    grow ((bytes < cc_mss) ? bytes : cc_mss);
+  }
+}
+
+void IP_Congestion_Delay::rtt_sample (u16_t rtt, u16_t in_flight) {
+  if (!rtt) { // less than the clock resolution
+    rtt = 1;
+  }
+  if (rtt_base > rtt) {
+    rtt_base = rtt;
+  }
+
+  u32_t queued = ((u32_t) cc_cwnd * (rtt - rtt_base)) / rtt; // estimate of the bytes queued along the path
+
+  if (slow_start ()) {
+    if (queued > cc_mss) { // queues are building; leave slow start
+      cc_ssthresh = cc_cwnd;
+    }
+  } else if (queued < (u32_t) IP_TCP_Delay_Alpha * cc_mss) {
+    if (limited (in_flight)) {
+      grow (cc_mss);
+    }
+  } else if ((queued > (u32_t) IP_TCP_Delay_Beta * cc_mss) && (cc_cwnd >= (cc_mss << 1) + cc_mss)) {
+    cc_cwnd -= cc_mss;
+  }
+}
@@ -23,20 +23,33 @@
 
 #include "netip/ip_manager.hh"
 
+IP_Manager & IP_Connection::manager () const {
+  return owner ? *owner : IP_Manager::manager ();
+}
+
+void IP_Connection::schedule () {
+  if (owner && !bReady) {
+    owner->connection_ready (this);
+  }
+}
+
 void IP_Connection::reset (IP_Protocol p, u16_t port) {
   if (is_open ()) {
     close ();
   }
-  fifo_write.clear ();
+  fifo_write.drain (); // the connection is fifo_write's consumer
 
   if (buffer_tcp) {
     buffer_tcp->unref ();
-    IP_Manager::manager().add_to_spares (buffer_tcp);
+    manager ().add_to_spares (buffer_tcp);
     buffer_tcp = 0;
   }
+  tcp_unacked_clear ();
+  tcp_ooo_clear ();
 
   flags = 0;
   is_TCP (p == p_TCP);
+  set_nagle (IP_TCP_Nagle);
 
   port_local = port;
 }
@@ -44,46 +57,45 @@ void IP_Connection::reset (IP_Protocol p, u16_t port) {
 void IP_Connection::update () {
   if (is_open ()) {
 
-    if (EL && !fifo_read.is_empty ()) { // notify listener that data is waiting to be read
-      EL->connection_has_data (*this);
-    }
-    if (buffer_in) {
-      data_in_length -= buffer_in->push (fifo_read, data_in_offset);
+    if (data_arrived ()) { // notify listener (once) that new data is waiting to be read
+      data_arrived (false);
 
-      if (!data_in_length) {
-	IP_Manager::manager().add_to_spares (buffer_in);
-	buffer_in = 0;
+      if (EL && (!fifo_read.is_empty () || (datagram_mode () && datagram_count))) {
+	EL->connection_has_data (*this);
       }
     }
+    if (buffer_in || (datagram_count && !datagram_mode ())) { // the latter if datagram mode has been turned off
+      data_in_push ();
+    }
 
     if (is_TCP ()) {
-
-      if (tcp_send_ack ()) {
-	if (tcp_ack ()) {
-	  tcp_send_ack (false);
-	}
-      }
-
-      // TODO: // FIXME
-
+      tcp_update ();
     } else if (has_remote ()) { // UDP
 
-      if (!fifo_write.is_empty () || (EL && bSendRequested)) {
-	IP_Buffer * buffer_out = IP_Manager::manager().get_from_spares ();
+      bool bSendFIFO = false;
+
+      if (!fifo_write.is_empty ()) { // send a partial datagram once it's waited long enough, unless corked
+	bSendFIFO = flush_requested () || !fifo_write.available ()
+	  || (!is_corked () && (manager ().milliseconds () - write_time >= IP_UDP_Coalesce));
+      }
+      if (bSendFIFO || (EL && bSendRequested)) {
+	IP_Buffer * buffer_out = manager ().get_from_spares (bc_Transmit);
 
 	if (buffer_out) {
-	  buffer_out->defaults (p_UDP);
+	  buffer_out->defaults (p_UDP, remote.family ());
 
-	  if (!fifo_write.is_empty ()) {
+	  if (bSendFIFO) {
 	    buffer_out->pull (fifo_write);
+
+	    flush_requested (false);
 	  } else {
 	    bSendRequested = false;
 
 	    if (!EL->buffer_to_send (*this, *buffer_out)) { // it was asked for, but not used...
-	      IP_Manager::manager().add_to_spares (buffer_out);
+	      manager ().add_to_spares (buffer_out);
 	      buffer_out = 0;
 	    } else if (buffer_out->length () <= buffer_out->udp_data_offset ()) { // make sure something was added
-	      IP_Manager::manager().add_to_spares (buffer_out);
+	      manager ().add_to_spares (buffer_out);
 	      buffer_out = 0;
 	    }
 	  }
@@ -91,14 +103,14 @@ void IP_Connection::update () {
 	if (buffer_out) {
 	  buffer_out->channel (0);
 
-	  buffer_out->ip().destination() = remote;
+	  buffer_out->ip().set_destination (remote);
 
 	  buffer_out->udp().source() = port_local;
 	  buffer_out->udp().destination() = port_remote;
 
 	  buffer_out->udp_finalise ();
 
-	  IP_Manager::manager().forward (buffer_out); // send it
+	  manager ().forward (buffer_out); // send it
 	}
       }
     }
@@ -106,33 +118,50 @@ void IP_Connection::update () {
     
     if (is_TCP ()) {
 
+      if (tcp_closing ()) { // finish sending, then send the FIN
+	tcp_update ();
+      }
+
       if (tcp_send_syn ()) {  // we wish to set up a new connection
 	DEBUG_PRINT ("IP_Connection::update: send SYN\n");
 	if (!buffer_tcp) {    // we haven't send a SYN yet
-	  buffer_tcp = IP_Manager::manager().get_from_spares ();
+	  buffer_tcp = manager ().get_from_spares (bc_Control);
 
 	  if (buffer_tcp) {
 	    buffer_tcp->ref (); // don't return to spares after sending
 
+	    tcp_rtt_reset ();
+
 	    tcp.attempts  = 0;
-	    tcp.send_time = IP_Manager::manager().milliseconds ();
-	    tcp.seq_no    = tcp.send_time; // just a random (-ish) number
+	    tcp.ack_count = 0;
+	    tcp.snd_una   = tcp_seq_add (manager ().milliseconds (), 0); // just a random (-ish) number
+	    tcp.snd_nxt   = tcp_seq_add (tcp.snd_una, 1);   // the SYN counts as one byte
+	    tcp.recover   = tcp.snd_una;
+	    tcp.dupacks   = 0;
 
 	    tcp_prepare (buffer_tcp);
 
+	    tcp.mss = buffer_tcp->available (); // the maximum segment size
+
+	    CC->reset (tcp.mss);
+
 	    buffer_tcp->tcp().flag_syn (true);
 
-	    buffer_tcp->tcp().seq_no() = tcp.seq_no++;
+	    tcp_syn_options (buffer_tcp);
+
+	    buffer_tcp->tcp().seq_no() = tcp.snd_una;
+	    buffer_tcp->tcp().window_size() = tcp.rcv_wnd = tcp_window ();
 
 	    buffer_tcp->tcp_finalise ();
 	  }
 	}
 	if (buffer_tcp) { // set up a new connection
-	  ++tcp.attempts;
-
-	  IP_Manager::manager().forward (buffer_tcp); // send it
+	  if (!tcp.attempts) { // only time the first transmission
+	    tcp_rtt_start (tcp.snd_una);
+	  }
+	  manager ().forward (buffer_tcp); // send it
 
-	  timer.start (IP_Manager::manager (), 499); // TODO: 500?
+	  timer.start (manager (), tcp.rto);
 	  timeout_set (true);
 
 	  tcp_send_syn (false);
@@ -143,32 +172,44 @@ void IP_Connection::update () {
       if (tcp_send_syn_ack ()) {  // we wish to respond to a new connection
 	DEBUG_PRINT ("IP_Connection::update: send SYN-ACK\n");
 	if (!buffer_tcp) {        // we haven't send a SYN ACK yet
-	  buffer_tcp = IP_Manager::manager().get_from_spares ();
+	  buffer_tcp = manager ().get_from_spares (bc_Control);
 
 	  if (buffer_tcp) {
 	    buffer_tcp->ref ();   // don't return to spares after sending
 
+	    tcp_rtt_reset ();
+
 	    tcp.attempts  = 0;
-	    tcp.send_time = IP_Manager::manager().milliseconds ();
-	    tcp.seq_no    = tcp.send_time; // just a random (-ish) number
+	    tcp.ack_count = 0;
+	    tcp.snd_una   = tcp_seq_add (manager ().milliseconds (), 0); // just a random (-ish) number
+	    tcp.snd_nxt   = tcp_seq_add (tcp.snd_una, 1);   // the SYN counts as one byte
+	    tcp.recover   = tcp.snd_una;
+	    tcp.dupacks   = 0;
 
 	    tcp_prepare (buffer_tcp);
 
+	    tcp.mss = buffer_tcp->available (); // the maximum segment size
+
+	    CC->reset (tcp.mss);
+
 	    buffer_tcp->tcp().flag_syn (true);
-	    buffer_tcp->tcp().flag_ack (true);
 
-	    buffer_tcp->tcp().seq_no() = tcp.seq_no++;
-	    buffer_tcp->tcp().ack_no() = tcp.ack_no;
+	    tcp_syn_options (buffer_tcp);
+
+	    buffer_tcp->tcp().seq_no() = tcp.snd_una;
+
+	    tcp_stamp (buffer_tcp);
 
 	    buffer_tcp->tcp_finalise ();
 	  }
 	}
 	if (buffer_tcp) { // respond to a new connection
-	  ++tcp.attempts;
-
-	  IP_Manager::manager().forward (buffer_tcp); // send it
+	  if (!tcp.attempts) { // only time the first transmission
+	    tcp_rtt_start (tcp.snd_una);
+	  }
+	  manager ().forward (buffer_tcp); // send it
 
-	  timer.start (IP_Manager::manager (), 599); // TODO: 500?
+	  timer.start (manager (), tcp.rto);
 	  timeout_set (true);
 
 	  tcp_send_syn_ack (false);
@@ -186,21 +227,21 @@ void IP_Connection::update () {
 	}
       } else {
 	if (!fifo_write.is_empty ()) { // finish writing the buffered output
-	  IP_Buffer * buffer_out = IP_Manager::manager().get_from_spares ();
+	  IP_Buffer * buffer_out = manager ().get_from_spares (bc_Transmit);
 
 	  if (buffer_out) {
-	    buffer_out->defaults (p_UDP);
+	    buffer_out->defaults (p_UDP, remote.family ());
 	    buffer_out->pull (fifo_write);
 	    buffer_out->channel (0);
 
-	    buffer_out->ip().destination() = remote;
+	    buffer_out->ip().set_destination (remote);
 
 	    buffer_out->udp().source() = port_local;
 	    buffer_out->udp().destination() = port_remote;
 
 	    buffer_out->udp_finalise ();
 
-	    IP_Manager::manager().forward (buffer_out); // send it
+	    manager ().forward (buffer_out); // send it
 	  }
 	}
 	if (fifo_write.is_empty ()) { // finished writing; nothing else to do
@@ -213,6 +254,97 @@ void IP_Connection::update () {
       }
     }
   }
+  io_update ();
+
+  if (update_pending ()) { // stay in the manager's ready queue
+    schedule ();
+  }
+}
+
+bool IP_Connection::update_pending () const {
+  if (data_arrived () || io_pending ()) {
+    return true;
+  }
+  if (is_TCP ()) {
+    if (tcp_send_syn () || tcp_send_syn_ack ()) { // waiting for a spare buffer
+      return true;
+    }
+    if (!is_open () && !tcp_closing ()) { // idle, listening, or waiting for the handshake (or a timeout)
+      return false;
+    }
+    if (tcp_send_ack () || tcp_send_probe () || tcp.ack_count || (tcp_rtx_next < tcp_rtx_end)) { // incl. a delayed ACK
+      return true;
+    }
+    u16_t limit = tcp_send_limit (); // otherwise output waits for an ACK (or the timer) to open the window
+
+    if (fifo_write.is_empty ()) {
+      return tcp_send_fin () && limit;
+    }
+    return limit && (tcp_send_partial () || !fifo_write.available () || (fifo_write.count () >= limit));
+  }
+  if (!is_open ()) {
+    return is_busy ();     // finishing the buffered output
+  }
+  if (!has_remote ()) {
+    return false;
+  }
+  if (EL && bSendRequested) { // waiting for a spare buffer
+    return true;
+  }
+  return !fifo_write.is_empty () && (flush_requested () || !is_corked () || !fifo_write.available ());
+}
+
+/* TCP data transfer, while the connection is open, or has been closed by the application but not yet by TCP
+ */
+void IP_Connection::tcp_update () {
+  if (tcp_ooo_count) {
+    if (!manager ().buffers_spare ()) { // we mustn't stop the channels receiving, or the gap will never be filled
+      IP_Buffer * segment = tcp_ooo[--tcp_ooo_count];
+
+      segment->unref ();
+      manager ().add_to_spares (segment);
+    }
+    tcp_ooo_drain (); // in case the application has made space in fifo_read
+  }
+  if (tcp_rtx_next < tcp_rtx_end) { // recovering from a loss; resend the rest as the congestion window allows
+    tcp_retransmit ();
+  }
+  while (!fifo_write.is_empty ()) { // send as much of the buffered output as the window (and Nagle) allows
+    u16_t length = 0;
+
+    if (!tcp_send_segment (0, length, tcp_send_partial ())) {
+      break;
+    }
+  }
+  if (fifo_write.is_empty ()) {
+    flush_requested (false);
+
+    if (tcp_send_fin ()) { // closing, and nothing left to carry the FIN; send it by itself
+      u16_t length = 0;
+
+      tcp_send_segment (0, length, true);
+    }
+  } else if (tcp_send_probe ()) {
+    tcp_probe ();
+  } else if (!tcp.snd_wnd && !tcp_unacked_count && !timeout_set ()) { // the remote's window is closed; the update that
+    timer.start (manager (), (tcp.rto > IP_TCP_Probe_Min) ? tcp.rto : IP_TCP_Probe_Min); // opens it could be lost,
+    timeout_set (true);                                                                  // so probe it in a while
+  }
+
+  /* if the application has made enough space in fifo_read since the window was last advertised, tell the remote
+   */
+  if ((tcp_window () > tcp.rcv_wnd) && (tcp_window () - tcp.rcv_wnd >= (fifo_read.capacity () >> 1))) {
+    tcp_send_ack (true);
+  }
+
+  /* a delayed ACK that no outgoing data has carried
+   */
+  if (tcp.ack_count && !tcp_send_ack () && (manager ().milliseconds () - tcp.ack_time >= IP_TCP_Ack_Delay)) {
+    tcp_send_ack (true);
+  }
+  if (tcp_send_ack ()) {
+    tcp_ack (); // clears the flag, if it can send the ACK
+  }
 }
 
 u16_t IP_Connection::read (u8_t * ptr, u16_t length) {
@@ -223,56 +355,364 @@ u16_t IP_Connection::read (u8_t * ptr, u16_t length) {
   u16_t count = fifo_read.read (ptr, length);
 
   while ((count < length) && buffer_in) {
-    data_in_length -= buffer_in->push (fifo_read, data_in_offset);
+    data_in_push ();
 
-    if (!data_in_length) {
-      IP_Manager::manager().add_to_spares (buffer_in);
-      buffer_in = 0;
-    }
     count += fifo_read.read (ptr + count, length - count);
   }
+  if (count) { // space has been made, for the next datagram or for a window update
+    schedule ();
+  }
   return count;
 }
 
+bool IP_Connection::set_fifo_buffers (u8_t * read_buffer, u16_t read_size, u8_t * write_buffer, u16_t write_size) {
+  if (!is_idle () || buffer_in || datagram_count || !read_buffer || !write_buffer) {
+    return false;
+  }
+  fifo_read.attach (read_buffer, read_size);
+  fifo_write.attach (write_buffer, write_size);
+  return true;
+}
+
 u16_t IP_Connection::write (const u8_t * ptr, u16_t length) {
   if (!is_open () || !has_remote ()) {
     return 0;
   }
 
+  if (fifo_write.is_empty ()) {
+    write_time = manager ().milliseconds ();
+  }
+
   u16_t count = fifo_write.write (ptr, length);
 
-  if (count < length) {
-    IP_Buffer * buffer_out = IP_Manager::manager().get_from_spares ();
+  if (count) {
+    schedule ();
+  }
+  if (is_TCP ()) {
+    while (count < length) { // the FIFO is full; send segments directly, as far as the window (and Nagle) allows
+      u16_t extra = length - count;
+
+      if (!tcp_send_segment (ptr + count, extra, tcp_send_partial ())) {
+	break;
+      }
+      count += extra;
+      count += fifo_write.write (ptr + count, length - count);
+    }
+  } else if (count < length) { // UDP
+    IP_Buffer * buffer_out = manager ().get_from_spares (bc_Transmit);
 
     if (buffer_out) {
-      if (is_TCP ()) {
+      buffer_out->defaults (p_UDP, remote.family ());
+      buffer_out->pull (fifo_write);
+
+      if (length - count > buffer_out->available ()) {
+	length = count + buffer_out->available ();
+      }
+      count += buffer_out->append (ptr + count, length - count);
 
-	// TODO: // FIXME
+      buffer_out->channel (0);
 
-      } else { // UDP
+      buffer_out->ip().set_destination (remote);
 
-	buffer_out->defaults (p_UDP);
-	buffer_out->pull (fifo_write);
+      buffer_out->udp().source() = port_local;
+      buffer_out->udp().destination() = port_remote;
 
-	if (length - count > buffer_out->available ()) {
-	  length = count + buffer_out->available ();
-	}
-	count += buffer_out->append (ptr + count, length - count);
+      buffer_out->udp_finalise ();
+
+      manager ().forward (buffer_out); // send it
+
+      write_time = manager ().milliseconds ();
+    }
+  }
+  return count;
+}
+
+bool IP_Connection::send_datagram (const u8_t * data, u16_t length) {
+  if (!is_open () || !has_remote () || is_TCP ()) {
+    return false;
+  }
+  return udp_send (remote, port_remote, data, length);
+}
+
+bool IP_Connection::send_to (const IP_Address & destination, u16_t port, const u8_t * data, u16_t length) {
+  if (!is_open () || is_TCP () || !port_local || !port) {
+    return false;
+  }
+  return udp_send (destination, port, data, length);
+}
+
+/* Send a UDP datagram to any destination; datagrams too long for a single buffer are sent as (IPv4) fragments
+ */
+bool IP_Connection::udp_send (const IP_Address & destination, const ns16_t & port, const u8_t * data, u16_t length) {
+  IP_Manager & M = manager ();
+
+  IP_Buffer * buffer = M.get_from_spares (bc_Transmit);
+
+  if (!buffer) {
+    return false;
+  }
+  buffer->defaults (p_UDP, destination.family ());
+
+  if (length <= buffer->available ()) { // fits in a single buffer
+    buffer->append (data, length);
+
+    buffer->channel (0);
+
+    buffer->ip().set_destination (destination);
+
+    buffer->udp().source() = port_local;
+    buffer->udp().destination() = port;
+
+    buffer->udp_finalise ();
+
+    M.forward (buffer); // send it
+    return true;
+  }
+
+#if IP_USE_IPv4
+  if (destination.is_IPv6 ()) {
+    M.add_to_spares (buffer); // fragmentation is IPv4 only
+    return false;
+  }
+
+  u16_t fragment_max = (buffer->available () + 8) & ~7; // payload per fragment; must be a multiple of 8
+  u32_t udp_length   = 8 + (u32_t) length;
+
+  if ((udp_length > 0xFFFF - 20) || ((u32_t) M.buffers_spare () + 1 < (udp_length + fragment_max - 1) / fragment_max)) {
+    M.add_to_spares (buffer);
+    return false;
+  }
+
+  /* the UDP header, with a checksum for the whole datagram, goes at the start of the first fragment
+   */
+  IP_Header_UDP udp;
+
+  udp.clear ();
+  udp.source() = port_local;
+  udp.destination() = port;
+  udp.length() = (u16_t) udp_length;
+
+  Check16 check;
+
+  M.host_for (IP_Family_IPv4).check (check);
+  destination.check (check);
+
+  check += buffer->ip().protocol ();
+  check += (u16_t) udp_length;
+
+  udp.header (check);
+
+  const Buffer B((u8_t *) data, length, true /* full buffer */);
+  B.check_16 (check, 0);
+
+  udp.checksum() = check.checksum ();
+  if (!udp.checksum ()) {
+    udp.checksum() = 0xFFFF;
+  }
+
+  u16_t id = M.ip_id_next ();
+
+  for (u16_t offset = 0; offset < udp_length; ) {
+    if (!buffer && !(buffer = M.get_from_spares (bc_Transmit))) {
+      return false; // the receiver will discard the fragments sent so far once they time out
+    }
+
+    u16_t count = udp_length - offset;
+    bool  bMore = (count > fragment_max);
+
+    if (bMore) {
+      count = fragment_max;
+    }
+
+    buffer->fragment_defaults (p_UDP, id, offset, bMore);
+
+    buffer->channel (0);
+
+    buffer->ip().set_destination (destination);
+
+    if (!offset) {
+      buffer->append (udp.buffer, 8);
+      buffer->append (data, count - 8);
+    } else {
+      buffer->append (data + offset - 8, count);
+    }
+    buffer->fragment_finalise ();
+
+    M.forward (buffer); // send it
+    buffer = 0;
+
+    offset += count;
+  }
+  return true;
+#else
+  M.add_to_spares (buffer); // fragmentation is IPv4 only
+  return false;
+#endif
+}
+
+/* A buffer for a single-buffer datagram in a batch, addressed to the destination; the headers are laid out for the
+ * first, and copied for the rest (as long as the address family is the same). Returns 0 if there are no spare buffers.
+ */
+IP_Buffer * IP_Connection::udp_batch_buffer (UDP_Template & T, const IP_Address & destination, u16_t port) {
+  IP_Buffer * buffer = manager ().get_from_spares (bc_Transmit);
+
+  if (!buffer) {
+    return 0;
+  }
+  if (T.length && (T.family == destination.family ())) {
+    buffer->clear ();
+    buffer->append (T.header, T.length);
+  } else {
+    buffer->defaults (p_UDP, destination.family ());
+    buffer->udp().source() = port_local;
+
+    T.family = destination.family ();
+    T.length = buffer->read (0, T.header, buffer->length ());
+  }
+  buffer->channel (0);
+
+  buffer->ip().set_destination (destination);
+  buffer->udp().destination() = port;
+
+  return buffer;
+}
+
+u16_t IP_Connection::send_batch (const Datagram * datagrams, u16_t count) {
+  if (!is_open () || is_TCP () || !port_local) {
+    return 0;
+  }
+
+  IP_Manager & M = manager ();
+
+  UDP_Template T;
+  T.length = 0;
 
-	buffer_out->channel (0);
+  u16_t sent = 0;
 
-	buffer_out->ip().destination() = remote;
+  for ( ; sent < count; sent++) {
+    const Datagram & D = datagrams[sent];
 
-	buffer_out->udp().source() = port_local;
-	buffer_out->udp().destination() = port_remote;
+    if (!D.port) { // skip it; not allowed to send to port 0
+      continue;
+    }
+    IP_Buffer * buffer = udp_batch_buffer (T, *D.destination, D.port);
 
-	buffer_out->udp_finalise ();
+    if (!buffer) {
+      break;
+    }
+    if (D.length > buffer->available ()) { // too long for a single buffer with these headers
+      M.add_to_spares (buffer);
 
-	IP_Manager::manager().forward (buffer_out); // send it
+      if (!udp_send (*D.destination, D.port, D.data, D.length)) { // needs fragments
+	break;
       }
+      continue;
     }
+    buffer->append (D.data, D.length);
+    buffer->udp_finalise ();
+
+    M.forward (buffer); // send it
   }
-  return count;
+  return sent;
+}
+
+u16_t IP_Connection::send_to_each (const IP_Address * destinations, u16_t count, u16_t port, const u8_t * data, u16_t length) {
+  if (!is_open () || is_TCP () || !port_local || !port) {
+    return 0;
+  }
+  IP_Manager & M = manager ();
+
+  /* the data is the same for every datagram, and so is its contribution to the checksum
+   */
+  Check16 data_check;
+
+  const Buffer B((u8_t *) data, length, true /* full buffer */);
+  B.check_16 (data_check, 0);
+
+  UDP_Template T;
+  T.length = 0;
+
+  u16_t sent = 0;
+
+  for ( ; sent < count; sent++) {
+    IP_Buffer * buffer = udp_batch_buffer (T, destinations[sent], port);
+
+    if (!buffer) {
+      break;
+    }
+    if (length > buffer->available ()) { // too long for a single buffer with these headers
+      M.add_to_spares (buffer);
+
+      if (!udp_send (destinations[sent], port, data, length)) { // needs fragments
+	break;
+      }
+      continue;
+    }
+    buffer->append (data, length);
+    buffer->udp_finalise (M.host_for (destinations[sent].family ()), data_check);
+
+    M.forward (buffer); // send it
+  }
+  return sent;
+}
+
+IP_Buffer * IP_Connection::borrow (u16_t & capacity) {
+  capacity = 0;
+
+  if (!is_open () || !has_remote ()) {
+    return 0;
+  }
+  if (is_TCP () && (!fifo_write.is_empty () || !tcp_send_limit ())) { // the FIFO's contents must go first
+    return 0;
+  }
+
+  IP_Buffer * buffer = manager ().get_from_spares (bc_Transmit);
+
+  if (buffer) {
+    if (is_TCP ()) {
+      tcp_prepare (buffer);
+    } else {
+      buffer->channel (0);
+      buffer->defaults (p_UDP, remote.family ());
+    }
+    capacity = buffer->available ();
+
+    if (is_TCP () && (capacity > tcp_send_limit ())) {
+      capacity = tcp_send_limit ();
+    }
+  }
+  return buffer;
+}
+
+bool IP_Connection::commit (IP_Buffer * buffer) {
+  if (!is_open ()) {
+    return false;
+  }
+  if (is_TCP ()) {
+    u16_t count = buffer->length () - buffer->tcp_data_offset ();
+
+    if (!count || (count > tcp_send_limit ()) || !fifo_write.is_empty ()) {
+      return false;
+    }
+    tcp_send_new (buffer, count);
+    return true;
+  }
+  if (buffer->length () <= buffer->udp_data_offset ()) { // make sure something was added
+    return false;
+  }
+  buffer->ip().set_destination (remote);
+
+  buffer->udp().source() = port_local;
+  buffer->udp().destination() = port_remote;
+
+  buffer->udp_finalise ();
+
+  manager ().forward (buffer); // send it
+  return true;
+}
+
+void IP_Connection::give_back (IP_Buffer * buffer) {
+  manager ().add_to_spares (buffer);
 }
 
 bool IP_Connection::open () {
@@ -305,42 +745,83 @@ bool IP_Connection::open () {
 }
 
 void IP_Connection::close () {
+  schedule ();
+
+  if (is_TCP () && !is_open ()) {
+    if (tcp_closing ()) { // already closing
+      return;
+    }
+    if (is_busy ()) { // still setting up the connection; give up
+      tcp_closed (false);
+    } else if (tcp_server ()) { // stop listening
+      reset (p_TCP, port_local);
+    }
+    return;
+  }
+  if (is_TCP ()) { // send what's left of the output, then the FIN
+    if (!tcp_fin_received ()) {
+      tcp_active_close (true);
+    }
+    tcp_send_fin (true);
+    flush ();
+  }
   is_open (false);
   is_busy (true);
 
-  /* the only reason we would have buffer_in is if there is more data for the user
+  /* the only reason we would have buffer_in (or queued datagrams) is if there is more data for the user
    * - who has closed the connection now
    */
-  if (buffer_in) {
-    IP_Manager::manager().add_to_spares (buffer_in);
-    buffer_in = 0;
-  }
+  data_in_clear ();
 
   /* similarly for the read buffer
    */
-  fifo_read.clear ();
+  io_discard ();
 }
 
 bool IP_Connection::timeout () { // return true if the timer should be reset & retained
+  schedule (); // whatever happens next, update() will see to it
+
   if (!timeout_set ()) {
     // was the connection reset?
     return false;
   }
   if (tcp_syn_sent ()) {
     DEBUG_PRINT ("timeout while sending SYN.\n");
-    if (true /* tcp.attempts < 8 */) {
+    if (tcp_backoff ()) {
       tcp_send_syn (true);
-      return true; // reset timer with same interval
+      return true; // update() will restart the timer
     }
-    reset (p_TCP, port_local);
+    tcp_abort ();
   } else if (tcp_syn_ack_sent ()) {
     DEBUG_PRINT ("timeout while sending SYN-ACK.\n");
-    if (true /* tcp.attempts < 8 */) {
+    if (tcp_backoff ()) {
       tcp_send_syn_ack (true);
-      return true; // reset timer with same interval
+      return true; // update() will restart the timer
+    }
+    tcp_abort ();
+  } else if ((is_open () || tcp_closing ()) && tcp_unacked_count) {
+    DEBUG_PRINT ("timeout while waiting for ACK.\n");
+    if (tcp_backoff ()) {
+      CC->loss ((u16_t) tcp_seq_diff (tcp.snd_nxt, tcp.snd_una), true);
+
+      tcp_recovery (false); // abandon any fast recovery...
+      tcp.recover = tcp.snd_nxt; // ... and don't start another on duplicate ACKs provoked by going back N
+      tcp.dupacks = 0;
+
+      tcp_rtx_next = 0; // go back N
+      tcp_rtx_end  = tcp_unacked_count;
+
+      tcp_retransmit ();
+      return true; // reset timer with the new interval
     }
-    reset (p_TCP, port_local);
-    open (); // we're in server mode
+    tcp_abort ();
+  } else if ((is_open () || tcp_closing ()) && !fifo_write.is_empty ()) {
+    DEBUG_PRINT ("timeout while the remote's window is closed.\n");
+    timeout_set (false);
+    tcp_send_probe (true); // let update() handle it; the probe is then timed like any other segment
+  } else if (tcp_fin_acked () && !tcp_fin_received ()) {
+    DEBUG_PRINT ("timeout while waiting for FIN.\n");
+    tcp_closed (tcp_server ());
   } else {
     DEBUG_PRINT ("other timeout (unhandled).\n");
   }
@@ -369,12 +850,15 @@ bool IP_Connection::accept_tcp (IP_Buffer * buffer) {
       port_remote = buffer->tcp().source ();
       has_remote (true);
 
-      tcp.ack_no = buffer->tcp().seq_no ();
-      tcp.ack_no++;
+      tcp.rcv_nxt = tcp_seq_add (buffer->tcp().seq_no (), 1); // the SYN counts as one byte
+      tcp.snd_wnd = buffer->tcp().window_size ();
+
+      u8_t option_length;
+      tcp_sack_permitted (IP_TCP_SACK && buffer->tcp_option (IP_TCP_Option_SACK_Permitted, option_length));
 
       tcp_send_syn_ack (true); // let update() handle it
 
-      IP_Manager::manager().add_to_spares (buffer);
+      manager ().add_to_spares (buffer);
       return true;
     }
     // not a connection request; reject
@@ -390,96 +874,87 @@ bool IP_Connection::accept_tcp (IP_Buffer * buffer) {
     return false;
   }
   DEBUG_PRINT ("IP_Connection::accept_tcp: remote matched\n");
-  /* Strictly speaking, this isn't a TCP requirement, but we're going to
-   * enforce it.
-   */
-  if (buffer->tcp().ack_no() == tcp.seq_no) {
 
-    if (buffer->tcp().flag_syn () && buffer->tcp().flag_ack ()) {
-      if (tcp_syn_sent ()) {
-	DEBUG_PRINT ("This is a response to a SYN we sent.\n");
+  const IP_Header_TCP & header = buffer->tcp ();
 
-	/* This is a response to a SYN we sent.
-	 */
-	buffer_tcp->unref ();
-	IP_Manager::manager().add_to_spares (buffer_tcp);
-	buffer_tcp = 0;
+  if (tcp_syn_sent ()) {
+    if (header.flag_syn () && header.flag_ack () && (header.ack_no () == tcp.snd_nxt)) {
+      DEBUG_PRINT ("This is a response to a SYN we sent.\n");
 
-	tcp.ack_no = buffer->tcp().seq_no ();
-	tcp.ack_no++;
+      /* This is a response to a SYN we sent.
+       */
+      buffer_tcp->unref ();
+      manager ().add_to_spares (buffer_tcp);
+      buffer_tcp = 0;
 
-	timeout_set (false);
+      tcp_rtt_sample (header.ack_no ());
 
-	tcp_syn_sent (false);
-	tcp_send_ack (true); // let update() handle it
+      tcp.snd_una = tcp.snd_nxt;
+      tcp.snd_wnd = header.window_size ();
+      tcp.rcv_nxt = tcp_seq_add (header.seq_no (), 1);
 
-	is_open (true);
-	if (EL) {
-	  EL->connection_has_opened (*this);
-	}
+      u8_t option_length;
+      tcp_sack_permitted (IP_TCP_SACK && buffer->tcp_option (IP_TCP_Option_SACK_Permitted, option_length));
 
-	IP_Manager::manager().add_to_spares (buffer);
-	return true;
+      timeout_set (false);
+
+      tcp_syn_sent (false);
+      tcp_send_ack (true); // let update() handle it
+
+      is_open (true);
+      if (EL) {
+	EL->connection_has_opened (*this);
       }
     }
+    manager ().add_to_spares (buffer);
+    return true;
+  }
 
-    if (buffer->tcp().flag_ack ()) {
-      if (tcp_syn_ack_sent ()) {
-	DEBUG_PRINT ("This is a response to a SYN-ACK we sent.\n");
+  if (tcp_syn_ack_sent ()) {
+    if (!header.flag_syn () && header.flag_ack () && (header.ack_no () == tcp.snd_nxt)) {
+      DEBUG_PRINT ("This is a response to a SYN-ACK we sent.\n");
 
-	/* This is a response to a SYN-ACK we sent.
-	 */
-	buffer_tcp->unref ();
-	IP_Manager::manager().add_to_spares (buffer_tcp);
-	buffer_tcp = 0;
+      /* This is a response to a SYN-ACK we sent; it may carry data as well.
+       */
+      buffer_tcp->unref ();
+      manager ().add_to_spares (buffer_tcp);
+      buffer_tcp = 0;
 
-	timeout_set (false);
+      tcp_rtt_sample (header.ack_no ());
 
-	tcp_syn_ack_sent (false);
+      tcp.snd_una = tcp.snd_nxt;
 
-	is_open (true);
-	if (EL) {
-	  EL->connection_has_opened (*this);
-	}
+      timeout_set (false);
+
+      tcp_syn_ack_sent (false);
 
-	IP_Manager::manager().add_to_spares (buffer);
-	return true;
+      is_open (true);
+      if (EL) {
+	EL->connection_has_opened (*this);
       }
-    }
-    DEBUG_PRINT ("(unhandled)\n");
-  } else {
-    DEBUG_PRINT ("(ack != seq)\n");
-
-    // unexpected, or packet re-sent; send an ack
-    if (is_open ()) {
-      tcp_send_ack (true); // let update() handle it
+    } else { // e.g., a repeated SYN; the timer will resend the SYN-ACK
+      manager ().add_to_spares (buffer);
+      return true;
     }
   }
 
-  IP_Manager::manager().add_to_spares (buffer);
-  return true;
-#if 0
-  bool bAcknowledge = false;
-
-  if (EL) { // we have an event listener
-    if (EL->buffer_received (*this, *buffer)) { // the new buffer has now been handled by the listener
-      bAcknowledge = true;
+  if (is_open () || tcp_closing ()) {
+    if (header.flag_ack ()) {
+      if (tcp_sack_permitted ()) { // first, so that a fast retransmit can skip what the remote holds
+	tcp_sack_received (buffer);
+      }
+      tcp_acknowledged (header.ack_no (), header.window_size (), buffer->tcp_data_length () + (header.flag_fin () ? 1 : 0));
     }
+    if (header.flag_syn ()) { // a repeated SYN-ACK; our ACK must have been lost
+      tcp_send_ack (true);
+    } else {
+      tcp_receive (buffer);
+    }
+    tcp_close_check ();
   }
 
-  if (!bAcknowledge) {
-    // TODO: Process data stream
-    buffer_in = buffer;
-
-    data_in_offset = buffer->tcp_data_offset ();
-    data_in_length = buffer->tcp_data_length ();
-  }
-  if (bAcknowledge) {
-    // TODO: Send acknowledgement
-  }
-  // FIXME!!!
+  manager ().add_to_spares (buffer);
   return true;
-#endif
 }
 
 bool IP_Connection::accept_udp (IP_Buffer * buffer) {
@@ -487,28 +962,135 @@ bool IP_Connection::accept_udp (IP_Buffer * buffer) {
     return false; // this connection hasn't finished closing yet
   }
 
-  if (EL) { // we have an event listener
+  if (EL && !buffer->fragment_next ()) { // we have an event listener, and the datagram is all in the one buffer
     if (EL->buffer_received (*this, *buffer)) { // the new buffer has now been handled by the listener
-      IP_Manager::manager().add_to_spares (buffer);
+      manager ().add_to_spares (buffer);
+      return true;
+    }
+  }
+
+  if (buffer_in || datagram_mode ()) { // queue it until the application has read the earlier ones
+    if (datagram_count >= datagram_limit) {
+      DEBUG_PRINT ("IP_Connection::accept_udp: receive queue full; datagram dropped\n");
+      ++udp_stats.dropped;
+      manager ().add_to_spares (buffer);
       return true;
     }
+    chain_datagrams.chain_append (buffer);
+    ++datagram_count;
+    ++udp_stats.received;
+
+    if (datagram_mode ()) {
+      data_arrived (true);
+    }
+    return true;
   }
+  ++udp_stats.received;
+
+  buffer_in = buffer; // save for later processing, if the FIFO fills up
 
   data_in_offset = buffer->udp_data_offset ();
   data_in_length = buffer->udp_data_length ();
 
-  data_in_length -= buffer->push (fifo_read, data_in_offset);
+  data_in_push ();
 
-  if (data_in_length) {
-    buffer_in = buffer; // save for later processing
-  } else {
-    IP_Manager::manager().add_to_spares (buffer);
-  }
   return true;
 }
 
+void IP_Connection::data_in_push () { // write as much of the incoming data as possible to the FIFO
+  if (!buffer_in) {
+    data_in_next ();
+  }
+  while (buffer_in) {
+    u16_t count = buffer_in->push (fifo_read, data_in_offset);
+
+    if (count) {
+      data_arrived (true);
+    }
+    data_in_length -= count;
+
+    if (data_in_length) { // the FIFO is full
+      break;
+    }
+
+    /* finished with this buffer; move on to the next fragment, if it's a reassembled datagram
+     */
+    IP_Buffer * next = buffer_in->fragment_next ();
+    buffer_in->fragment_next (0);
+
+    manager ().add_to_spares (buffer_in);
+    buffer_in = next;
+
+    if (buffer_in) {
+      data_in_offset = buffer_in->ip().header_length ();
+      data_in_length = buffer_in->ip().payload_length ();
+    } else {
+      data_in_next ();
+    }
+  }
+}
+
+void IP_Connection::data_in_next () { // unless in datagram mode, move on to the next datagram in the queue
+  if (datagram_count && !datagram_mode ()) {
+    buffer_in = chain_datagrams.chain_pop ();
+    --datagram_count;
+
+    data_in_offset = buffer_in->udp_data_offset ();
+    data_in_length = buffer_in->udp_data_length ();
+  }
+}
+
+void IP_Connection::data_in_clear () { // discard any received data not yet read
+  if (buffer_in) {
+    manager ().add_to_spares (buffer_in);
+    buffer_in = 0;
+  }
+  while (IP_Buffer * buffer = chain_datagrams.chain_pop ()) {
+    manager ().add_to_spares (buffer);
+  }
+  datagram_count = 0;
+}
+
+u16_t IP_Connection::datagram_length () const {
+  const IP_Buffer * buffer = const_cast<Chain<IP_Buffer> &>(chain_datagrams).chain_first ();
+
+  if (!buffer) {
+    return 0;
+  }
+  u16_t length = buffer->udp_data_length ();
+
+  while ((buffer = buffer->fragment_next ())) { // the rest of a reassembled datagram
+    length += buffer->ip().payload_length ();
+  }
+  return length;
+}
+
+u16_t IP_Connection::receive_from (u8_t * ptr, u16_t length, IP_Address & source, u16_t & source_port) {
+  IP_Buffer * buffer = chain_datagrams.chain_pop ();
+
+  if (!buffer) {
+    source_port = 0;
+    return 0;
+  }
+  --datagram_count;
+
+  source      = buffer->ip().source ();
+  source_port = buffer->udp().source ();
+
+  u16_t count  = buffer->read (buffer->udp_data_offset (), ptr, length);
+  IP_Buffer * next = buffer->fragment_next ();
+
+  while (next && (count < length)) { // the rest of a reassembled datagram
+    count += next->read (next->ip().header_length (), ptr + count, length - count);
+    next = next->fragment_next ();
+  }
+  manager ().add_to_spares (buffer); // along with any further fragments
+
+  return count;
+}
+
 bool IP_Connection::accept (IP_Buffer * buffer) {
-  if (buffer_in || !port_local) {
+  if (!port_local) {
     return false;
   }
 
@@ -548,6 +1130,16 @@ bool IP_Connection::accept (IP_Buffer * buffer) {
   return accept_udp (buffer);
 }
 
+bool IP_Connection::accept_request (IP_Buffer * buffer) {
+  if (!is_idle () || !buffer->ip().is_TCP ()) {
+    return false;
+  }
+  reset (p_TCP, buffer->tcp().destination ());
+  schedule ();
+
+  return accept_tcp (buffer);
+}
+
 void IP_Connection::connect (const IP_Address & address, u16_t port) {
   if (is_open () || is_busy () || tcp_server ()) {
     return;
@@ -557,6 +1149,7 @@ void IP_Connection::connect (const IP_Address & address, u16_t port) {
     return;
   }
   has_remote (true);
+  schedule ();
 
   port_remote = port;
   remote = address;
@@ -579,31 +1172,759 @@ void IP_Connection::connect (const IP_Address & address, u16_t port) {
 void IP_Connection::tcp_prepare (IP_Buffer * buffer) {
   buffer->channel (0);
 
-  buffer->defaults (p_TCP);
+  buffer->defaults (p_TCP, remote.family ());
 
-  buffer->ip().destination() = remote;
+  buffer->ip().set_destination (remote);
 
   buffer->tcp().source() = port_local;
   buffer->tcp().destination() = port_remote;
 }
 
+/* Acknowledge everything received so far, and advertise the receive window; call before tcp_finalise(). Any pending
+ * or delayed ACK is now carried by this buffer.
+ */
+void IP_Connection::tcp_stamp (IP_Buffer * buffer) {
+  tcp_send_ack (false);
+  tcp.ack_count = 0;
+
+  tcp.rcv_wnd = tcp_window ();
+
+  buffer->tcp().flag_ack (true);
+
+  buffer->tcp().ack_no() = tcp.rcv_nxt;
+  buffer->tcp().window_size() = tcp.rcv_wnd;
+}
+
 bool IP_Connection::tcp_ack () {
   DEBUG_PRINT ("IP_Connection::tcp_ack: send ACK\n");
-  IP_Buffer * buffer = IP_Manager::manager().get_from_spares ();
+  IP_Buffer * buffer = manager ().get_from_spares (bc_Control);
 
   if (buffer) {
     tcp_prepare (buffer);
 
-    buffer->tcp().flag_ack (true);
+    buffer->tcp().seq_no() = tcp.snd_nxt;
 
-    buffer->tcp().seq_no() = tcp.seq_no;
-    buffer->tcp().ack_no() = tcp.ack_no;
+    tcp_sack_options (buffer);
+    tcp_stamp (buffer);
 
     buffer->tcp_finalise ();
 
-    IP_Manager::manager().forward (buffer); // send it
+    manager ().forward (buffer); // send it
 
     return true;
   }
   return false;
 }
+
+u16_t IP_Connection::tcp_window () const {
+  return fifo_read.available ();
+}
+
+u16_t IP_Connection::tcp_send_space () const {
+  u32_t in_flight = tcp_seq_diff (tcp.snd_nxt, tcp.snd_una);
+  u16_t window    = (tcp.snd_wnd < CC->window ()) ? tcp.snd_wnd : CC->window ();
+
+  return (window > in_flight) ? (window - in_flight) : 0;
+}
+
+/* Nagle's algorithm (RFC 896): a partly filled segment may only be sent if nothing is waiting to be acknowledged;
+ * cork() holds back partial segments altogether, and flush() lets them through.
+ */
+bool IP_Connection::tcp_send_partial () const {
+  if (flush_requested ()) {
+    return true;
+  }
+  if (is_corked ()) {
+    return false;
+  }
+  return !nagle () || !tcp_unacked_count;
+}
+
+/* Send a new data segment, taking data first from fifo_write and then from ptr, as far as the remote's window
+ * and the congestion window allow; length is the number of bytes available at ptr, and is set to the number actually taken.
+ * Unless bPartial, the segment is only sent if it can be filled. Returns false if no segment was sent, i.e., if the
+ * window is full or closed, if there isn't enough data, or if there isn't a spare buffer.
+ */
+bool IP_Connection::tcp_send_segment (const u8_t * ptr, u16_t & length, bool bPartial) {
+  u16_t space = tcp_send_limit ();
+
+  if (!space) {
+    length = 0;
+    return false;
+  }
+  if (!bPartial && fifo_write.available () && ((u32_t) fifo_write.count () + length < space)) { // wait for more data, unless the FIFO is full
+    length = 0;
+    return false;
+  }
+
+  IP_Buffer * buffer = manager ().get_from_spares (bc_Transmit);
+
+  if (!buffer) {
+    length = 0;
+    return false;
+  }
+  tcp_prepare (buffer);
+
+  if (space > buffer->available ()) {
+    space = buffer->available ();
+  }
+  space -= buffer->pull (fifo_write, space);
+
+  if (length > space) {
+    length = space;
+  }
+  if (length) {
+    buffer->append (ptr, length);
+  }
+
+  u16_t count = buffer->length () - buffer->tcp_data_offset ();
+  bool  bFin  = tcp_send_fin () && fifo_write.is_empty (); // closing; the FIN goes with the last of the output
+
+  if (!count && !bFin) {
+    manager ().add_to_spares (buffer);
+    return false;
+  }
+  if (bFin) {
+    buffer->tcp().flag_fin (true);
+
+    tcp_send_fin (false);
+    tcp_fin_sent (true);
+  }
+  tcp_send_new (buffer, count + (bFin ? 1 : 0));
+  return true;
+}
+
+/* The most data a new segment may carry now, within the remote's window, the congestion window and the maximum
+ * segment size; 0 if no new segment may be sent, e.g., while resending after a loss.
+ */
+u16_t IP_Connection::tcp_send_limit () const {
+  if ((tcp_unacked_count == IP_TCP_Window_Segments) || (tcp_rtx_next < tcp_rtx_end)) {
+    return 0;
+  }
+  u16_t space = tcp_send_space ();
+
+  return (space > tcp.mss) ? tcp.mss : space;
+}
+
+/* Send a new segment, using count sequence numbers (its data, plus one for any FIN), and retain it for retransmission
+ */
+void IP_Connection::tcp_send_new (IP_Buffer * buffer, u16_t count) {
+  if (buffer->length () > buffer->tcp_data_offset ()) {
+    buffer->tcp().flag_psh (true);
+  }
+  buffer->tcp().seq_no() = tcp.snd_nxt;
+
+  tcp_stamp (buffer); // the ACK is carried by this segment
+
+  buffer->tcp_finalise ();
+
+  tcp_rtt_start (tcp.snd_nxt);
+
+  tcp.snd_nxt = tcp_seq_add (tcp.snd_nxt, count); // data, plus one for any FIN
+
+  buffer->ref (); // retain for retransmission until acknowledged
+  tcp_sacked[tcp_unacked_count] = false;
+  tcp_unacked[tcp_unacked_count++] = buffer;
+
+  if (tcp_unacked_count == 1) { // start the retransmission timer
+    tcp.attempts = 0;
+
+    timer.start (manager (), tcp.rto);
+    timeout_set (true);
+  }
+
+  manager ().forward (buffer); // send it
+}
+
+/* The remote's window has been closed for a while; send a single byte regardless, so that its ACK reports the window
+ * even if the update that opened it was lost. Until the remote takes it, the probe is resent (with backoff) like any
+ * other unacknowledged segment.
+ */
+void IP_Connection::tcp_probe () {
+  if (tcp_unacked_count || fifo_write.is_empty ()) { // the window has opened since
+    tcp_send_probe (false);
+    return;
+  }
+
+  IP_Buffer * buffer = manager ().get_from_spares (bc_Transmit);
+
+  if (buffer) { // otherwise try again on the next update()
+    DEBUG_PRINT ("IP_Connection::tcp_probe: zero-window probe\n");
+    ++tcp_stats.probes;
+
+    tcp_send_probe (false);
+
+    tcp_prepare (buffer);
+
+    buffer->pull (fifo_write, 1);
+
+    tcp_send_new (buffer, 1);
+  }
+}
+
+/* Process a cumulative acknowledgement from the remote, releasing the segments it covers. A bare ACK that doesn't
+ * advance and doesn't change the window while data is outstanding is a duplicate, i.e., the remote has received
+ * a later segment; during fast recovery, an ACK short of tcp.recover (a partial ACK) means the next segment has
+ * been lost too (NewReno).
+ */
+void IP_Connection::tcp_acknowledged (u32_t ack_no, u16_t window, u16_t length) {
+  if (tcp_seq_lt (ack_no, tcp.snd_una) || tcp_seq_lt (tcp.snd_nxt, ack_no)) { // old, or for data we haven't sent
+    return;
+  }
+  bool bProgress  = (ack_no != tcp.snd_una);
+  bool bDuplicate = !bProgress && !length && window && (window == tcp.snd_wnd) && tcp_unacked_count;
+  bool bReopened  = window && !tcp.snd_wnd;
+
+  u16_t bytes     = (u16_t) tcp_seq_diff (ack_no, tcp.snd_una);
+  u16_t in_flight = (u16_t) tcp_seq_diff (tcp.snd_nxt, tcp.snd_una);
+
+  if (bProgress) {
+    tcp_rtt_sample (ack_no);
+  }
+  tcp.snd_una = ack_no;
+  tcp.snd_wnd = window;
+
+  if (!bProgress) {
+    if (bDuplicate) {
+      tcp_duplicate_ack (in_flight);
+    } else if (!window) { // the remote is still there, but has no room yet; keep probing (RFC 1122, 4.2.2.17)
+      tcp.attempts = 0;
+    } else if (bReopened && tcp_unacked_count && (tcp_rtx_next >= tcp_rtx_end)) { // resend the probe now, rather than
+      tcp_rtx_next = 0;                                                           // when the timer next expires
+      tcp_rtx_end  = tcp_unacked_count;
+    }
+    return;
+  }
+  tcp.dupacks = 0;
+
+  u8_t acked = 0;
+
+  while (acked < tcp_unacked_count) {
+    IP_Buffer * segment = tcp_unacked[acked];
+
+    if (tcp_seq_lt (ack_no, tcp_seq_end (segment))) { // not yet fully acknowledged
+      break;
+    }
+    segment->unref ();
+    manager ().add_to_spares (segment); // if still queued by a channel, the channel will release it
+    ++acked;
+  }
+  for (u8_t i = acked; i < tcp_unacked_count; i++) {
+    tcp_unacked[i - acked] = tcp_unacked[i];
+    tcp_sacked[i - acked]  = tcp_sacked[i];
+  }
+  tcp_unacked_count -= acked;
+
+  tcp_rtx_next = (tcp_rtx_next > acked) ? (tcp_rtx_next - acked) : 0;
+  tcp_rtx_end  = (tcp_rtx_end  > acked) ? (tcp_rtx_end  - acked) : 0;
+
+  if (!tcp_recovery ()) {
+    CC->acked (bytes, in_flight);
+  } else if (tcp_seq_lt (ack_no, tcp.recover)) { // a partial ACK; resend the segment it stops at, and any other holes
+    DEBUG_PRINT ("IP_Connection::tcp_acknowledged: partial ACK during fast recovery\n");
+    ++tcp_stats.partial;
+
+    CC->deflate (bytes);
+
+    u8_t holes = tcp_holes ();
+
+    if (tcp_rtx_next >= tcp_rtx_end) {
+      tcp_rtx_next = 0;
+      tcp_rtx_end  = holes;
+    } else if (tcp_rtx_end < holes) { // earlier holes are still waiting to be resent
+      tcp_rtx_end  = holes;
+    }
+    tcp_retransmit ();
+  } else { // everything in flight when the loss was detected has been acknowledged
+    tcp_recovery (false);
+
+    CC->recovered ();
+  }
+
+  if (tcp_unacked_count) { // restart the retransmission timer for the remaining segments
+    tcp.attempts = 0;
+
+    timer.start (manager (), tcp.rto);
+  } else {
+    timeout_set (false);
+  }
+  if (tcp_fin_sent () && (ack_no == tcp.snd_nxt)) {
+    tcp_fin_acked (true);
+  }
+}
+
+/* Take in-sequence data from a segment, as much as fifo_read has space for; anything beyond that is left unacknowledged,
+ * and the remote will resend it. Out-of-sequence data is held, if possible, and the expected sequence number acknowledged
+ * again (with selective acknowledgements, if permitted).
+ */
+void IP_Connection::tcp_receive (IP_Buffer * buffer) {
+  u16_t length = buffer->tcp_data_length ();
+  bool  bFin   = buffer->tcp().flag_fin ();
+
+  if (!length && !bFin) { // just an ACK
+    return;
+  }
+  if (tcp_fin_received ()) { // nothing new can follow the FIN; our ACK may have been lost
+    tcp_send_ack (true);
+    return;
+  }
+
+  u32_t seq_no = buffer->tcp().seq_no ();
+  u16_t offset = buffer->tcp_data_offset ();
+
+  if (tcp_seq_lt (seq_no, tcp.rcv_nxt)) { // some or all of this has been received already
+    u32_t repeated = tcp_seq_diff (tcp.rcv_nxt, seq_no);
+
+    if ((repeated > length) || ((repeated == length) && !bFin)) {
+      tcp_send_ack (true); // our ACK may have been lost; let update() resend it now
+      return;
+    }
+    offset += repeated;
+  } else if (seq_no != tcp.rcv_nxt) { // a gap; an earlier segment has been lost or delayed
+    tcp_ooo_insert (buffer);
+
+    tcp_send_ack (true); // tell the remote straight away what we're still waiting for
+    return;
+  }
+
+  /* delay the ACK, in the hope that outgoing data can carry it, unless this is the second segment in a row
+   */
+  if (!tcp.ack_count++) {
+    tcp.ack_time = manager ().milliseconds ();
+  }
+  if (tcp.ack_count >= IP_TCP_Ack_Segments) {
+    tcp_send_ack (true); // let update() handle it
+  }
+
+  if (tcp_deliver (buffer, offset) < buffer->length () - offset) { // no room for all of it, e.g., a zero-window probe
+    tcp_send_ack (true);
+  }
+
+  if (bFin && (tcp.rcv_nxt == tcp_seq_add (seq_no, length))) { // everything before the FIN has been taken
+    tcp_fin_arrived ();
+  } else if (tcp_ooo_count) {
+    tcp_ooo_drain ();
+  }
+}
+
+/* Pass data received in sequence on to fifo_read, as much as it has space for; if the application has closed the
+ * connection, there's no-one to read it, so it's all taken (and discarded). Returns the number of bytes taken.
+ */
+u16_t IP_Connection::tcp_deliver (IP_Buffer * buffer, u16_t offset) {
+  u16_t count = is_open () ? buffer->push (fifo_read, offset) : (buffer->length () - offset);
+
+  if (count && is_open ()) {
+    data_arrived (true);
+  }
+
+  tcp.rcv_nxt = tcp_seq_add (tcp.rcv_nxt, count);
+  tcp.rcv_wnd = (tcp.rcv_wnd > count) ? (tcp.rcv_wnd - count) : 0;
+
+  return count;
+}
+
+void IP_Connection::tcp_fin_arrived () {
+  DEBUG_PRINT ("IP_Connection::tcp_fin_arrived\n");
+  tcp.rcv_nxt = tcp_seq_add (tcp.rcv_nxt, 1); // the FIN counts as one byte
+
+  tcp_fin_received (true);
+  tcp_send_ack (true); // acknowledge it straight away
+
+  tcp_ooo_clear ();
+
+  if (is_open () && EL) { // the application can still write, until it closes too
+    EL->connection_has_finished (*this);
+  }
+}
+
+/* Resend unacknowledged segments from tcp_rtx_next, as far as the congestion window allows (but at least one), except
+ * any still queued for sending; after a timeout, everything outstanding is resent (go-back-N), but segments the remote
+ * has reported holding are skipped.
+ */
+void IP_Connection::tcp_retransmit () {
+  tcp_timing (false); // Karn's rule: an ACK for a retransmitted segment is ambiguous, so don't time it
+
+  while (tcp_rtx_next < tcp_rtx_end) {
+    IP_Buffer * segment = tcp_unacked[tcp_rtx_next];
+
+    u32_t end = tcp_seq_diff (tcp_seq_end (segment), tcp.snd_una);
+
+    if (tcp_sacked[tcp_rtx_next]) { // the remote has this one already
+      ++tcp_rtx_next;
+      continue;
+    }
+    if (tcp_rtx_next && (end > CC->window ())) {
+      break;
+    }
+    ++tcp_rtx_next;
+
+    if (segment->shared ()) { // still waiting in a channel's queue; can't change it now
+      continue;
+    }
+    tcp_stamp (segment);
+    segment->tcp_finalise ();
+
+    manager ().forward (segment); // send it
+  }
+}
+
+void IP_Connection::tcp_duplicate_ack (u16_t in_flight) {
+  if (tcp_recovery ()) { // another segment has left the network
+    CC->inflate (1);
+    return;
+  }
+  if (++tcp.dupacks != IP_TCP_Dup_ACKs) {
+    return;
+  }
+  if (!tcp_seq_lt (tcp.recover, tcp.snd_una) || (tcp_rtx_next < tcp_rtx_end)) { // still recovering from an earlier loss
+    return;
+  }
+  DEBUG_PRINT ("IP_Connection::tcp_duplicate_ack: fast retransmit\n");
+  ++tcp_stats.fast;
+
+  CC->loss (in_flight, false);
+  CC->inflate (IP_TCP_Dup_ACKs); // the segments that provoked the duplicate ACKs have left the network
+
+  tcp.recover = tcp.snd_nxt;
+  tcp_recovery (true);
+
+  tcp_rtx_next = 0;
+  tcp_rtx_end  = tcp_holes ();
+
+  tcp_retransmit ();
+}
+
+/* The oldest unacknowledged segment has been lost; with selective acknowledgements, so have any others that the remote
+ * doesn't hold and that are older than the newest it does.
+ */
+u8_t IP_Connection::tcp_holes () const {
+  u8_t end = 1;
+
+  for (u8_t i = 1; i < tcp_unacked_count; i++) {
+    if (tcp_sacked[i]) {
+      end = i;
+    }
+  }
+  return end;
+}
+
+void IP_Connection::tcp_unacked_clear () {
+  tcp_rtx_next = 0;
+  tcp_rtx_end  = 0;
+
+  while (tcp_unacked_count) {
+    IP_Buffer * segment = tcp_unacked[--tcp_unacked_count];
+
+    segment->unref ();
+    manager ().add_to_spares (segment);
+  }
+}
+
+void IP_Connection::tcp_rtt_reset () {
+  tcp.srtt   = 0;
+  tcp.rttvar = 0;
+  tcp.rto    = IP_TCP_RTO_Initial;
+
+  tcp_timing (false);
+
+  tcp_stats.samples     = 0;
+  tcp_stats.retransmits = 0;
+  tcp_stats.fast        = 0;
+  tcp_stats.partial     = 0;
+  tcp_stats.probes      = 0;
+  tcp_stats.rtt_min     = 0;
+  tcp_stats.rtt_max     = 0;
+}
+
+void IP_Connection::tcp_rtt_start (u32_t seq_no) {
+  if (!tcp_timing ()) { // only one measurement at a time
+    tcp_timing (true);
+
+    tcp.rtt_seq   = seq_no;
+    tcp.send_time = manager ().milliseconds ();
+  }
+}
+
+/* Jacobson/Karels estimation (RFC 6298): SRTT += (R - SRTT) / 8; RTTVAR += (|R - SRTT| - RTTVAR) / 4;
+ * RTO = SRTT + 4 RTTVAR. Both are kept scaled, so the smoothing is done with shifts.
+ */
+void IP_Connection::tcp_rtt_sample (u32_t ack_no) {
+  if (!tcp_timing () || !tcp_seq_lt (tcp.rtt_seq, ack_no)) { // not timing, or the timed segment isn't covered yet
+    return;
+  }
+  tcp_timing (false);
+
+  u32_t rtt = manager ().milliseconds () - tcp.send_time;
+
+  if (rtt > 0xFFFF) {
+    rtt = 0xFFFF;
+  }
+  if (!tcp_stats.samples++) {
+    tcp.srtt   = rtt << 3;
+    tcp.rttvar = rtt << 1; // i.e., RTTVAR = R / 2
+
+    tcp_stats.rtt_min = (u16_t) rtt;
+    tcp_stats.rtt_max = (u16_t) rtt;
+  } else {
+    u32_t srtt  = tcp.srtt >> 3;
+    u32_t delta = (rtt > srtt) ? (rtt - srtt) : (srtt - rtt);
+
+    tcp.srtt   = tcp.srtt   - (tcp.srtt   >> 3) + rtt;
+    tcp.rttvar = tcp.rttvar - (tcp.rttvar >> 2) + delta;
+
+    if (tcp_stats.rtt_min > rtt) {
+      tcp_stats.rtt_min = (u16_t) rtt;
+    }
+    if (tcp_stats.rtt_max < rtt) {
+      tcp_stats.rtt_max = (u16_t) rtt;
+    }
+  }
+
+  u32_t rto = (tcp.srtt >> 3) + (tcp.rttvar ? tcp.rttvar : 1); // the clock granularity is 1 ms
+
+  if (rto < IP_TCP_RTO_Min) {
+    rto = IP_TCP_RTO_Min;
+  } else if (rto > IP_TCP_RTO_Max) {
+    rto = IP_TCP_RTO_Max;
+  }
+  tcp.rto = (u16_t) rto;
+
+  CC->rtt_sample ((u16_t) rtt, (u16_t) tcp_seq_diff (tcp.snd_nxt, tcp.snd_una));
+}
+
+/* Exponential backoff: each retransmission of the same segment doubles the timeout
+ */
+bool IP_Connection::tcp_backoff () {
+  if (tcp.attempts >= IP_TCP_Retries) {
+    return false;
+  }
+  ++tcp.attempts;
+  ++tcp_stats.retransmits;
+
+  tcp_timing (false);
+
+  tcp.rto = (tcp.rto > (IP_TCP_RTO_Max >> 1)) ? IP_TCP_RTO_Max : (tcp.rto << 1);
+
+  timer.set_interval (tcp.rto);
+  return true;
+}
+
+/* Give up on the connection after too many retransmissions; a server goes back to listening
+ */
+void IP_Connection::tcp_abort () {
+  DEBUG_PRINT ("IP_Connection::tcp_abort: too many retransmissions\n");
+
+  tcp_closed (tcp_server ());
+}
+
+/* The connection has closed (or been given up on); make it ready for reuse
+ */
+void IP_Connection::tcp_closed (bool bServer) {
+  reset (p_TCP, port_local);
+
+  if (bServer) {
+    open ();
+  }
+  if (EL) {
+    EL->connection_has_closed (*this);
+  }
+}
+
+/* Teardown: once our FIN has been acknowledged and the remote's received, the connection is finished with. If we
+ * closed first, the remote may yet resend its FIN (if our last ACK is lost), so the connection goes into the
+ * manager's TIME_WAIT table, and this IP_Connection can be reused straight away. While waiting for the remote's
+ * FIN (FIN_WAIT_2), the timer limits how long the remote can keep its side open.
+ */
+void IP_Connection::tcp_close_check () {
+  if (!tcp_fin_acked ()) {
+    return;
+  }
+  if (tcp_fin_received ()) {
+    if (tcp_active_close ()) {
+      tcp_ack (); // the final ACK; if it's lost, IP_Manager will resend it
+
+      manager ().time_wait ().add (remote, port_local, port_remote, tcp.snd_nxt, tcp.rcv_nxt, manager ().milliseconds ());
+    }
+    tcp_closed (tcp_server ());
+  } else if (!timeout_set ()) {
+    timer.start (manager (), IP_TCP_FinWait);
+    timeout_set (true);
+  }
+}
+
+u32_t IP_Connection::tcp_seq_end (const IP_Buffer * segment) const {
+  return tcp_seq_add (segment->tcp().seq_no (), segment->tcp_data_length () + (segment->tcp().flag_fin () ? 1 : 0));
+}
+
+void IP_Connection::tcp_syn_options (IP_Buffer * buffer) {
+  static const u8_t sack_permitted[4] = { IP_TCP_Option_NOP, IP_TCP_Option_NOP, IP_TCP_Option_SACK_Permitted, 2 };
+
+  if (IP_TCP_SACK && (tcp_send_syn () || tcp_sack_permitted ())) {
+    buffer->tcp_options (sack_permitted, 4);
+  }
+}
+
+/* SACK blocks (RFC 2018) for the out-of-order segments held, with adjacent segments merged; the block with the most
+ * recently received segment comes first.
+ */
+void IP_Connection::tcp_sack_options (IP_Buffer * buffer) {
+  if (!tcp_sack_permitted () || !tcp_ooo_count) {
+    return;
+  }
+
+  u32_t left[4];
+  u32_t right[4];
+  u8_t  count = 0;
+  u8_t  first = 0;
+
+  for (u8_t i = 0; i < tcp_ooo_count; i++) {
+    u32_t seq_no = tcp_ooo[i]->tcp().seq_no ();
+    u32_t end    = tcp_seq_add (seq_no, tcp_ooo[i]->tcp_data_length ());
+
+    if (count && tcp_seq_le (seq_no, right[count-1])) { // adjacent to (or overlapping) the previous block
+      if (tcp_seq_lt (right[count-1], end)) {
+	right[count-1] = end;
+      }
+    } else if (count < 4) {
+      left[count]  = seq_no;
+      right[count] = end;
+      ++count;
+    } else {
+      break;
+    }
+    if (i == tcp_ooo_last) {
+      first = count - 1;
+    }
+  }
+
+  u8_t options[2 + 2 + 8 * 4];
+  u8_t length = 0;
+
+  options[length++] = IP_TCP_Option_NOP;
+  options[length++] = IP_TCP_Option_NOP;
+  options[length++] = IP_TCP_Option_SACK;
+  options[length++] = 2 + 8 * count;
+
+  for (u8_t b = 0; b < count; b++) {
+    u8_t i = (b == 0) ? first : ((b <= first) ? (b - 1) : b);
+
+    for (int shift = 24; shift >= 0; shift -= 8) {
+      options[length++] = (u8_t) (left[i] >> shift);
+    }
+    for (int shift = 24; shift >= 0; shift -= 8) {
+      options[length++] = (u8_t) (right[i] >> shift);
+    }
+  }
+  buffer->tcp_options (options, length);
+}
+
+void IP_Connection::tcp_sack_received (IP_Buffer * buffer) {
+  u8_t length;
+
+  const u8_t * blocks = buffer->tcp_option (IP_TCP_Option_SACK, length);
+
+  if (!blocks) {
+    return;
+  }
+  for ( ; length >= 8; length -= 8, blocks += 8) {
+    u32_t left  = ((u32_t) blocks[0] << 24) | ((u32_t) blocks[1] << 16) | ((u32_t) blocks[2] << 8) | (u32_t) blocks[3];
+    u32_t right = ((u32_t) blocks[4] << 24) | ((u32_t) blocks[5] << 16) | ((u32_t) blocks[6] << 8) | (u32_t) blocks[7];
+
+    for (u8_t i = 0; i < tcp_unacked_count; i++) {
+      u32_t seq_no = tcp_unacked[i]->tcp().seq_no ();
+      u32_t end    = tcp_seq_end (tcp_unacked[i]);
+
+      if (tcp_seq_le (left, seq_no) && tcp_seq_le (end, right)) {
+	tcp_sacked[i] = true;
+      }
+    }
+  }
+}
+
+void IP_Connection::tcp_ooo_insert (IP_Buffer * buffer) {
+  u32_t seq_no = buffer->tcp().seq_no ();
+  u32_t end    = tcp_seq_add (seq_no, buffer->tcp_data_length ());
+
+  if (!IP_TCP_OOO_Segments || (tcp_seq_diff (end, tcp.rcv_nxt) > tcp_window ())) { // not holding any, or beyond the window
+    return;
+  }
+  if (manager ().buffers_spare () < 2) { // leave room to receive the missing segment, and to acknowledge it
+    return;
+  }
+
+  u8_t i = 0;
+
+  while ((i < tcp_ooo_count) && tcp_seq_lt (tcp_ooo[i]->tcp().seq_no (), seq_no)) {
+    ++i;
+  }
+  if ((i < tcp_ooo_count) && (tcp_ooo[i]->tcp().seq_no () == seq_no)) { // a duplicate
+    return;
+  }
+  if (tcp_ooo_count == IP_TCP_OOO_Segments) { // full; keep the earlier segments, which are more useful
+    if (i == tcp_ooo_count) {
+      return;
+    }
+    IP_Buffer * segment = tcp_ooo[--tcp_ooo_count];
+
+    segment->unref ();
+    manager ().add_to_spares (segment);
+  }
+  for (u8_t j = tcp_ooo_count; j > i; j--) {
+    tcp_ooo[j] = tcp_ooo[j-1];
+  }
+  buffer->ref (); // retain until the gap is filled
+  tcp_ooo[i] = buffer;
+  tcp_ooo_last = i;
+  ++tcp_ooo_count;
+}
+
+void IP_Connection::tcp_ooo_drain () {
+  bool bFilled = false;
+
+  while (tcp_ooo_count) {
+    IP_Buffer * segment = tcp_ooo[0];
+
+    u32_t seq_no = segment->tcp().seq_no ();
+    u32_t end    = tcp_seq_add (seq_no, segment->tcp_data_length ());
+
+    if (tcp_seq_lt (tcp.rcv_nxt, seq_no)) { // still a gap
+      break;
+    }
+    if (tcp_seq_lt (tcp.rcv_nxt, end)) {
+      tcp_deliver (segment, segment->tcp_data_offset () + tcp_seq_diff (tcp.rcv_nxt, seq_no));
+
+      bFilled = true;
+
+      if (tcp.rcv_nxt != end) { // fifo_read is full
+	break;
+      }
+    }
+    bool bFin = segment->tcp().flag_fin () && (tcp.rcv_nxt == end);
+
+    segment->unref ();
+    manager ().add_to_spares (segment);
+
+    for (u8_t i = 1; i < tcp_ooo_count; i++) {
+      tcp_ooo[i-1] = tcp_ooo[i];
+    }
+    --tcp_ooo_count;
+    tcp_ooo_last = 0;
+
+    if (bFin) {
+      tcp_fin_arrived ();
+      break;
+    }
+  }
+  if (bFilled) {
+    tcp_send_ack (true); // a gap has been filled; let the remote know straight away
+  }
+}
+
+void IP_Connection::tcp_ooo_clear () {
+  while (tcp_ooo_count) {
+    IP_Buffer * segment = tcp_ooo[--tcp_ooo_count];
+
+    segment->unref ();
+    manager ().add_to_spares (segment);
+  }
+}
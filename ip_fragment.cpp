@@ -0,0 +1,204 @@
+/* Copyright (c) 2018 Francis James Franklin
+ * 
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided
+ * that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and
+ *    the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ *    the following disclaimer in the documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*! \file ip_fragment.cpp
+    \brief Implementation of IP_Reassembly.
+    
+    Fragments are kept in order of offset within their slot. A datagram is complete once the last fragment has
+    arrived (so that the total length is known) and the number of bytes received equals the total; since
+    overlaps aren't allowed, there can then be no gaps.
+*/
+
+#include "netip/ip_fragment.hh"
+
+IP_Reassembly::IP_Reassembly () :
+  length_max(IP_Reassembly_Length),
+  timeout(IP_Reassembly_Timeout),
+  buffers_max(0xFF),
+  buffers_held(0),
+  stat_completed(0),
+  stat_expired(0),
+  stat_rejected(0),
+  stat_refused(0)
+{
+  for (int s = 0; s < IP_Reassembly_Slots; s++) {
+    slots[s].first = 0;
+  }
+}
+
+IP_Buffer * IP_Reassembly::slot_clear (Slot & slot) {
+  IP_Buffer * first = slot.first;
+
+  slot.first = 0;
+
+  buffers_held -= slot.buffers;
+  slot.buffers  = 0;
+
+  return first;
+}
+
+#if !IP_USE_IPv4
+IP_Reassembly::Slot * IP_Reassembly::slot_for (const IP_Buffer * fragment) {
+  (void) fragment;
+  return 0;
+}
+
+IP_Buffer * IP_Reassembly::add (IP_Buffer * fragment, u32_t now, IP_Buffer *& discard) {
+  (void) now;
+  discard = fragment; // fragmentation is IPv4 only
+  return 0;
+}
+#else
+IP_Reassembly::Slot * IP_Reassembly::slot_for (const IP_Buffer * fragment) {
+  for (int s = 0; s < IP_Reassembly_Slots; s++) {
+    const IP_Buffer * first = slots[s].first;
+
+    if (first) {
+      if ((first->ip().v4().id ()     == fragment->ip().v4().id ()) &&
+	  (first->ip().protocol ()    == fragment->ip().protocol ()) &&
+	  (first->ip().source ()      == fragment->ip().source ()) &&
+	  (first->ip().destination () == fragment->ip().destination ())) { // RFC 791: source, destination, protocol & id
+	return slots + s;
+      }
+    }
+  }
+  return 0;
+}
+
+IP_Buffer * IP_Reassembly::add (IP_Buffer * fragment, u32_t now, IP_Buffer *& discard) {
+  discard = 0;
+
+  u16_t offset = fragment->fragment_offset ();
+  u16_t length = fragment->ip().payload_length ();
+  u16_t end    = offset + length;
+
+  bool bMore = fragment->fragment_more ();
+
+  fragment->fragment_next (0);
+
+  Slot * slot = slot_for (fragment);
+
+  if (!slot) { // the first fragment (to arrive) of a new datagram; find a free slot
+    if ((buffers_max >= 2) && (buffers_held < buffers_max)) { // unless it can't possibly be completed
+      for (int s = 0; s < IP_Reassembly_Slots; s++) {
+	if (!slots[s].first) {
+	  slot = slots + s;
+	  break;
+	}
+      }
+    }
+    if (!slot) {
+      ++stat_refused;
+      discard = fragment;
+      return 0;
+    }
+    slot->started  = now;
+    slot->received = 0;
+    slot->total    = 0;
+    slot->buffers  = 0;
+  }
+
+  bool bReject = false;
+
+  if ((end > length_max) || (end < offset)) { // too long (or wrapped around)
+    bReject = true;
+  } else if (bMore && (length & 7)) {         // all but the last fragment must be a multiple of 8 bytes
+    bReject = true;
+  } else if (!bMore && slot->total && (slot->total != end)) { // another last fragment, with a different length
+    bReject = true;
+  } else if (slot->total && (end > slot->total)) {            // beyond the end of the datagram
+    bReject = true;
+  }
+
+  IP_Buffer * prev = 0;
+  IP_Buffer * next = slot->first;
+
+  while (next && !bReject) { // find where the fragment goes
+    u16_t next_offset = next->fragment_offset ();
+    u16_t next_end    = next_offset + next->ip().payload_length ();
+
+    if (end <= next_offset) {
+      break;
+    }
+    if (offset < next_end) { // overlap
+      if ((offset == next_offset) && (end == next_end)) { // exact duplicate; ignore it
+	discard = fragment;
+	return 0;
+      }
+      bReject = true;
+      break;
+    }
+    prev = next;
+    next = next->fragment_next ();
+  }
+
+  if (bReject) { // discard the fragment and everything received so far
+    ++stat_rejected;
+    fragment->fragment_next (slot_clear (*slot));
+    discard = fragment;
+    return 0;
+  }
+  if (buffers_held >= buffers_max) { // out of buffers; this datagram can't be completed, so don't hold the rest
+    ++stat_refused;
+    fragment->fragment_next (slot_clear (*slot));
+    discard = fragment;
+    return 0;
+  }
+
+  fragment->fragment_next (next);
+  if (prev) {
+    prev->fragment_next (fragment);
+  } else {
+    slot->first = fragment;
+  }
+
+  if (!bMore) {
+    if (fragment->fragment_next ()) { // something already received lies beyond the end
+      ++stat_rejected;
+      discard = slot_clear (*slot);
+      return 0;
+    }
+    slot->total = end;
+  }
+  slot->received += length;
+
+  ++slot->buffers;
+  ++buffers_held;
+
+  if (slot->total && (slot->received == slot->total)) {
+    ++stat_completed;
+    return slot_clear (*slot);
+  }
+  return 0;
+}
+#endif
+
+IP_Buffer * IP_Reassembly::expire (u32_t now) {
+  for (int s = 0; s < IP_Reassembly_Slots; s++) {
+    if (slots[s].first && (now - slots[s].started > timeout)) {
+      ++stat_expired;
+      return slot_clear (slots[s]);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,121 @@
+/* Copyright (c) 2018 Francis James Franklin
+ * 
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided
+ * that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and
+ *    the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ *    the following disclaimer in the documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*! \file ip_listener.cpp
+    \brief Implementation of IP_Listener.
+*/
+
+#include "netip/ip_manager.hh"
+
+IP_Listener::IP_Listener (u16_t local_port, u8_t max_backlog) :
+  owner(0),
+  pool_count(0),
+  backlog(max_backlog),
+  stat_accepted(0),
+  stat_overflow(0),
+  stat_exhausted(0)
+{
+  port = local_port;
+}
+
+void IP_Listener::bind (IP_Manager * manager) {
+  owner = manager;
+
+  for (u8_t c = 0; c < pool_count; c++) {
+    owner->connection_add (pool[c]);
+  }
+}
+
+IP_Manager & IP_Listener::manager () const {
+  return owner ? *owner : IP_Manager::manager ();
+}
+
+bool IP_Listener::pool_add (IP_Connection * connection) {
+  if (pool_count == IP_TCP_Listener_Pool) {
+    return false;
+  }
+  connection->reset (p_TCP, port); // idle, i.e., a client that isn't connecting
+
+  pool[pool_count++] = connection;
+
+  if (owner) { // otherwise the connection is added to the manager along with the listener
+    owner->connection_add (connection);
+  }
+  return true;
+}
+
+bool IP_Listener::accept (IP_Buffer * buffer) {
+  const IP_Header_TCP & header = buffer->tcp ();
+
+  if ((header.destination () != port) || !header.flag_syn () || header.flag_ack ()) { // not a connection request for us
+    return false;
+  }
+
+  IP_Connection * idle = 0;
+  u8_t handshakes = 0;
+
+  for (u8_t c = 0; c < pool_count; c++) {
+    if (pool[c]->tcp_half_open ()) {
+      ++handshakes;
+    } else if (!idle && pool[c]->is_idle ()) {
+      idle = pool[c];
+    }
+  }
+  if (handshakes >= backlog) {
+    DEBUG_PRINT ("IP_Listener::accept: backlog full\n");
+    ++stat_overflow;
+    return false;
+  }
+  if (!idle) {
+    DEBUG_PRINT ("IP_Listener::accept: no idle connection\n");
+    ++stat_exhausted;
+    return false;
+  }
+  if (!idle->accept_request (buffer)) {
+    return false;
+  }
+  ++stat_accepted;
+  return true;
+}
+
+u8_t IP_Listener::active () const {
+  u8_t count = 0;
+
+  for (u8_t c = 0; c < pool_count; c++) {
+    if (!pool[c]->is_idle ()) {
+      ++count;
+    }
+  }
+  return count;
+}
+
+u8_t IP_Listener::half_open () const {
+  u8_t count = 0;
+
+  for (u8_t c = 0; c < pool_count; c++) {
+    if (pool[c]->tcp_half_open ()) {
+      ++count;
+    }
+  }
+  return count;
+}
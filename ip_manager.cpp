@@ -23,33 +23,93 @@
 
 #include "netip/ip_manager.hh"
 
-static IP_Manager s_manager;
+static IP_ARCH_THREAD_LOCAL IP_Manager * s_active = 0;
 
 IP_Manager & IP_Manager::manager () {
+  static IP_Manager s_manager; // constructed on first use only
+
   return s_manager;
 }
 
+IP_Manager & IP_Manager::active () {
+  return s_active ? *s_active : manager ();
+}
+
 /*
- * Use IP_Manager::manager() to get the global instance
+ * Use IP_Manager::manager() to get the default instance, or create new instances as required
  */
 IP_Manager::IP_Manager () :
   EL(0),
+  GW(0),
+  spare_count(0),
+  pool_size(0),
+  rx_quota(0xFF),
+  ready_first(0),
+  ready_last(0),
+  ready_count(0),
   timer(this),
   ping_interval(1),
   ping_next(0),
+  ip_id(0),
   last_port(0xC000),
   host(IP_Address_DefaultHost),
   gateway(IP_Address_DefaultGateway),
   netmask(IP_Address_DefaultNetmask),
-  ticker(0)
+#if IP_USE_IPv4 && IP_USE_IPv6
+  host6(IP_Address_DefaultHost6),
+  gateway6(IP_Address_DefaultGateway6),
+  netmask6(IP_Address_DefaultNetmask6),
+#endif
+  ticker(0),
+  pending_batch(IP_Pending_Batch),
+  pending_budget(IP_Pending_Budget),
+  pending_total(0),
+  pending_overrun(0)
 {
-  for (int i = 0; i < IP_Buffer_Extras; i++) {
-    add_to_spares (buffers + i);
+  for (int c = 0; c < bc_Count; c++) {
+    pool_quota[c]  = 0xFF;
+    pool_in_use[c] = 0;
+    pool_failed[c] = 0;
   }
+  pool_reserve[bc_Receive]  = IP_Reserve_Receive;
+  pool_reserve[bc_Forward]  = IP_Reserve_Forward;
+  pool_reserve[bc_Transmit] = IP_Reserve_Transmit;
+  pool_reserve[bc_Control]  = IP_Reserve_Control;
+
+  for (int ch = 0; ch < 16; ch++) {
+    rx_in_use[ch] = 0;
+  }
+  for (int id = 0; id < 127; id++) {
+    channel_register[id] = 0; // no routes known yet
+  }
+
+  buffers_add (buffers, IP_Buffer_Extras);
 
   timer.start (*this, ping_interval); // we'll adjust this later
 }
 
+void IP_Manager::buffers_add (IP_Buffer * extra, u8_t count) {
+  for (u8_t i = 0; i < count; i++) {
+    extra[i].bind (this);
+    add_to_spares (extra + i);
+  }
+  pool_size += count;
+
+  reassembly_limit ();
+}
+
+/* Incomplete datagrams may hold only the spares not reserved for any consumer class (including receiving), so
+ * that they can't starve the channels
+ */
+void IP_Manager::reassembly_limit () {
+  u16_t reserved = 0;
+
+  for (int c = 0; c < bc_Count; c++) {
+    reserved += pool_reserve[c];
+  }
+  reassembler.set_buffer_limit ((pool_size > reserved) ? (u8_t) (pool_size - reserved) : 0);
+}
+
 IP_Connection * IP_Manager::connection_for_port (const ns16_t & port) {
   Chain<IP_Connection>::iterator I = chain_connection.begin ();
 
@@ -88,6 +148,7 @@ bool IP_Manager::channel_add (IP_Channel * channel) {
     } else {
       channel->set_number (1); // first channel is #1; reserve 0 for ourself
     }
+    channel->bind (this);
     chain_channel.chain_prepend (channel);
   }
   return true;
@@ -105,37 +166,227 @@ IP_Channel * IP_Manager::channel (u8_t number) {
   return *I;
 }
 
+void IP_Manager::connection_ready (IP_Connection * connection) {
+  if (connection->scheduled ()) {
+    return;
+  }
+  connection->ready_next (0, true);
+
+  if (ready_last) {
+    ready_last->ready_next (connection, true);
+  } else {
+    ready_first = connection;
+  }
+  ready_last = connection;
+  ++ready_count;
+}
+
+IP_Connection * IP_Manager::ready_pop () {
+  IP_Connection * connection = ready_first;
+
+  if (connection) {
+    ready_first = connection->ready_next ();
+
+    if (!ready_first) {
+      ready_last = 0;
+    }
+    connection->ready_next (0, false);
+    --ready_count;
+  }
+  return connection;
+}
+
+void IP_Manager::ready_remove (IP_Connection * connection) {
+  if (!connection->scheduled ()) {
+    return;
+  }
+  IP_Connection * previous = 0;
+  IP_Connection * current  = ready_first;
+
+  while (current && (current != connection)) {
+    previous = current;
+    current  = current->ready_next ();
+  }
+  if (current) {
+    if (previous) {
+      previous->ready_next (current->ready_next (), true);
+    } else {
+      ready_first = current->ready_next ();
+    }
+    if (ready_last == current) {
+      ready_last = previous;
+    }
+    current->ready_next (0, false);
+    --ready_count;
+  }
+}
+
 void IP_Manager::connection_handover (IP_Buffer * buffer) {
+  if (buffer->ip().is_TCP () && time_wait_accept (buffer)) { // a segment for a connection that has closed
+    return;
+  }
+
   bool bHandedOver = false;
 
   Chain<IP_Connection>::iterator I = chain_connection.begin ();
 
   while (*I) {
     if ((*I)->accept (buffer)) {
+      connection_ready (*I);
       bHandedOver = true;
       break;
     }
     ++I;
   }
+  if (!bHandedOver && buffer->ip().is_TCP ()) { // perhaps a connection request for a listener
+    Chain<IP_Listener>::iterator L = chain_listener.begin ();
+
+    while (*L) {
+      if ((*L)->accept (buffer)) {
+	bHandedOver = true;
+	break;
+      }
+      ++L;
+    }
+  }
   if (!bHandedOver) {
     add_to_spares (buffer);
   }
 }
 
+/* Check a TCP segment against the connections in TIME_WAIT; returns true if it belongs to one (and has been dealt with).
+ * A resent FIN means the remote didn't get our last ACK, so that's resent, and the wait starts again; a connection
+ * request with a higher sequence number than the old connection used ends the wait early (RFC 1122, 4.2.2.13).
+ */
+bool IP_Manager::time_wait_accept (IP_Buffer * buffer) {
+  IP_TimeWait::Entry * entry = time_waiting.find (buffer);
+
+  if (!entry) {
+    return false;
+  }
+
+  const IP_Header_TCP & header = buffer->tcp ();
+
+  if (header.flag_syn ()) {
+    if (!header.flag_ack () && tcp_seq_lt (entry->ack_no, header.seq_no ())) {
+      DEBUG_PRINT ("IP_Manager::time_wait_accept: new connection request\n");
+      time_waiting.reuse (entry);
+      return false; // let the connections handle it
+    }
+  } else if (!header.flag_rst ()) { // resets are ignored in TIME_WAIT (RFC 1337)
+    if (header.flag_fin ()) {
+      time_waiting.restart (entry, milliseconds ());
+    }
+    if (header.flag_fin () || buffer->tcp_data_length ()) {
+      time_wait_ack (*entry);
+    }
+  }
+  add_to_spares (buffer);
+  return true;
+}
+
+void IP_Manager::time_wait_ack (const IP_TimeWait::Entry & entry) {
+  DEBUG_PRINT ("IP_Manager::time_wait_ack\n");
+  IP_Buffer * buffer = get_from_spares (bc_Control);
+
+  if (buffer) {
+    buffer->channel (0);
+
+    buffer->defaults (p_TCP, entry.remote.family ());
+
+    buffer->ip().set_destination (entry.remote);
+
+    buffer->tcp().source() = entry.port_local;
+    buffer->tcp().destination() = entry.port_remote;
+
+    buffer->tcp().seq_no() = entry.seq_no;
+    buffer->tcp().ack_no() = entry.ack_no;
+    buffer->tcp().flag_ack (true);
+
+    buffer->tcp_finalise ();
+
+    forward (buffer); // send it
+  }
+}
+
+/* Returns true if a buffer can be taken from the spares for the consumer class; the channel is only
+ * relevant for bc_Receive.
+ */
+bool IP_Manager::pool_allows (IP_BufferClass bc, u8_t channel) const {
+  if (!spare_count || (pool_in_use[bc] >= pool_quota[bc])) {
+    return false;
+  }
+  if ((bc == bc_Receive) && (rx_in_use[channel & 0x0F] >= rx_quota)) {
+    return false;
+  }
+
+  u8_t reserved = 0; // spares held back for the other classes
+
+  for (u8_t c = 0; c < bc_Count; c++) {
+    if ((c != bc) && (pool_in_use[c] < pool_reserve[c])) {
+      reserved += pool_reserve[c] - pool_in_use[c];
+    }
+  }
+  return (spare_count > reserved);
+}
+
+/* Stop accounting a buffer against its consumer class.
+ */
+void IP_Manager::pool_release (IP_Buffer * buffer) {
+  u8_t bc = buffer->pool_class ();
+
+  if (bc < bc_Count) {
+    --pool_in_use[bc];
+
+    if (bc == bc_Receive) {
+      --rx_in_use[buffer->channel () & 0x0F];
+    }
+  }
+}
+
+/* Move a buffer to a different consumer class; returns false if the new class has reached its quota.
+ * Unaccounted buffers are left as they are.
+ */
+bool IP_Manager::pool_reclass (IP_Buffer * buffer, IP_BufferClass bc) {
+  if ((buffer->pool_class () == bc) || (buffer->pool_class () >= bc_Count)) {
+    return true;
+  }
+  if (pool_in_use[bc] >= pool_quota[bc]) {
+    ++pool_failed[bc];
+    return false;
+  }
+  pool_release (buffer);
+
+  buffer->pool_class (bc);
+  ++pool_in_use[bc];
+
+  return true;
+}
+
 bool IP_Manager::queue (IP_Buffer *& buffer) {
   bool bQueued = false;
 
   if (buffer) {
     IP_Buffer * pending = buffer;
-    IP_Buffer * spare = get_from_spares ();
 
-    if (buffer == spare) {
-      DEBUG_PRINT ("$^$"); // help!
-    }
-    if (spare) {
+    if (pool_allows (bc_Receive, pending->channel ())) {
+      IP_Buffer * spare = chain_buffers_spare.chain_pop ();
+      --spare_count;
+
+      spare->pool_class (bc_Channel); // the channel's new receive buffer
+
+      pending->pool_class (bc_Receive);
+      ++pool_in_use[bc_Receive];
+      ++rx_in_use[pending->channel () & 0x0F];
+
       buffer = spare;
-      chain_buffers_pending.chain_push (pending, true /* FIFO */);
       bQueued = true;
+
+      if (!queue_pending.push (pending, milliseconds ())) { // pending queue is full; drop the packet
+	add_to_spares (pending);
+      }
+    } else {
+      ++pool_failed[bc_Receive];
     }
   }
   return bQueued;
@@ -151,8 +402,9 @@ void IP_Manager::broadcast (IP_Buffer * buffer) {
 
   while (*I) {
     if ((*I)->number () != channel_origin) { // don't send it backwards
-      (*I)->send (buffer);
-      bEndOfLine = false;
+      if ((*I)->send (buffer)) {
+	bEndOfLine = false;
+      }
     }
     ++I;
   }
@@ -167,18 +419,27 @@ void IP_Manager::forward (IP_Buffer * buffer) {
 
   IP_Channel * ch = 0;
 
-  switch (channel_for_destination (channel_number, buffer->ip().destination ())) {
+  RoutingInfo ri = channel_for_destination (channel_number, buffer->ip().destination ());
+
+  if ((ri == ri_Destination_Local) || (ri == ri_Gateway_Local) || (ri == ri_Broadcast_Local)) {
+    if ((buffer->pool_class () == bc_Receive) && !pool_reclass (buffer, bc_Forward)) { // over the forwarding quota; drop it
+      add_to_spares (buffer);
+      return;
+    }
+  }
+
+  switch (ri) {
 
   case ri_Destination_Self:   // that's us!
-    chain_buffers_pending.chain_push (buffer, true /* FIFO */);
+    if (!queue_pending.push (buffer, milliseconds ())) {
+      add_to_spares (buffer);
+    }
     break;
 
   case ri_Destination_Local:  // route through local network to final destination
   case ri_Gateway_Local:      // route through local network to gateway
     ch = channel (channel_number);
-    if (ch) {
-      ch->send (buffer);
-    } else {
+    if (!ch || !ch->send (buffer)) {
       add_to_spares (buffer);
     }
     break;
@@ -188,7 +449,11 @@ void IP_Manager::forward (IP_Buffer * buffer) {
     break;
 
   case ri_Gateway_Self:       // we're the gateway - route to external network
-    // TODO: route to external network
+    if (GW) {
+      GW->gateway_forward (*this, *buffer);
+    }
+    add_to_spares (buffer);
+    break;
 
   case ri_InvalidAddress:     // reserved network address, or channel not registered
     add_to_spares (buffer);
@@ -196,6 +461,14 @@ void IP_Manager::forward (IP_Buffer * buffer) {
   }
 }
 
+/* Whether a packet to the destination would go to our gateway, i.e., to an external network
+ */
+bool IP_Manager::for_gateway (const IP_Address & destination) const {
+  u8_t channel;
+
+  return GW && (channel_for_destination (channel, destination) == ri_Gateway_Self);
+}
+
 IP_Manager::RoutingInfo IP_Manager::channel_for_destination (u8_t & channel, const IP_Address & destination) const {
   u8_t id;
 
@@ -213,7 +486,7 @@ IP_Manager::RoutingInfo IP_Manager::channel_for_destination (u8_t & channel, con
     }
     ri = ri_Destination_Local;
   } else {
-    id = gateway.local_network_id ();
+    id = gateway_for (destination.family ()).local_network_id ();
 
     if (id == host.local_network_id ()) {
       channel = 0;
@@ -265,6 +538,14 @@ void IP_Manager::register_source (u8_t channel, const IP_Address & source) {
   }
 }
 
+void IP_Manager::cycle () { // make this the active instance, e.g., for DEBUG_PRINT, while it's running
+  IP_Manager * previous = s_active;
+
+  s_active = this;
+  IP_Clock::cycle ();
+  s_active = previous;
+}
+
 void IP_Manager::tick () {
   /* Update I/O channels
    */
@@ -275,115 +556,215 @@ void IP_Manager::tick () {
     ++C;
   }
 
+  /* Update the gateway to external networks, if any
+   */
+  if (GW) {
+    GW->gateway_update (*this);
+  }
+
   switch (ticker) { // try to balance processor load to allow the timers to function properly
   case 0:
     {
-      /* Update IP connections
+      /* Update the IP connections that have something to do; any still busy afterwards queue up again, behind
+       * the rest, for the next pass
        */
-      Chain<IP_Connection>::iterator I = chain_connection.begin ();
+      u16_t count = ready_count;
+
+      while (count--) {
+	IP_Connection * connection = ready_pop ();
 
-      while (*I) {
-	(*I)->update ();
-	++I;
+	if (!connection) { // some were removed
+	  break;
+	}
+	connection->update ();
       }
     }
     ++ticker;
     break;
 
-  case 1: // Handle next pending buffer, if any
-    {
-      IP_Buffer * pending = chain_buffers_pending.chain_pop ();
+  case 1: // Handle the next batch of pending buffers, if any
+    pending_pass ();
+    ++ticker;
+    break;
 
-      if (pending) {
-	// DEBUG_PRINT("IP_Manager::tick: pending\n");
-	switch (pending->sniff ()) {
+  case 2:
+  default:
+    if (!queue_pending.is_empty ()) { // still busy after the last pass - take another batch rather than wait for the next cycle
+      pending_pass ();
+    }
+    ticker = 0;
+    break;
+  }
+}
 
-	case IP_Buffer::hs_Okay:
-	  // DEBUG_PRINT("IP_Manager::tick: pending: Okay\n");
-	  register_source (pending->channel (), pending->ip().source ());
+/* Handle up to pending_batch buffers from the pending queue, stopping early if the pass takes
+ * longer than pending_budget milliseconds.
+ */
+void IP_Manager::pending_pass () {
+  u32_t start = milliseconds ();
 
-	  if (pending->ip().destination () == host) { // it's for us
-	    connection_handover (pending); // hand over to appropriate connection
-	  } else { // forward it
-	    forward (pending);
-	  }
-	  break;
+  for (u8_t count = 0; count < pending_batch; count++) {
+    bool bDrop;
 
-	case IP_Buffer::hs_EchoRequest:
-	  // DEBUG_PRINT("IP_Manager::tick: Echo Request\n");
-	  register_source (pending->channel (), pending->ip().source ());
-	  // pending->print ();
-	  if (pending->ip().destination () == host) { // it's for us; we don't respond to broadcast pings
-	    pending->ping_to_pong ();
-	    forward (pending);
-	  } else { // forward it
-	    if (chain_buffers_pending.chain_first () && !chain_buffers_spare.chain_first ()) { // if other pending (not possible if total spares == 1), but no spares, then drop it
-	      add_to_spares (pending);                                                         // more important to have spare buffers than ping packets (trying to avoid storms)
-	    } else {
-	      forward (pending);
-	    }
-	  }
-	  break;
+    IP_Buffer * pending = queue_pending.pop (milliseconds (), bDrop);
 
-	case IP_Buffer::hs_EchoReply:
-	  DEBUG_PRINT("IP_Manager::tick: Echo Reply\n");
-	  // pending->print ();
-	  register_source (pending->channel (), pending->ip().source ());
-
-	  if (pending->ip().destination () == host) { // it's for us
-	    if (EL) {
-	      u32_t round_trip;
-	      u16_t seq_no;
-
-	      pending->pong (round_trip, seq_no);                     // get the values
-	      EL->pong (pending->ip().source (), round_trip, seq_no); // pass them on
-	    }
-	    add_to_spares (pending);
-	  } else { // forward it
-	    forward (pending);
-	  }
-	  break;
+    if (!pending) {
+      break;
+    }
+    if (bDrop) { // queue management has dropped it
+      add_to_spares (pending);
+      continue;
+    }
+    pending_handle (pending);
+    ++pending_total;
 
-	case IP_Buffer::hs_Protocol_Unsupported:
-	  DEBUG_PRINT("IP_Manager::tick: Protocol Unsupported\n");
-	  register_source (pending->channel (), pending->ip().source ());
+    if (pending_budget && (milliseconds () - start >= pending_budget)) {
+      ++pending_overrun;
+      break;
+    }
+  }
+}
 
-	  if (pending->ip().destination () == host) { // it's for us - but we can't use it
-	    add_to_spares (pending);
-	  } else { // forward it
-	    forward (pending);
-	  }
-	  break;
+void IP_Manager::pending_reassemble (IP_Buffer * fragment) {
+  IP_Buffer * discard;
+  IP_Buffer * first = reassembler.add (fragment, milliseconds (), discard);
 
-	  /* Unable to handle this packet; don't handle or even forward it
-	   */
-	case IP_Buffer::hs_FrameError:
-	case IP_Buffer::hs_IPv4:
-	case IP_Buffer::hs_IPv4_FrameError:
-	case IP_Buffer::hs_IPv4_PacketTooShort:
-	case IP_Buffer::hs_IPv4_Checksum:
-	case IP_Buffer::hs_IPv6:
-	case IP_Buffer::hs_IPv6_FrameError:
-	case IP_Buffer::hs_IPv6_PacketTooShort:
-	case IP_Buffer::hs_Protocol_PacketTooShort:
-	case IP_Buffer::hs_Protocol_FrameError:
-	case IP_Buffer::hs_Protocol_Checksum:
-	  pending->print ();
-	  DEBUG_PRINT("IP_Manager::tick: Bad Packet\n");
-	  add_to_spares (pending);
-	  break;
-	}
+  add_to_spares (discard);
+
+  if (!first) { // still waiting for fragments
+    return;
+  }
+
+  /* the datagram is complete; only UDP is supported, and the checksum (if any) can now be checked
+   */
+  bool bOkay = first->ip().is_UDP () && (first->ip().payload_length () >= 8);
+
+  if (bOkay && first->udp().checksum ()) {
+    u16_t udp_length = 0;
+
+    for (IP_Buffer * B = first; B; B = B->fragment_next ()) {
+      udp_length += B->ip().payload_length ();
+    }
+
+    Check16 check;
+
+    first->ip().source().check (check);
+    first->ip().destination().check (check);
+
+    check += first->ip().protocol ();
+    check += udp_length;
+
+    first->udp().header (check);
+    first->check_16 (check, first->udp_data_offset ());
+
+    for (IP_Buffer * B = first->fragment_next (); B; B = B->fragment_next ()) {
+      B->check_16 (check, B->ip().header_length ());
+    }
+    ns16_t checksum_calc = check.checksum ();
+
+    bOkay = (first->udp().checksum () == checksum_calc) && (first->udp().length () == udp_length);
+  }
+
+  if (bOkay) {
+    if (is_host (first->ip().destination ())) {
+      connection_handover (first);
+    } else { // for an external network, via the gateway
+      forward (first);
+    }
+  } else {
+    DEBUG_PRINT("IP_Manager::pending_reassemble: Bad Datagram\n");
+    add_to_spares (first);
+  }
+}
+
+void IP_Manager::pending_handle (IP_Buffer * pending) {
+  // DEBUG_PRINT("IP_Manager::pending_handle\n");
+  switch (pending->sniff ()) {
+
+  case IP_Buffer::hs_Okay:
+    // DEBUG_PRINT("IP_Manager::pending_handle: Okay\n");
+    register_source (pending->channel (), pending->ip().source ());
+
+    if (is_host (pending->ip().destination ())) { // it's for us
+      connection_handover (pending); // hand over to appropriate connection
+    } else { // forward it
+      forward (pending);
+    }
+    break;
+
+  case IP_Buffer::hs_EchoRequest:
+    // DEBUG_PRINT("IP_Manager::pending_handle: Echo Request\n");
+    register_source (pending->channel (), pending->ip().source ());
+    // pending->print ();
+    if (is_host (pending->ip().destination ())) { // it's for us; we don't respond to broadcast pings
+      pending->ping_to_pong ();
+      forward (pending);
+    } else { // forward it
+      if (!queue_pending.is_empty () && !spare_count) { // if other pending (not possible if total spares == 1), but no spares, then drop it
+	add_to_spares (pending);                                    // more important to have spare buffers than ping packets (trying to avoid storms)
+      } else {
+	forward (pending);
       }
     }
-    ++ticker;
     break;
 
-  case 2:
-  default:
-    {
-      // TODO: Handle next pending task, if any
+  case IP_Buffer::hs_EchoReply:
+    DEBUG_PRINT("IP_Manager::pending_handle: Echo Reply\n");
+    // pending->print ();
+    register_source (pending->channel (), pending->ip().source ());
+
+    if (is_host (pending->ip().destination ())) { // it's for us
+      if (EL) {
+	u32_t round_trip;
+	u16_t seq_no;
+
+	pending->pong (round_trip, seq_no);                     // get the values
+	EL->pong (pending->ip().source (), round_trip, seq_no); // pass them on
+      }
+      add_to_spares (pending);
+    } else { // forward it
+      forward (pending);
     }
-    ticker = 0;
+    break;
+
+  case IP_Buffer::hs_Fragment:
+    register_source (pending->channel (), pending->ip().source ());
+
+    if (is_host (pending->ip().destination ()) || for_gateway (pending->ip().destination ())) { // reassemble it
+      pending_reassemble (pending);
+    } else { // forward it as is
+      forward (pending);
+    }
+    break;
+
+  case IP_Buffer::hs_Protocol_Unsupported:
+    DEBUG_PRINT("IP_Manager::pending_handle: Protocol Unsupported\n");
+    register_source (pending->channel (), pending->ip().source ());
+
+    if (is_host (pending->ip().destination ())) { // it's for us - but we can't use it
+      add_to_spares (pending);
+    } else { // forward it
+      forward (pending);
+    }
+    break;
+
+    /* Unable to handle this packet; don't handle or even forward it
+     */
+  case IP_Buffer::hs_FrameError:
+  case IP_Buffer::hs_IPv4:
+  case IP_Buffer::hs_IPv4_FrameError:
+  case IP_Buffer::hs_IPv4_PacketTooShort:
+  case IP_Buffer::hs_IPv4_Checksum:
+  case IP_Buffer::hs_IPv6:
+  case IP_Buffer::hs_IPv6_FrameError:
+  case IP_Buffer::hs_IPv6_PacketTooShort:
+  case IP_Buffer::hs_IPv6_Prefix:
+  case IP_Buffer::hs_Protocol_PacketTooShort:
+  case IP_Buffer::hs_Protocol_FrameError:
+  case IP_Buffer::hs_Protocol_Checksum:
+    pending->print ();
+    DEBUG_PRINT("IP_Manager::pending_handle: Bad Packet\n");
+    add_to_spares (pending);
     break;
   }
 }
@@ -393,7 +774,12 @@ void IP_Manager::every_millisecond () {
 }
 
 void IP_Manager::every_second () {
-  // ...
+  IP_Buffer * expired;
+
+  while ((expired = reassembler.expire (milliseconds ()))) { // discard incomplete datagrams that have timed out
+    add_to_spares (expired);
+  }
+  time_waiting.expire (milliseconds ());
 }
 
 bool IP_Manager::timeout () {
@@ -411,7 +797,7 @@ bool IP_Manager::timeout () {
 
 void IP_Manager::ping (const IP_Address & address, u16_t seq_no) {
   DEBUG_PRINT ("IP_Manager::ping\n");
-  IP_Buffer * spare = get_from_spares ();
+  IP_Buffer * spare = get_from_spares (bc_Control);
 
   if (!spare) {
     DEBUG_PRINT ("IP_Manager::ping: no spare\n");
@@ -0,0 +1,156 @@
+/* Copyright (c) 2018 Francis James Franklin
+ * 
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided
+ * that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and
+ *    the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ *    the following disclaimer in the documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*! \file ip_queue.cpp
+    \brief Implementation of IP_Queue.
+    
+    The dropping logic follows the CoDel pseudo-code in RFC 8289, except that a buffer selected for dropping
+    is handed back to the caller by pop() rather than being freed here.
+*/
+
+#include "netip/ip_queue.hh"
+
+IP_Queue::IP_Queue () :
+  queue_length(0),
+  queue_limit(IP_Queue_Limit),
+  codel_target(IP_Queue_Target),
+  codel_interval(IP_Queue_Interval),
+  first_above(0),
+  drop_next(0),
+  drop_count(0),
+  drop_count_last(0),
+  bDropping(false),
+  stat_length_max(0),
+  stat_sojourn(0),
+  stat_sojourn_max(0),
+  stat_queued(0),
+  stat_dropped(0),
+  stat_overflow(0)
+{
+  // ...
+}
+
+bool IP_Queue::push (IP_Buffer * buffer, u32_t now, bool bUrgent) {
+  if (buffer->in_chain (chain.chain_first ())) {
+    return false; // already queued
+  }
+  if (queue_limit && (queue_length >= queue_limit)) {
+    ++stat_overflow;
+    return false;
+  }
+  buffer->timestamp (now);
+
+  if (bUrgent) {
+    chain.chain_prepend (buffer);
+  } else {
+    chain.chain_append (buffer);
+  }
+
+  if (++queue_length > stat_length_max) {
+    stat_length_max = queue_length;
+  }
+  ++stat_queued;
+
+  return true;
+}
+
+IP_Buffer * IP_Queue::dequeue (u32_t now, bool & bOkToDrop) {
+  bOkToDrop = false;
+
+  IP_Buffer * buffer = chain.chain_pop ();
+
+  if (!buffer) {
+    first_above = 0;
+    return 0;
+  }
+  --queue_length;
+
+  stat_sojourn = buffer->sojourn (now);
+
+  if (stat_sojourn_max < stat_sojourn) {
+    stat_sojourn_max = stat_sojourn;
+  }
+
+  if (!codel_target || (stat_sojourn < codel_target) || !queue_length) { // never drop the last buffer in the queue
+    first_above = 0;
+  } else if (!first_above) {
+    first_above = now + codel_interval;
+  } else if (now >= first_above) {
+    bOkToDrop = true;
+  }
+  return buffer;
+}
+
+u32_t IP_Queue::control_law (u32_t t) const {
+  /* interval / sqrt(count), using an integer square root
+   */
+  u16_t root = 1;
+
+  while ((u32_t) (root + 1) * (root + 1) <= drop_count) {
+    ++root;
+  }
+  return t + codel_interval / root;
+}
+
+IP_Buffer * IP_Queue::pop (u32_t now, bool & bDrop) {
+  bool bOkToDrop;
+
+  bDrop = false;
+
+  IP_Buffer * buffer = dequeue (now, bOkToDrop);
+
+  if (!buffer) {
+    bDropping = false;
+    return 0;
+  }
+
+  if (bDropping) {
+    if (!bOkToDrop) {            // the delay is back below target
+      bDropping = false;
+    } else if (now >= drop_next) {
+      bDrop = true;
+      ++drop_count;
+      drop_next = control_law (drop_next);
+    }
+  } else if (bOkToDrop) {        // the delay has been above target for a whole interval; start dropping
+    bDrop = true;
+    bDropping = true;
+
+    /* if we were dropping recently, carry on at about the same rate
+     */
+    u16_t delta = drop_count - drop_count_last;
+
+    if ((delta > 1) && (now - drop_next < 16 * (u32_t) codel_interval)) {
+      drop_count = delta;
+    } else {
+      drop_count = 1;
+    }
+    drop_next = control_law (now);
+    drop_count_last = drop_count;
+  }
+
+  if (bDrop) {
+    ++stat_dropped;
+  }
+  return buffer;
+}
@@ -59,29 +59,35 @@ bool IP_Clock::timer_checks (u32_t current_time) {
   return !*I;
 }
 
-/** Run the clock. This continues indefinitely, but can be stopped by calling stop().
- * With each cycle of the infinite loop, tick() is called. Each millisecond, the timers are checked
- * using timer_checks(), and every_millisecond() is called. Once a second, every_second() is called.
+/** A single cycle of the clock. Each millisecond, the timers are checked using timer_checks(), and
+ * every_millisecond() is called. Once a second, every_second() is called. Then tick() is called.
  * Subclasses can override tick(), every_millisecond() and every_second().
  */
-void IP_Clock::run () {
-  while (!bStop) {
-    u32_t time = milliseconds ();  // just call this the once
+void IP_Clock::cycle () {
+  u32_t time = milliseconds ();  // just call this the once
 
-    if (last_timer_check < time) { // time is in milliseconds; timer_checks() should be called once a millisecond
-      while (!timer_checks (time));
-      last_timer_check = time;     // finished time checks; note current time
+  if (last_timer_check < time) { // time is in milliseconds; timer_checks() should be called once a millisecond
+    while (!timer_checks (time));
+    last_timer_check = time;     // finished time checks; note current time
 
-      every_millisecond ();
-    }
+    every_millisecond ();
+  }
 
-    if (time - last_timer_second > 999) {
-      last_timer_second += 1000;
+  if (time - last_timer_second > 999) {
+    last_timer_second += 1000;
 
-      every_second ();
-    }
+    every_second ();
+  }
 
-    tick ();
+  tick ();
+}
+
+/** Run the clock. This continues indefinitely, but can be stopped by calling stop().
+ * With each cycle of the infinite loop, cycle() is called.
+ */
+void IP_Clock::run () {
+  while (!bStop) {
+    cycle ();
 
     ip_arch_usleep (1);
   }
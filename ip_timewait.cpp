@@ -0,0 +1,97 @@
+/* Copyright (c) 2018 Francis James Franklin
+ * 
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided
+ * that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and
+ *    the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ *    the following disclaimer in the documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*! \file ip_timewait.cpp
+    \brief Implementation of IP_TimeWait.
+*/
+
+#include "netip/ip_timewait.hh"
+
+IP_TimeWait::IP_TimeWait () :
+  duration(IP_TCP_TimeWait),
+  stat_added(0),
+  stat_evicted(0),
+  stat_reused(0)
+{
+  for (int e = 0; e < IP_TCP_TimeWait_Slots; e++) {
+    entries[e].port_local = 0;
+  }
+}
+
+void IP_TimeWait::add (const IP_Address & remote, const ns16_t & port_local, const ns16_t & port_remote, u32_t seq_no, u32_t ack_no, u32_t now) {
+  Entry * entry = 0;
+
+  for (int e = 0; e < IP_TCP_TimeWait_Slots; e++) { // an unused entry, or else the oldest
+    if (!entries[e].port_local) {
+      entry = entries + e;
+      break;
+    }
+    if (!entry || (now - entries[e].started > now - entry->started)) {
+      entry = entries + e;
+    }
+  }
+  if (entry->port_local) {
+    ++stat_evicted;
+  }
+  ++stat_added;
+
+  entry->remote      = remote;
+  entry->port_local  = port_local;
+  entry->port_remote = port_remote;
+  entry->seq_no      = seq_no;
+  entry->ack_no      = ack_no;
+  entry->started     = now;
+}
+
+IP_TimeWait::Entry * IP_TimeWait::find (const IP_Buffer * buffer) {
+  for (int e = 0; e < IP_TCP_TimeWait_Slots; e++) {
+    Entry & entry = entries[e];
+
+    if (entry.port_local &&
+	(entry.port_local  == buffer->tcp().destination ()) &&
+	(entry.port_remote == buffer->tcp().source ()) &&
+	(entry.remote      == buffer->ip().source ())) {
+      return &entry;
+    }
+  }
+  return 0;
+}
+
+void IP_TimeWait::expire (u32_t now) {
+  for (int e = 0; e < IP_TCP_TimeWait_Slots; e++) {
+    if (entries[e].port_local && (now - entries[e].started >= duration)) {
+      entries[e].port_local = 0;
+    }
+  }
+}
+
+u8_t IP_TimeWait::count () const {
+  u8_t n = 0;
+
+  for (int e = 0; e < IP_TCP_TimeWait_Slots; e++) {
+    if (entries[e].port_local) {
+      ++n;
+    }
+  }
+  return n;
+}
@@ -87,51 +87,45 @@ void Link::remove_from_chain (Link *& link_first, Link *& link_last, Link * link
   }
 }
 
+void FIFO::attach (u8_t * byte_buffer, u16_t size) {
+  u16_t capacity = 0x8000;
+
+  while (capacity > size) {
+    capacity >>= 1;
+  }
+  buffer = capacity ? byte_buffer : 0;
+  mask   = capacity ? (capacity - 1) : 0;
+
+  clear ();
+}
+
 /** Read (and remove) multiple bytes from the buffer.
  * \param ptr    Pointer to an external byte array where the data should be written.
  * \param length Number of bytes to read from the buffer, if possible.
  * \return The number of bytes actually read from the buffer.
  */
 u16_t FIFO::read (u8_t * ptr, u16_t length) {
-  u16_t count = 0;
-
-  if (ptr && length) {
-    if (data_end > data_start) {
-
-      count = data_end - data_start;             // i.e., bytes in FIFO
-      count = (count > length) ? length : count; // or length, if less
-
-      memcpy (ptr, data_start, count);
-      data_start += count;
-
-    } else if (data_end < data_start) {
-
-      count = buffer_end - data_start;           // i.e., bytes in FIFO *at the end*
-      count = (count > length) ? length : count; // or length, if less
-
-      memcpy (ptr, data_start, count);
-      data_start += count;
-
-      if (data_start == buffer_end) { // wrap-around
-	data_start = buffer_start;
+  u16_t index = ip_arch_index_load (index_read);
+  u16_t total = ip_arch_index_load (index_write) - index;
 
-	length -= count;                         // how much we still want to read
-
-	u16_t extra = data_end - data_start;     // i.e., bytes in FIFO
-
-	if (length && extra) {                       // we can read more...
-	  extra = (extra > length) ? length : extra; // or length, if less
-
-	  memcpy (ptr, data_start, extra);
-	  data_start += extra;
+  if (!ptr || !total) {
+    return 0;
+  }
+  if (length > total) {
+    length = total;
+  }
 
-	  count += extra;
-	}
-      }
+  u16_t offset = index & mask;
+  u16_t first  = mask + 1 - offset; // bytes before the end of the ring
 
-    } // else (data_end == data_start) => FIFO is empty
+  if (first > length) {
+    first = length;
   }
-  return count;
+  memcpy (ptr, buffer + offset, first);
+  memcpy (ptr + first, buffer, length - first); // the rest, if the data wraps around
+
+  ip_arch_index_store (index_read, index + length); // only now can the producer reuse the space
+  return length;
 }
 
 /** Write multiple bytes to the buffer.
@@ -140,75 +134,25 @@ u16_t FIFO::read (u8_t * ptr, u16_t length) {
  * \return The number of bytes actually written to the buffer.
  */
 u16_t FIFO::write (const u8_t * ptr, u16_t length) {
-  u16_t count = 0;
-
-  if (ptr && length) {
-    if (data_end > data_start) {
-
-      /* this is where we need to worry about wrap-around
-       */
-
-      if (data_start == buffer_start) { // we're *not* able to wrap-around
-
-	count = buffer_end - data_end - 1;         // i.e., usable free space in FIFO *at the end*
-	count = (count > length) ? length : count; // or length, if less
+  u16_t index = ip_arch_index_load (index_write);
+  u16_t space = capacity () - (u16_t) (index - ip_arch_index_load (index_read));
 
-	memcpy (data_end, ptr, count);
-	data_end += count;
-
-      } else { // we *are* able to wrap-around
-
-	count = buffer_end - data_end;             // i.e., usable free space in FIFO *at the end*
-	count = (count > length) ? length : count; // or length, if less
-
-	memcpy (data_end, ptr, count);
-	data_end += count;
-
-	if (data_end == buffer_end) { // wrap-around
-	  data_end = buffer_start;
-
-	  length -= count;                             // how much we still want to write
-
-	  u16_t extra = data_start - data_end - 1;     // i.e., usable free space in FIFO
-
-	  if (length && extra) {                       // we can write more...
-	    extra = (extra > length) ? length : extra; // or length, if less
-
-	    memcpy (data_end, ptr, extra);
-	    data_end += extra;
-
-	    count += extra;
-	  }
-	}
-
-      }
-
-    } else if (data_end < data_start) {
-
-      count = data_start - data_end - 1;         // i.e., usable free space in FIFO
-      count = (count > length) ? length : count; // or length, if less
-
-      /* don't need to worry about wrap-around
-       */
-      memcpy (data_end, ptr, count);
-      data_end += count;
-
-    } else { // (data_end == data_start)
-
-      /* the FIFO is empty - we can move the pointers for convenience
-       */
-      data_start = buffer_start;
-      data_end   = buffer_start;
-
-      count = buffer_end - buffer_start - 1;     // i.e., maximum number of bytes the FIFO can hold
-      count = (count > length) ? length : count; // or length, if less
+  if (!ptr || !space) {
+    return 0;
+  }
+  if (length > space) {
+    length = space;
+  }
 
-      /* don't need to worry about wrap-around
-       */
-      memcpy (data_end, ptr, count);
-      data_end += count;
+  u16_t offset = index & mask;
+  u16_t first  = mask + 1 - offset; // space before the end of the ring
 
-    }
+  if (first > length) {
+    first = length;
   }
-  return count;
+  memcpy (buffer + offset, ptr, first);
+  memcpy (buffer, ptr + first, length - first); // the rest, if it wraps around
+
+  ip_arch_index_store (index_write, index + length); // only now can the consumer see the data
+  return length;
 }
@@ -32,6 +32,34 @@ typedef unsigned char  u8_t;
 typedef unsigned short u16_t;
 typedef unsigned long  u32_t;
 
+/* Storage class for per-thread state, e.g., the active IP_Manager; no threads here
+ */
+#define IP_ARCH_THREAD_LOCAL
+
+/* Free-running index of a ring (see FIFO); no threads, so no ordering is needed
+ */
+typedef u16_t ip_arch_index_t;
+
+static inline u16_t ip_arch_index_load (const ip_arch_index_t & index) {
+  return index;
+}
+
+static inline void ip_arch_index_store (ip_arch_index_t & index, u16_t value) {
+  index = value;
+}
+
+/* Lock for access to state shared by all threads; no threads, so nothing to do
+ */
+typedef u8_t ip_arch_lock_t;
+
+static inline void ip_arch_lock (ip_arch_lock_t &) {
+  // ...
+}
+
+static inline void ip_arch_unlock (ip_arch_lock_t &) {
+  // ...
+}
+
 static void ip_arch_usleep (u16_t us) {
   // do nothing
 }
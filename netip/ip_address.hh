@@ -26,9 +26,11 @@
     
     IPv6 addresses are 16 bytes compared to 4 bytes for an IPv4 address. IPv6 protocol headers are 40 bytes
     vs 20 bytes for IPv4. Support for IPv6 has a significant impact on memory requirements, which is critical
-    for devices such as the Arduino Uno. For this reason, there is support for either IPv4 or IPv6, but not
-    really both. The IP_Address class is defined for one or other, but not both. Perhaps this could/should be
-    rewritten as two distinct classes.
+    for devices such as the Arduino Uno. Either or both families can be supported (IP_USE_IPv4, IP_USE_IPv6),
+    and IP_Address stores addresses in a compact internal form: IPv6 addresses keep the 8-byte interface
+    identifier and an index into a small shared table of /64 prefixes (a mesh typically shares one prefix), so
+    an IPv6 address costs 9 bytes (10 if dual stack), and an IPv4-only build still pays only 4 bytes. A prefix
+    stays in the table only while an address refers to it.
 */
 
 #ifndef __ip_address_hh__
@@ -38,76 +40,201 @@
 #include "ip_types.hh"
 
 /** A class for storing and manipulating IP addresses.
- * IPv6 addresses are 16 bytes compared to 4 bytes for an IPv4 address. IPv6 protocol headers are 40 bytes
- * vs 20 bytes for IPv4. Support for IPv6 has a significant impact on memory requirements, which is critical
- * for devices such as the Arduino Uno. For this reason, there is support for either IPv4 or IPv6, but not
- * really both. The IP_Address class is defined for one or other, but not both. Perhaps this could/should be
- * rewritten as two distinct classes.
+ * The address family (IP_Family_IPv4 or IP_Family_IPv6) is stored only if both families are supported.
+ * IPv6 addresses are stored as the index of their /64 prefix in a static table of IP_Prefix_Count prefixes,
+ * followed by the 8-byte interface identifier; the wire format is recovered with write(). Each address holds a
+ * reference to its prefix, which is added to the table on demand and removed once no address refers to it; if
+ * the table is full of prefixes in use, the address is marked invalid. The table is shared by all IP_Manager
+ * instances, and is guarded by a lock (see ip_arch_lock()).
  */
 class IP_Address {
 private:
-  ns16_t address[IP_Address_WordCount]; ///< byte buffer (4 bytes for IPv4; 16 bytes for IPv6)
+#if IP_USE_IPv4 && IP_USE_IPv6
+  u8_t addr_family;   ///< IP_Family_IPv4 or IP_Family_IPv6
+#endif
+#if IP_USE_IPv6
+  u8_t addr_prefix;   ///< (IPv6) index into the prefix table, or IP_Prefix_None
+  u8_t addr_bytes[8]; ///< IPv6 interface identifier, or IPv4 address in the first 4 bytes
+#else
+  u8_t addr_bytes[4]; ///< IPv4 address
+#endif
+
+#if IP_USE_IPv6
+  /** Find the /64 prefix in the prefix table, adding it if necessary, and take a reference to it.
+   * \param prefix The first 8 bytes of an IPv6 address.
+   * \return The index of the prefix in the table, or IP_Prefix_None if the table is full.
+   */
+  static u8_t prefix_acquire (const u8_t * prefix);
+
+  /** Take another reference to the prefix with the specified index, if not IP_Prefix_None.
+   */
+  static void prefix_retain (u8_t index);
+
+  /** Drop a reference to the prefix with the specified index, if not IP_Prefix_None.
+   */
+  static void prefix_release (u8_t index);
+
+  /** The /64 prefix with the specified index; the index must be valid, and referred to.
+   */
+  static const u8_t * prefix (u8_t index);
+
+  /** Change the prefix index, dropping the reference to the old prefix; a reference to the new one must be held already.
+   */
+  inline void set_prefix (u8_t index) {
+    u8_t old_index = addr_prefix;
+
+    addr_prefix = index;
+    prefix_release (old_index);
+  }
+#endif
+
+  inline void set_family (u8_t family) {
+#if IP_USE_IPv4 && IP_USE_IPv6
+    addr_family = family;
+#else
+    (void) family;
+#endif
+  }
+
 public:
-  /** Pointer to the internal byte buffer containing the IP address. 
+  /** The address family, either IP_Family_IPv4 or IP_Family_IPv6.
    */
-  inline const u8_t * byte_buffer () const {
-    return (u8_t *) address;
+  inline u8_t family () const {
+#if IP_USE_IPv4 && IP_USE_IPv6
+    return addr_family;
+#else
+    return IP_Family_Default;
+#endif
+  }
+
+  /** Whether this is an IPv6 address; resolves at compile-time unless both families are supported.
+   */
+  inline bool is_IPv6 () const {
+#if IP_USE_IPv4 && IP_USE_IPv6
+    return addr_family == IP_Family_IPv6;
+#else
+    return IP_USE_IPv6;
+#endif
+  }
+
+  /** An IPv6 address is invalid if its prefix couldn't be added to the prefix table; IPv4 addresses are always valid.
+   */
+  inline bool is_valid () const {
+#if IP_USE_IPv6
+    return !is_IPv6 () || (addr_prefix != IP_Prefix_None);
+#else
+    return true;
+#endif
   }
 
-  /** Number of bytes in the internal byte buffer containing the IP address. 
+  /** Number of bytes in the wire format of the address (4 for IPv4; 16 for IPv6).
    */
   inline u8_t byte_length () const {
-    return IP_Address_WordCount << 1;
+    return is_IPv6 () ? 16 : 4;
   }
 
+  /** The nth byte of the wire format of the address; the prefix bytes of an invalid IPv6 address are zero.
+   */
+  inline u8_t byte (u8_t i) const {
 #if IP_USE_IPv6
-  /** For IPv6, IP_Address[n] is a reference to the nth two-byte word of the eight two-byte address.
+    if (is_IPv6 ()) {
+      if (i >= 8)
+	return addr_bytes[i - 8];
+      return (addr_prefix != IP_Prefix_None) ? prefix (addr_prefix)[i] : 0;
+    }
+#endif
+    return addr_bytes[i];
+  }
+
+  /** Read the address from its wire format, e.g., from a packet header.
+   * \param address_family IP_Family_IPv4 or IP_Family_IPv6.
+   * \param wire           The address in network byte order (4 or 16 bytes).
+   * \return False if an IPv6 prefix could not be added to the prefix table.
    */
-  inline ns16_t & operator[] (int i) {
-    return address[i];
+  inline bool read (u8_t address_family, const u8_t * wire) {
+    set_family (address_family);
+#if IP_USE_IPv6
+    if (is_IPv6 ()) {
+      memcpy (addr_bytes, wire + 8, 8);
+      set_prefix (prefix_acquire (wire));
+      return addr_prefix != IP_Prefix_None;
+    }
+    set_prefix (IP_Prefix_None);
+#endif
+    memcpy (addr_bytes, wire, 4);
+    return true;
   }
-#else
+
+#if IP_USE_IPv6
+  /** Whether the /64 prefix of an IPv6 address (in wire format) is in the prefix table, or could be added now;
+   * unlike read(), this doesn't change the table.
+   */
+  static bool prefix_available (const u8_t * wire);
+#endif
+
+  /** Write the wire format of the address, e.g., into a packet header.
+   * \param wire Destination for the address in network byte order (byte_length() bytes).
+   */
+  inline void write (u8_t * wire) const {
+#if IP_USE_IPv6
+    if (is_IPv6 ()) {
+      if (addr_prefix != IP_Prefix_None)
+	memcpy (wire, prefix (addr_prefix), 8);
+      else
+	memset (wire, 0, 8);
+      memcpy (wire + 8, addr_bytes, 8);
+      return;
+    }
+#endif
+    memcpy (wire, addr_bytes, 4);
+  }
+
+#if IP_USE_IPv4
   /** For IPv4, IP_Address[n] is a reference to the nth byte of the four-byte address.
    */
   inline u8_t & operator[] (int i) {
-    return address[0x01 & (((u8_t) i) >> 1)][i];
+    return addr_bytes[i & 0x03];
   }
 
   /** For IPv4, IP_Address[n] is a (constant) reference to the nth byte of the four-byte address.
    */
   inline const u8_t & operator[] (int i) const {
-    return address[0x01 & (((u8_t) i) >> 1)][i];
+    return addr_bytes[i & 0x03];
   }
 #endif
 
-  /** Assignment operator.
-   */
-  inline IP_Address & operator= (const IP_Address & rhs) {
-    memcpy (address, rhs.address, IP_Address_WordCount << 1);
-    return *this;
-  }
-
-  /** Equality comparison of two IP_Address objects.
+  /** Equality comparison of two IP_Address objects; false if either is invalid.
+   * Prefixes are unique in the prefix table, so IPv6 addresses compare by prefix index.
    */
   inline bool operator== (const IP_Address & rhs) const {
-    return !memcmp (address, rhs.address, IP_Address_WordCount << 1);
+    if (family () != rhs.family ())
+      return false;
+#if IP_USE_IPv6
+    if (is_IPv6 ())
+      return (addr_prefix != IP_Prefix_None) && (addr_prefix == rhs.addr_prefix) && !memcmp (addr_bytes, rhs.addr_bytes, 8);
+#endif
+    return !memcmp (addr_bytes, rhs.addr_bytes, 4);
   }
 
   /** Inequality comparison of two IP_Address objects.
    */
   inline bool operator!= (const IP_Address & rhs) const {
-    return memcmp (address, rhs.address, IP_Address_WordCount << 1);
+    return !(*this == rhs);
   }
 
   /** Masked equality comparison of two IP_Address objects, i.e., do the addresses match wherever the mask bit is 1.
    * \param rhs  The address to compare with.
-   * \param mask The address to use as a bitmask.
-   * \return True if the addresses match wherever the mask bit is 1.
+   * \param mask The address to use as a bitmask; should be of the same family.
+   * \return True if the addresses are of the same family and match wherever the mask bit is 1.
    */
   inline bool compare (const IP_Address & rhs, const IP_Address & mask) const {
+    if ((family () != rhs.family ()) || (family () != mask.family ()))
+      return false;
+
     bool bMatch = true;
-    for (u8_t i = 0; i < IP_Address_WordCount; i++) {
-      if (((u16_t) address[i] & (u16_t) mask.address[i]) != ((u16_t) rhs.address[i] & (u16_t) mask.address[i])) {
+    for (u8_t i = 0; i < byte_length (); i++) {
+      u8_t m = mask.byte (i);
+      if ((byte (i) & m) != (rhs.byte (i) & m)) {
 	bMatch = false;
 	break;
       }
@@ -119,77 +246,110 @@ public:
    * \param C  The Check16 object being used to calculate the checksum.
    */
   inline void check (Check16 & C) const {
-    for (u8_t i = 0; i < IP_Address_WordCount; i++) {
-      C += address[i];
+    for (u8_t i = 0; i < byte_length (); i += 2) {
+      C += (u16_t) ((((u16_t) byte (i)) << 8) | byte (i + 1));
     }
   }
 
-  /** For IPv6, IP_Address::set() will set the address with eight two-byte words, e.g., set (0xfe00, 0x1234, ...).
-   * For IPv4, IP_Address::set() will set the address with four bytes, e.g., set (192, 168, 5, 1).
+#if IP_USE_IPv4
+  /** Set an IPv4 address with four bytes, e.g., set (192, 168, 5, 1).
    */
-  inline void set (
-#if IP_USE_IPv6
-		   u16_t addr_0, u16_t addr_1, u16_t addr_2, u16_t addr_3,
-		   u16_t addr_4, u16_t addr_5, u16_t addr_6, u16_t addr_7
-#else
-		   u8_t addr_0, u8_t addr_1, u8_t addr_2, u8_t addr_3
-#endif
-		   ) {
-    (*this)[0] = addr_0;
-    (*this)[1] = addr_1;
-    (*this)[2] = addr_2;
-    (*this)[3] = addr_3;
+  inline void set (u8_t addr_0, u8_t addr_1, u8_t addr_2, u8_t addr_3) {
+    set_family (IP_Family_IPv4);
 #if IP_USE_IPv6
-    (*this)[4] = addr_4;
-    (*this)[5] = addr_5;
-    (*this)[6] = addr_6;
-    (*this)[7] = addr_7;
+    set_prefix (IP_Prefix_None);
 #endif
+    addr_bytes[0] = addr_0;
+    addr_bytes[1] = addr_1;
+    addr_bytes[2] = addr_2;
+    addr_bytes[3] = addr_3;
   }
 
-  /** For IPv6, the constructor can set the address with eight two-byte words, e.g., IP_Address(0xfe00, 0x1234, ...).
-   * For IPv4, the constructor can set the address with four bytes, e.g., IP_Address(192, 168, 5, 1).
+  /** The constructor can set an IPv4 address with four bytes, e.g., IP_Address(192, 168, 5, 1).
    */
-  IP_Address (
+  IP_Address (u8_t addr_0, u8_t addr_1, u8_t addr_2, u8_t addr_3) {
 #if IP_USE_IPv6
-	      u16_t addr_0, u16_t addr_1, u16_t addr_2, u16_t addr_3,
-	      u16_t addr_4, u16_t addr_5, u16_t addr_6, u16_t addr_7
-#else
-	      u8_t addr_0, u8_t addr_1, u8_t addr_2, u8_t addr_3
+    addr_prefix = IP_Prefix_None;
 #endif
-	      ) {
-    (*this)[0] = addr_0;
-    (*this)[1] = addr_1;
-    (*this)[2] = addr_2;
-    (*this)[3] = addr_3;
-#if IP_USE_IPv6
-    (*this)[4] = addr_4;
-    (*this)[5] = addr_5;
-    (*this)[6] = addr_6;
-    (*this)[7] = addr_7;
+    set (addr_0, addr_1, addr_2, addr_3);
+  }
 #endif
+
+#if IP_USE_IPv6
+  /** Set an IPv6 address with eight two-byte words, e.g., set (0xfd00, 0x1234, ...).
+   * \return False if the prefix could not be added to the prefix table.
+   */
+  inline bool set (u16_t addr_0, u16_t addr_1, u16_t addr_2, u16_t addr_3,
+		   u16_t addr_4, u16_t addr_5, u16_t addr_6, u16_t addr_7) {
+    const u16_t words[8] = { addr_0, addr_1, addr_2, addr_3, addr_4, addr_5, addr_6, addr_7 };
+    u8_t wire[16];
+
+    for (u8_t i = 0; i < 8; i++) {
+      wire[2*i  ] = (u8_t) (words[i] >> 8);
+      wire[2*i+1] = (u8_t) (words[i] & 0xFF);
+    }
+    return read (IP_Family_IPv6, wire);
+  }
+
+  /** The constructor can set an IPv6 address with eight two-byte words, e.g., IP_Address(0xfd00, 0x1234, ...).
+   */
+  IP_Address (u16_t addr_0, u16_t addr_1, u16_t addr_2, u16_t addr_3,
+	      u16_t addr_4, u16_t addr_5, u16_t addr_6, u16_t addr_7) {
+    addr_prefix = IP_Prefix_None;
+    set (addr_0, addr_1, addr_2, addr_3, addr_4, addr_5, addr_6, addr_7);
   }
+#endif
 
   /** The default constructor - does not set a default address.
    */
   IP_Address () {
-    // ...
+    set_family (IP_Family_Default);
+#if IP_USE_IPv6
+    addr_prefix = IP_Prefix_None;
+#endif
+  }
+
+#if IP_USE_IPv6
+  /** Copies share the reference-counted prefix.
+   */
+  IP_Address (const IP_Address & rhs) {
+#if IP_USE_IPv4
+    addr_family = rhs.addr_family;
+#endif
+    addr_prefix = rhs.addr_prefix;
+    memcpy (addr_bytes, rhs.addr_bytes, 8);
+    prefix_retain (addr_prefix);
+  }
+
+  IP_Address & operator= (const IP_Address & rhs) {
+    if (this != &rhs) {
+      prefix_retain (rhs.addr_prefix);
+      set_prefix (rhs.addr_prefix);
+      set_family (rhs.family ());
+      memcpy (addr_bytes, rhs.addr_bytes, 8);
+    }
+    return *this;
   }
 
+  ~IP_Address () {
+    prefix_release (addr_prefix);
+  }
+#else
   ~IP_Address () {
     // ...
   }
+#endif
 
   /** Set the last byte of the address. NetIP uses the last byte of the address (value in range 1-254) to identify devices in the local network.
    */
   inline void set_local_network_id (u8_t id) {
-    address[IP_Address_WordCount-1][1] = id; // final byte of address; must be local-network unique in range 1-254
+    addr_bytes[is_IPv6 () ? 7 : 3] = id; // final byte of address; must be local-network unique in range 1-254
   }
 
   /** Get the last byte of the address. NetIP uses the last byte of the address (value in range 1-254) to identify devices in the local network.
    */
   inline u8_t local_network_id () const {
-    return address[IP_Address_WordCount-1][1]; // final byte of address; must be local-network unique
+    return addr_bytes[is_IPv6 () ? 7 : 3]; // final byte of address; must be local-network unique
   }
 };
 
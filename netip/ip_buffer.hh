@@ -25,7 +25,7 @@
     \brief The actual packet buffer, along with utility methods for analysing or creating the protocol and IP headers.
     
     The packet buffer must be associated with an originating channel; if it's being generated, then the channel number is zero.
-    Either IPv4 or IPv6 is supported, but not both simultaneously.
+    IPv4 and/or IPv6 are supported (see IP_USE_IPv4, IP_USE_IPv6); the IP header is accessed through IP_Header.
 */
 
 #ifndef __ip_buffer_hh__
@@ -33,17 +33,58 @@
 
 #include "ip_protocol.hh"
 
+class IP_Manager;
+
+/** Buffers taken from IP_Manager's pool of spares are accounted against a consumer class, each of which can
+ * have a number of buffers reserved for it and a maximum quota; see IP_Manager::set_buffer_quota().
+ */
+enum IP_BufferClass {
+  bc_Receive = 0, ///< Packets received by a channel, waiting to be handled or delivered to a connection.
+  bc_Forward,     ///< Received packets queued for sending on to neighbouring devices.
+  bc_Transmit,    ///< Packets generated locally by connections, e.g., UDP data.
+  bc_Control,     ///< Packets generated internally, e.g., pings and TCP handshakes and acknowledgements.
+  bc_Count,       ///< The number of consumer classes; the following are not accounted.
+  bc_Channel,     ///< Held by a channel for receiving packets into.
+  bc_Spare        ///< In the pool of spares.
+};
+
 /** The IP_Buffer contains the actual byte buffer for packets, as well as a range of utility methods for examining
  * and/or generating the protocols and and data. The packet buffer must be associated with an originating channel;
- * if it's being generated, then the channel number is zero. Either IPv4 or IPv6 is supported, but not both simultaneously.
+ * if it's being generated, then the channel number is zero. IPv4 and/or IPv6 are supported; see IP_Header.
  */
 class IP_Buffer : public Buffer, public Link {
 private:
   u8_t buffer[IP_Buffer_WordCount << 1]; ///< The main packet buffer, containing IP and UDP/TCP/ICMP headers, as well as any data.
   u8_t source_channel;                   ///< Number (1-15) indicating the source (i.e., which IP_Channel) of the packet; or 0 for self.
   u8_t ref_count;                        ///< A reference counter.
+  u8_t consumer_class;                   ///< The IP_BufferClass the buffer is currently accounted against.
+  u16_t queue_time;                      ///< Time (in milliseconds, truncated) at which the buffer was last queued.
+  IP_Manager * owner;                    ///< The IP_Manager the buffer belongs to.
+  IP_Buffer * fragment_chain;            ///< The next fragment of a reassembled datagram, if any.
 
 public:
+  /** Set the next fragment of a reassembled datagram; see IP_Reassembly.
+   */
+  inline void fragment_next (IP_Buffer * buffer) {
+    fragment_chain = buffer;
+  }
+
+  /** Get the next fragment of a reassembled datagram; 0 if this is the last (or the only) buffer.
+   */
+  inline IP_Buffer * fragment_next () const {
+    return fragment_chain;
+  }
+
+  /** Bind the buffer to the IP_Manager it belongs to; for IP_Manager's use.
+   */
+  inline void bind (IP_Manager * manager) {
+    owner = manager;
+  }
+
+  /** The IP_Manager the buffer belongs to; if unbound, the default IP_Manager::manager().
+   */
+  IP_Manager & manager () const;
+
   /** Set the number of the originating channel; 0 for packets generated by us, 1-15 for other channels (identified by IP_Channel).
    */
   inline void channel (u8_t channel_number) {
@@ -56,6 +97,30 @@ public:
     return source_channel;
   }
 
+  /** Set the consumer class (IP_BufferClass) the buffer is accounted against; for IP_Manager's use.
+   */
+  inline void pool_class (u8_t bc) {
+    consumer_class = bc;
+  }
+
+  /** Get the consumer class (IP_BufferClass) the buffer is accounted against.
+   */
+  inline u8_t pool_class () const {
+    return consumer_class;
+  }
+
+  /** Note the time (in milliseconds) at which the buffer is queued; see IP_Queue.
+   */
+  inline void timestamp (u32_t time) {
+    queue_time = (u16_t) time;
+  }
+
+  /** Time (in milliseconds) spent in the queue since timestamp() was called.
+   */
+  inline u16_t sojourn (u32_t time) const {
+    return (u16_t) time - queue_time;
+  }
+
   /** Increment the reference counter.
    */
   inline void ref () {
@@ -74,12 +139,22 @@ public:
     return (ref_count > 0);
   }
 
+  /** Returns true if there is more than one reference, e.g., if a retained buffer is still queued for sending by a channel.
+   */
+  inline bool shared () const {
+    return (ref_count > 1);
+  }
+
   /** Default constructor.
    */
   IP_Buffer () :
     Buffer(buffer, IP_Buffer_WordCount << 1),
     source_channel(0),
-    ref_count(0)
+    ref_count(0),
+    consumer_class(bc_Channel),
+    queue_time(0),
+    owner(0),
+    fragment_chain(0)
   {
     // ...
   }
@@ -88,31 +163,17 @@ public:
     // ...
   }
 
-#if IP_USE_IPv6
-  /** Returns a reference to the IP header within the buffer. For IPv6, see struct IP_Header_IPv6. For IPv4, see struct IP_Header_IPv4.
+  /** Returns a view of the IP header within the buffer, which dispatches on the IP version; see struct IP_Header.
    */
-  inline struct IP_Header_IPv6 & ip () {
-    return *((struct IP_Header_IPv6 *) buffer);
+  inline struct IP_Header ip () {
+    return IP_Header (buffer);
   }
 
-  /** Returns a constant reference to the IP header within the buffer. For IPv6, see struct IP_Header_IPv6. For IPv4, see struct IP_Header_IPv4.
+  /** Returns a constant view of the IP header within the buffer, which dispatches on the IP version; see struct IP_Header.
    */
-  inline const struct IP_Header_IPv6 & ip () const {
-    return *((const struct IP_Header_IPv6 *) buffer);
+  inline const struct IP_Header ip () const {
+    return IP_Header ((u8_t *) buffer);
   }
-#else // IP_USE_IPv6
-  /** Returns a reference to the IP header within the buffer. For IPv6, see struct IP_Header_IPv6. For IPv4, see struct IP_Header_IPv4.
-   */
-  inline struct IP_Header_IPv4 & ip () {
-    return *((struct IP_Header_IPv4 *) buffer);
-  }
-
-  /** Returns a constant reference to the IP header within the buffer. For IPv6, see struct IP_Header_IPv6. For IPv4, see struct IP_Header_IPv4.
-   */
-  inline const struct IP_Header_IPv4 & ip () const {
-    return *((const struct IP_Header_IPv4 *) buffer);
-  }
-#endif
 
   /** Returns a reference to the TCP header within the buffer.
    */
@@ -175,11 +236,12 @@ public:
   }
 
   /** Reset the buffer, ready to generate a new packet of the specified protocol.
-   * \param p The protocol (TCP, UDP, ICMP) of the new packet.
+   * \param p      The protocol (TCP, UDP, ICMP) of the new packet.
+   * \param family The address family (IP_Family_IPv4 or IP_Family_IPv6) of the new packet, i.e., of its destination.
    */
-  inline void defaults (IP_Protocol p) {
-    ip().defaults ();
-    ip().protocol() = (u8_t) p;
+  inline void defaults (IP_Protocol p, u8_t family = IP_Family_Default) {
+    ip().defaults (family);
+    ip().protocol() = ((p == p_ICMP) && ip().is_IPv6 ()) ? 0x3A : (u8_t) p; // IPv6-ICMP
 
     buffer_used = ip().header_length ();
 
@@ -208,14 +270,16 @@ public:
     hs_FrameError,               ///< An internal error - an empty packet.
     hs_EchoRequest,              ///< An Echo Request (ping!) received
     hs_EchoReply,                ///< Response to an Echo Request (i.e., an Echo Reply) received
-    hs_IPv4,                     ///< The packet is IPv4, but we only support IPv6
+    hs_IPv4,                     ///< The packet is IPv4, but IPv4 is not supported (IP_USE_IPv4)
     hs_IPv4_FrameError,          ///< The packet is shorter than the IPv4 header, or the packet's stated header length is longer than the packet
     hs_IPv4_PacketTooShort,      ///< The packet's stated length does not match the packet's actual length
     hs_IPv4_Checksum,            ///< The IPv4 checksum is wrong.
-    hs_IPv6,                     ///< The packet is IPv6, but we only support IPv4
+    hs_IPv6,                     ///< The packet is IPv6, but IPv6 is not supported (IP_USE_IPv6)
     hs_IPv6_FrameError,          ///< The packet is shorter than the IPv6 header
     hs_IPv6_PacketTooShort,      ///< The packet's stated length does not match the packet's actual length
+    hs_IPv6_Prefix,              ///< An address's /64 prefix can't be represented; the IP_Address prefix table (IP_Prefix_Count) is full
     hs_Protocol_Unsupported,     ///< Protocol is not one of TCP, UDP, ICMP (Echo Request / Reply)
+    hs_Fragment,                 ///< A fragment of a larger (IPv4) datagram; the protocol can't be checked until reassembled
     hs_Protocol_FrameError,      ///< Stated length of TCP header is too short
     hs_Protocol_PacketTooShort,  ///< The packet's stated length does not match the packet's actual length
     hs_Protocol_Checksum         ///< The protocol checksum is wrong.
@@ -225,6 +289,20 @@ public:
    */
   HeaderSniff sniff () const;
 
+  /** Add options to a new TCP packet, padded to a multiple of 4 bytes; call before adding any data.
+   * \param options The options, already encoded.
+   * \param length  The length of the options (at most 40 bytes).
+   * \return False if there's data already, or if there isn't space.
+   */
+  bool tcp_options (const u8_t * options, u8_t count);
+
+  /** Find an option in a received TCP packet.
+   * \param kind   The option kind, e.g., IP_TCP_Option_SACK.
+   * \param length Set to the length of the option's data, i.e., excluding the kind & length bytes.
+   * \return Pointer to the option's data, or 0 if the option isn't present.
+   */
+  const u8_t * tcp_option (u8_t kind, u8_t & length) const;
+
   /** Last step before sending a new TCP packet: set lengths and calculate checksums.
    */
   void tcp_finalise ();
@@ -233,12 +311,67 @@ public:
    */
   void udp_finalise ();
 
+  /** Last step before sending a new UDP packet on behalf of another device (e.g., a gateway injecting a reply from
+   * an external network): set source address and lengths, and calculate checksums.
+   */
+  void udp_finalise (const IP_Address & source);
+
+  /** As udp_finalise(source), but with the checksum of the data already calculated, e.g., for the same data sent to
+   * many destinations. (The data must start at an even offset, as it does with IPv4 & IPv6 headers.)
+   */
+  void udp_finalise (const IP_Address & source, const Check16 & data_check);
+
 private:
+  /** Set the IPv4 header checksum, once the rest of the IP header is complete; nothing to do for IPv6.
+   */
+  void header_finalise ();
+
   /** Last step before sending a new ICMP packet: set lengths and calculate checksums.
    */
   void icmp_finalise ();
 
 public:
+#if IP_USE_IPv4
+  /** Prepare a fragment of a larger IPv4 datagram. Only the IP header is set; the fragment's payload should be appended.
+   * \param p      The protocol of the datagram.
+   * \param id     The identification shared by all fragments of the datagram.
+   * \param offset The byte offset of the fragment's payload within the datagram's payload; must be a multiple of 8.
+   * \param bMore  True if more fragments follow this one.
+   */
+  inline void fragment_defaults (IP_Protocol p, u16_t id, u16_t offset, bool bMore) {
+    IP_Header_IPv4 & v4 = ip().v4 ();
+
+    v4.defaults ();
+    v4.protocol() = (u8_t) p;
+    v4.id() = id;
+    v4.set_fragment_offset (offset >> 3);
+    if (bMore) {
+      v4.set_flags_MF ();
+    }
+    buffer_used = v4.header_length ();
+  }
+
+  /** Last step before sending a fragment: set source address and length, and calculate the header checksum.
+   */
+  void fragment_finalise ();
+
+  /** The byte offset of the fragment's payload within the datagram's payload.
+   */
+  inline u16_t fragment_offset () const {
+    return ip().v4().get_fragment_offset () << 3;
+  }
+
+  /** Returns true if more fragments follow this one.
+   */
+  inline bool fragment_more () const {
+    bool DF;
+    bool MF;
+
+    ip().v4().get_flags (DF, MF);
+    return MF;
+  }
+#endif
+
   /** Generate an Echo Request ping packet.
    */
   void ping (const IP_Address & destination, u16_t seq_no);
@@ -24,7 +24,7 @@
 #ifndef __ip_channel_hh__
 #define __ip_channel_hh__
 
-#include "ip_buffer.hh"
+#include "ip_queue.hh"
 
 /* SLIP encoding special bytes
  */
@@ -51,7 +51,7 @@ class IP_Channel : public Link {
 private:
   IP_Buffer initial_buffer;
 
-  Chain<IP_Buffer> chain_out;
+  IP_Queue queue_out;
 
   IP_Buffer * buffer_in;
   IP_Buffer * buffer_out;
@@ -62,6 +62,8 @@ private:
 
   u8_t slip_read_flags;
 
+  IP_Manager * owner;
+
 public:
   inline u8_t number () const {
     return channel_number;
@@ -76,7 +78,8 @@ public:
     buffer_out(0),
     bytes_sent(0),
     channel_number(0),
-    slip_read_flags(0)
+    slip_read_flags(0),
+    owner(0)
   {
     // ...
   }
@@ -85,15 +88,34 @@ public:
     // ...
   }
 
-  inline void send (IP_Buffer * buffer, bool bUrgent = false) {
+  /* Bind the channel to its IP_Manager; see IP_Manager::channel_add()
+   */
+  inline void bind (IP_Manager * manager) {
+    owner = manager;
+    initial_buffer.bind (manager);
+  }
+
+  /* The IP_Manager the channel belongs to; if unbound, the default IP_Manager::manager()
+   */
+  IP_Manager & manager () const;
+
+  /* Output queue, e.g., for adjusting queue management or checking statistics
+   */
+  inline IP_Queue & queue () {
+    return queue_out;
+  }
+
+  /* Queue a buffer for sending; returns false if the queue is full (or the buffer is already queued), in which
+   * case the buffer isn't retained
+   */
+  inline bool send (IP_Buffer * buffer, bool bUrgent = false) {
     if (buffer) {
+      if (!queue_out.push (buffer, ip_arch_millis (), bUrgent)) {
+	return false;
+      }
       buffer->ref ();
-
-      if (bUrgent)
-	chain_out.chain_prepend (buffer);
-      else
-	chain_out.chain_append (buffer);
     }
+    return true;
   }
 
 protected:
@@ -104,6 +126,19 @@ protected:
   bool slip_can_receive (); // call this before trying slip_receive().
   void slip_receive (u8_t byte);
 
+  /* SLIP-decode a byte into the buffer, with read_flags keeping track of escapes and errors (initially 0);
+   * returns true if the byte completes a packet; for channels that do their own buffer management
+   */
+  static bool slip_decode (IP_Buffer * buffer, u8_t & read_flags, u8_t byte);
+
+  /* Hand over the channel's own receive buffer; for channels that do their own buffer management
+   */
+  inline IP_Buffer * slip_detach_buffer () {
+    IP_Buffer * buffer = buffer_in;
+    buffer_in = 0;
+    return buffer;
+  }
+
 public:
   virtual void update () {
     // 
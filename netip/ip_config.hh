@@ -25,16 +25,19 @@
     \brief Defaults and settings that affect NetIP.
     
     Some settings affect network communication and should be kept constant for all devices on the network,
-    in particular IP_USE_IPv6 and IP_Buffer_WordCount, but the rest could be (and arguably *should* be)
+    in particular IP_USE_IPv4, IP_USE_IPv6 and IP_Buffer_WordCount, but the rest could be (and arguably *should* be)
     moved to device-specific application source folders / sketches.
 */
 
 #ifndef __ip_config_hh__
 #define __ip_config_hh__
 
-/* Protocol options
+/* Protocol options; either or both (dual stack) of IPv4 and IPv6 can be supported
  */
-#define IP_USE_IPv6          0 ///< Use IPv6 protocol headers; default is IPv4.
+#define IP_USE_IPv4          1 ///< Support IPv4; if both are supported, IPv4 is the default for the host address etc.
+#define IP_USE_IPv6          0 ///< Support IPv6.
+
+#define IP_Prefix_Count      4 ///< (IPv6) Number of distinct /64 prefixes that can be in use at any one time; see IP_Address.
 
 /* Architecture build options
  */
@@ -59,21 +62,119 @@
 /* (Comma-separated) Default host & gateway (default router) addresses and netmask, for IPv4 and IPv6.
  * .255 should be broadcast; .0 reserved as a network identifier.
  */
-#if IP_USE_IPv6
-#define IP_Address_DefaultHost    0xfd00,0x0000,0x0000,0x0000,0x0000,0x0000,0x0000,(0x0500|IP_HostID_Default)
-#define IP_Address_DefaultGateway 0xfd00,0x0000,0x0000,0x0000,0x0000,0x0000,0x0000,(0x0500|IP_GatewayID_Default)
-#define IP_Address_DefaultNetmask 0xffff,0xffff,0xffff,0xffff,0xffff,0xffff,0xffff,0xff00
-#else
-#define IP_Address_DefaultHost    192,168,  5,IP_HostID_Default    ///< Default host address; for both IPv4 and IPv6, the last byte (1-254) identifies the device on NetIP's local network.
-#define IP_Address_DefaultGateway 192,168,  5,IP_GatewayID_Default ///< Default gateway address; attempts to connect to external addresses will route to the gateway device.
-#define IP_Address_DefaultNetmask 255,255,255,0                    ///< Network mask.
-#endif
+#define IP_Address_DefaultHost4    192,168,  5,IP_HostID_Default    ///< Default host address; for both IPv4 and IPv6, the last byte (1-254) identifies the device on NetIP's local network.
+#define IP_Address_DefaultGateway4 192,168,  5,IP_GatewayID_Default ///< Default gateway address; attempts to connect to external addresses will route to the gateway device.
+#define IP_Address_DefaultNetmask4 255,255,255,0                    ///< Network mask.
+
+#define IP_Address_DefaultHost6    0xfd00,0x0000,0x0000,0x0000,0x0000,0x0000,0x0000,(0x0500|IP_HostID_Default)
+#define IP_Address_DefaultGateway6 0xfd00,0x0000,0x0000,0x0000,0x0000,0x0000,0x0000,(0x0500|IP_GatewayID_Default)
+#define IP_Address_DefaultNetmask6 0xffff,0xffff,0xffff,0xffff,0xffff,0xffff,0xffff,0xff00
 
 /* Parameters affecting memory use. A high IP_Buffer_Extras increases performance but significantly impacts memory use.
  */
 #define IP_Buffer_WordCount  64   ///< Buffer size in (2-byte) words; one included per channel - affects TCP/IP data size.
 #define IP_Buffer_Extras      2   ///< The number of extra buffers (1 minimum) to include to increase flexibility and responsiveness.
-#define IP_Connection_FIFO   32   ///< Size of FIFO in bytes; there are two FIFO per connection.
+#define IP_Connection_FIFO   32   ///< Default size of FIFO in bytes (a power of two); there are two FIFO per connection.
+
+/* Number of spare buffers reserved for each consumer class (see IP_BufferClass); these can be adjusted, along with
+ * maximum quotas, at run-time with IP_Manager::set_buffer_quota(). The total should be less than IP_Buffer_Extras.
+ */
+#define IP_Reserve_Receive    1   ///< Spares reserved for receiving, so that channels can make progress under heavy local transmit load.
+#define IP_Reserve_Forward    0   ///< Spares reserved for forwarding received packets.
+#define IP_Reserve_Transmit   0   ///< Spares reserved for data sent by local connections.
+#define IP_Reserve_Control    0   ///< Spares reserved for pings and TCP handshakes and acknowledgements.
+
+/* Scheduling of IP_Manager::tick(); both can be adjusted at run-time with IP_Manager::set_pending_budget().
+ */
+#define IP_Pending_Batch      4   ///< Maximum number of pending buffers handled per pass of the pending queue.
+#define IP_Pending_Budget     2   ///< Maximum time (in milliseconds) to spend per pass of the pending queue; 0 for no limit.
+
+/* Active queue management of the pending queue and each channel's output queue (see IP_Queue); these can be adjusted
+ * at run-time for each queue. At 115200 baud, a full 128-byte buffer takes about 11 ms to send.
+ */
+#define IP_Queue_Target      50   ///< Acceptable standing queue delay in milliseconds; 0 disables dropping.
+#define IP_Queue_Interval   500   ///< Time in milliseconds the delay must stay above target before dropping starts.
+#define IP_Queue_Limit        0   ///< Maximum number of buffers in a queue; 0 for no limit.
+
+/* Reassembly of fragmented (IPv4) datagrams (see IP_Reassembly); the fragments are held in buffers from the pool
+ * of spares, but only in those not reserved for a consumer class, so longer datagrams need a larger IP_Buffer_Extras
+ * (or see IP_Manager::buffers_add()) - with the defaults, no datagram can be reassembled, and fragments are refused
+ * at once. The length and timeout can be adjusted at run-time.
+ */
+#define IP_Reassembly_Slots      2   ///< Number of datagrams that can be reassembled at the same time.
+#define IP_Reassembly_Length  4096   ///< Maximum length (in bytes) of a reassembled datagram's payload.
+#define IP_Reassembly_Timeout 3000   ///< Time (in milliseconds) allowed for all the fragments of a datagram to arrive.
+
+/* TCP data transfer (see IP_Connection); each unacknowledged data segment holds a buffer from the pool of spares.
+ */
+#define IP_TCP_Window_Segments 4   ///< Maximum number of unacknowledged data segments in flight per connection.
+
+/* TCP retransmission (see IP_Connection); the timeout adapts to the measured round-trip time, within these limits,
+ * and doubles with each retransmission of the same segment.
+ */
+#define IP_TCP_RTO_Initial  1000   ///< Retransmission timeout (in milliseconds) before the round-trip time has been measured.
+#define IP_TCP_RTO_Min       100   ///< Minimum retransmission timeout (in milliseconds).
+#define IP_TCP_RTO_Max     16000   ///< Maximum retransmission timeout (in milliseconds), including backoff.
+#define IP_TCP_Retries         8   ///< Number of retransmissions of a segment (or SYN / SYN-ACK) before the connection is aborted.
+#define IP_TCP_Probe_Min     500   ///< Minimum time (in milliseconds) the remote's window stays closed before it's probed.
+
+/* TCP fast retransmit & fast recovery (NewReno, RFC 6582); duplicate acknowledgements signal a lost segment well
+ * before the retransmission timer would.
+ */
+#define IP_TCP_Dup_ACKs        3   ///< Number of duplicate acknowledgements that trigger a fast retransmit.
+
+/* TCP receive: out-of-order segments are held (in buffers from the pool of spares) until the gap is filled, and
+ * reported to the remote with selective acknowledgements so that only the gaps are resent.
+ */
+#define IP_TCP_OOO_Segments    2   ///< Maximum number of out-of-order segments held per connection; 0 to discard them.
+#define IP_TCP_SACK            1   ///< Use selective acknowledgements (RFC 2018) if the remote agrees.
+
+/* UDP receive: datagrams that arrive while the application is still reading earlier ones are queued (see
+ * IP_Connection::set_receive_queue()); each holds a buffer (or, if reassembled, several) from the pool of spares.
+ */
+#define IP_UDP_Queue           2   ///< Default maximum number of received datagrams queued per UDP connection; more are dropped.
+
+/* Coalescing of small writes into fewer, larger packets (see IP_Connection::cork() and IP_Connection::flush()).
+ */
+#define IP_TCP_Nagle           1   ///< Default for TCP: hold back partial segments while data is unacknowledged (Nagle's algorithm).
+#define IP_UDP_Coalesce       10   ///< Time (in milliseconds) a partly filled UDP datagram waits for more data; 0 to send on the next update().
+
+/* TCP delayed acknowledgements; an ACK waits for a second segment, or for outgoing data to carry it, but no longer
+ * than the delay.
+ */
+#define IP_TCP_Ack_Segments    2   ///< Number of in-sequence segments received before an ACK is sent immediately.
+#define IP_TCP_Ack_Delay      50   ///< Maximum time (in milliseconds) an ACK is delayed.
+
+/* TCP connection teardown; the side that closes first lingers in TIME_WAIT, in case its last ACK is lost and the
+ * remote resends its FIN, but this is tracked in a small table (see IP_TimeWait) so that the connection itself can
+ * be reused straight away.
+ */
+#define IP_TCP_TimeWait_Slots  4   ///< Number of closed connections tracked in TIME_WAIT; when full, the oldest is dropped.
+#define IP_TCP_TimeWait    32000   ///< Time (in milliseconds) spent in TIME_WAIT; long enough to see a FIN resent after the maximum backoff.
+#define IP_TCP_FinWait     10000   ///< Time (in milliseconds) to wait for the remote's FIN after ours has been acknowledged.
+
+/* TCP servers with many clients (see IP_Listener); each connection request on the listener's port is taken on by an
+ * idle connection from a pool provided by the application, as long as not too many handshakes are still in progress.
+ */
+#define IP_TCP_Listener_Pool   8   ///< Maximum number of connections in a listener's pool.
+#define IP_TCP_Backlog         4   ///< Default maximum number of half-open connections (handshakes in progress) per listener.
+
+/* TCP congestion control (see IP_Congestion); the delay-based algorithm adjusts the window to keep between Alpha
+ * and Beta segments queued along the path.
+ */
+#define IP_TCP_CWnd_Initial    2   ///< Initial congestion window, in segments.
+#define IP_TCP_Delay_Alpha     1   ///< Delay-based: grow the window if fewer than this many segments are queued.
+#define IP_TCP_Delay_Beta      3   ///< Delay-based: shrink the window if more than this many segments are queued.
+
+/* Threaded channels (Unix only; see IP_ThreadedChannel).
+ */
+#define IP_Thread_Ring        8   ///< Capacity of each ring between a channel's I/O thread and the manager; must be a power of two.
+#define IP_Thread_Retry     500   ///< Time (in milliseconds) before a channel's I/O thread tries a device that has hung up again.
+
+/* Gateway bridge to external networks (Unix only; see IP_GatewayBridge).
+ */
+#define IP_Gateway_Flows     16   ///< Maximum number of UDP flows (i.e., source address & port pairs) mapped to host sockets.
+#define IP_Gateway_Idle      60   ///< Time in seconds after which an idle flow is closed; can be adjusted at run-time.
 
 /* Other network parameters.
  */
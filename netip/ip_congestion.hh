@@ -0,0 +1,195 @@
+/* Copyright (c) 2018 Francis James Franklin
+ * 
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided
+ * that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and
+ *    the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ *    the following disclaimer in the documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*! \file ip_congestion.hh
+    \brief Congestion control for TCP connections.
+    
+    IP_Congestion is the interface between IP_Connection and a congestion control algorithm: the connection
+    reports acknowledgements, round-trip time measurements and losses, and limits the data in flight to the
+    congestion window. Two algorithms are provided: IP_Congestion_Reno (slow start, congestion avoidance and
+    multiplicative decrease on loss, as in RFC 5681) and IP_Congestion_Delay, which (as in TCP Vegas) also
+    watches the round-trip time and backs off as soon as packets start to queue along the path - on slow serial
+    links with small buffer pools, the queueing delay rises long before anything is lost.
+*/
+
+#ifndef __ip_congestion_hh__
+#define __ip_congestion_hh__
+
+#include "ip_types.hh"
+
+/** Interface for congestion control algorithms; one instance per connection. The base class provides the state
+ * common to all algorithms, and the standard response to loss.
+ */
+class IP_Congestion {
+protected:
+  u16_t cc_mss;      ///< Maximum segment size (in bytes).
+  u16_t cc_cwnd;     ///< Congestion window (in bytes).
+  u16_t cc_ssthresh; ///< Slow start threshold (in bytes).
+
+  /** Grow the window by the given number of bytes, without overflowing.
+   */
+  inline void grow (u16_t bytes) {
+    cc_cwnd = (cc_cwnd > 0xFFFF - bytes) ? 0xFFFF : (cc_cwnd + bytes);
+  }
+
+  /** Returns true if the window was (nearly) full, i.e., if the window rather than the application or the
+   * receiver is limiting the data in flight; the window shouldn't grow otherwise.
+   */
+  inline bool limited (u16_t in_flight) const {
+    return ((u32_t) in_flight + cc_mss > cc_cwnd);
+  }
+
+public:
+  IP_Congestion () :
+    cc_mss(1),
+    cc_cwnd(1),
+    cc_ssthresh(0xFFFF)
+  {
+    // ...
+  }
+
+  virtual ~IP_Congestion () {
+    // ...
+  }
+
+  /** Start again, for a new connection.
+   * \param mss The maximum segment size (in bytes).
+   */
+  virtual void reset (u16_t mss);
+
+  /** New data has been acknowledged.
+   * \param bytes     The number of bytes newly acknowledged.
+   * \param in_flight The number of bytes in flight before the acknowledgement.
+   */
+  virtual void acked (u16_t bytes, u16_t in_flight) = 0;
+
+  /** A round-trip time measurement; only segments sent once are timed (Karn's rule). Called before acked().
+   * \param rtt       The round-trip time (in milliseconds).
+   * \param in_flight The number of bytes in flight before the acknowledgement.
+   */
+  virtual void rtt_sample (u16_t rtt, u16_t in_flight) {
+    (void) rtt;
+    (void) in_flight;
+  }
+
+  /** Data has been lost.
+   * \param in_flight The number of bytes in flight.
+   * \param bTimeout  True if detected by the retransmission timer, in which case the window drops to one segment.
+   */
+  virtual void loss (u16_t in_flight, bool bTimeout);
+
+  /** During fast recovery, each duplicate acknowledgement means a segment has left the network; the window is
+   * inflated to let new data take its place.
+   * \param segments The number of segments that have left the network.
+   */
+  inline void inflate (u8_t segments) {
+    while (segments--) {
+      grow (cc_mss);
+    }
+  }
+
+  /** A partial acknowledgement during fast recovery; the window is deflated by the amount acknowledged, less
+   * the segment about to be resent.
+   * \param bytes The number of bytes newly acknowledged.
+   */
+  void deflate (u16_t bytes);
+
+  /** Fast recovery is complete, i.e., everything in flight when the loss was detected has been acknowledged;
+   * the window returns to the slow start threshold.
+   */
+  virtual void recovered ();
+
+  /** The congestion window (in bytes), i.e., the maximum number of bytes in flight.
+   */
+  inline u16_t window () const {
+    return cc_cwnd;
+  }
+
+  /** The slow start threshold (in bytes).
+   */
+  inline u16_t threshold () const {
+    return cc_ssthresh;
+  }
+
+  /** Returns true while in slow start.
+   */
+  inline bool slow_start () const {
+    return (cc_cwnd < cc_ssthresh);
+  }
+};
+
+/** Standard (Reno) congestion control: exponential growth in slow start, then about one segment per round trip.
+ */
+class IP_Congestion_Reno : public IP_Congestion {
+private:
+  u16_t bytes_acked; ///< Bytes acknowledged in congestion avoidance since the window last grew.
+
+public:
+  IP_Congestion_Reno () :
+    bytes_acked(0)
+  {
+    // ...
+  }
+
+  virtual ~IP_Congestion_Reno () {
+    // ...
+  }
+
+  virtual void reset (u16_t mss);
+  virtual void acked (u16_t bytes, u16_t in_flight);
+  virtual void loss (u16_t in_flight, bool bTimeout);
+};
+
+/** Delay-based (Vegas-like) congestion control. The shortest round-trip time seen is taken as the base, with
+ * no queueing; each measurement gives an estimate of the data queued along the path, cwnd * (rtt - base) / rtt,
+ * and once per measurement (i.e., roughly once per round trip) the window grows by a segment if fewer than
+ * IP_TCP_Delay_Alpha segments are queued, or shrinks by one if more than IP_TCP_Delay_Beta are. Slow start ends
+ * as soon as a segment's worth is queued. Losses are handled as for Reno.
+ */
+class IP_Congestion_Delay : public IP_Congestion {
+private:
+  u16_t rtt_base; ///< Shortest round-trip time seen (in milliseconds).
+
+public:
+  IP_Congestion_Delay () :
+    rtt_base(0xFFFF)
+  {
+    // ...
+  }
+
+  virtual ~IP_Congestion_Delay () {
+    // ...
+  }
+
+  virtual void reset (u16_t mss);
+  virtual void acked (u16_t bytes, u16_t in_flight);
+  virtual void rtt_sample (u16_t rtt, u16_t in_flight);
+
+  /** The shortest round-trip time seen (in milliseconds); 0xFFFF until the first measurement.
+   */
+  inline u16_t base_rtt () const {
+    return rtt_base;
+  }
+};
+
+#endif /* ! __ip_congestion_hh__ */
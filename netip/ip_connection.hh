@@ -25,9 +25,15 @@
 #define __ip_connection_hh__
 
 #include "ip_buffer.hh"
+#include "ip_congestion.hh"
 #include "ip_timer.hh"
 
+#if IP_Connection_FIFO & (IP_Connection_FIFO - 1)
+#error "NetIP: IP_Connection_FIFO must be a power of two"
+#endif
+
 class IP_Channel;
+class IP_Manager;
 
 class IP_Connection : public Link, public IP_TimerClient {
 public:
@@ -40,6 +46,7 @@ public:
      * 
      * if buffer_received() returns false, the buffer will be processed as normal;
      * if it returns true, the buffer will be treated as if already processed.
+     * (UDP datagrams reassembled from fragments span several buffers, and are always processed as normal.)
      */
     virtual bool buffer_received (const IP_Connection & connection, const IP_Buffer & buffer) = 0;
 
@@ -58,6 +65,13 @@ public:
 
     virtual void connection_has_closed (const IP_Connection & connection) = 0;
 
+    /* notification that the remote has closed its side of a TCP connection; any data waiting can still be read,
+     * and more can be written, but nothing more will arrive - close() when finished
+     */
+    virtual void connection_has_finished (const IP_Connection & connection) {
+      (void) connection;
+    }
+
     virtual ~EventListener () {
       // ...
     }
@@ -72,6 +86,10 @@ private:
   u16_t data_in_offset;
   u16_t data_in_length;
 
+  Chain<IP_Buffer> chain_datagrams; // UDP: received datagrams waiting to be read, oldest first
+  u8_t datagram_count;
+  u8_t datagram_limit;
+
   u8_t fifo_read_buffer[IP_Connection_FIFO];
   FIFO fifo_read;
 
@@ -80,56 +98,76 @@ private:
 
   EventListener * EL;
 
+  IP_Manager * owner;
+
+  IP_Connection * ready_link; // the next connection in the manager's ready queue
+  bool            bReady;     // whether in the manager's ready queue
+
   bool bSendRequested;
 
-#if 0
-  /* IP header - we support one or the other, not both
+  /* TCP state; sequence numbers are modulo 2^32 - see tcp_seq_add() etc.
    */
-#if IP_USE_IPv6
-    struct IP_Header_IPv6 ip;
-#else
-    struct IP_Header_IPv4 ip;
-#endif
+  struct {
+    u32_t snd_una;   // oldest unacknowledged sequence number
+    u32_t snd_nxt;   // next sequence number to send
+    u32_t rcv_nxt;   // next sequence number expected from the remote
 
-  /* Protocol-specific fields
-   */
-  union {
-    struct IP_Header_TCP  tcp;
-    struct IP_Header_UDP  udp;
-    struct IP_Header_ICMP icmp;
-  } proto;
+    u16_t snd_wnd;   // window advertised by the remote, relative to snd_una
+    u16_t rcv_wnd;   // window we last advertised, relative to rcv_nxt
 
-  struct {
-    ns32_t rcv_nxt;     /**< The sequence number that we expect to receive next. */
-    ns32_t snd_nxt;     /**< The sequence number that was last sent by us. */
-
-    u16_t length;       /**< Length of the data that was previously sent. */
-    u16_t mss;          /**< Current maximum segment size for the connection. */
-    u16_t mss_initial;  /**< Initial maximum segment size for the connection. */
-
-    u8_t sa;            /**< Retransmission time-out calculation state variable. */
-    u8_t sv;            /**< Retransmission time-out calculation state variable. */
-    u8_t rto;           /**< Retransmission time-out. */
-    u8_t tcpstateflags; /**< TCP state and flags. */
-    u8_t timer;         /**< The retransmission timer. */
-    u8_t nrtx;          /**< The number of retransmissions for the last segment sent. */
-  } tcp;
-#endif
-  struct {
-    u32_t seq_no;
-    u32_t ack_no;
+    u32_t send_time; // when the segment being timed was sent
+    u32_t rtt_seq;   // sequence number being timed; the measurement completes when the remote acknowledges it
 
-    u32_t send_time;
+    u32_t srtt;      // smoothed round-trip time, in units of 1/8 ms; 0 until the first measurement
+    u32_t rttvar;    // round-trip time variation, in units of 1/4 ms
+    u16_t rto;       // current retransmission timeout (in milliseconds), including any backoff
+    u16_t mss;       // maximum segment size, i.e., the data a buffer can hold
+
+    u32_t ack_time;  // when the oldest segment not yet acknowledged arrived
+    u8_t  ack_count; // number of segments received but not yet acknowledged
+
+    u32_t recover;   // highest sequence number sent when fast recovery (or the last timeout) began
+    u8_t  dupacks;   // number of duplicate acknowledgements in a row
 
     u8_t attempts;
   } tcp;
 
+  struct {
+    u32_t samples;     // number of round-trip time measurements
+    u32_t retransmits; // number of retransmission timeouts
+    u32_t fast;        // number of fast retransmits, i.e., entries into fast recovery
+    u32_t partial;     // number of segments resent on partial acknowledgements during fast recovery
+    u32_t probes;      // number of zero-window probes
+    u16_t rtt_min;     // shortest round-trip time measured (in milliseconds)
+    u16_t rtt_max;     // longest round-trip time measured (in milliseconds)
+  } tcp_stats;
+
+  struct {
+    u32_t received;    // number of datagrams accepted
+    u32_t dropped;     // number of datagrams dropped because the receive queue was full
+  } udp_stats;
+
+  IP_Buffer * tcp_unacked[IP_TCP_Window_Segments]; // data segments sent but not yet acknowledged, oldest first; retained
+  bool tcp_sacked[IP_TCP_Window_Segments];         // whether the remote has selectively acknowledged the corresponding segment
+  u8_t tcp_unacked_count;
+  u8_t tcp_rtx_next;  // after a timeout or during fast recovery, the next of tcp_unacked to resend...
+  u8_t tcp_rtx_end;   // ... up to (but not including) this one
+
+  IP_Buffer * tcp_ooo[IP_TCP_OOO_Segments ? IP_TCP_OOO_Segments : 1]; // out-of-order segments received, in sequence order; retained
+  u8_t tcp_ooo_count;
+  u8_t tcp_ooo_last;  // the one received most recently
+
+  IP_Congestion_Reno cc_default; // default congestion control
+  IP_Congestion *    CC;         // congestion control in use
+
   IP_Address remote;
 
   ns16_t port_local;    // port 0 is reserved; can't send to or receive at; it can be used as a do-not-reply
   ns16_t port_remote;
 
-  u16_t flags; // internal flags
+  u32_t write_time; // when the data waiting in fifo_write was first written (UDP)
+
+  u32_t flags; // internal flags
 
   inline void tcp_reset_flags () {
     flags &= ~IP_TCP_Mask;
@@ -205,6 +243,76 @@ private:
       flags &= ~IP_Connection_RemoteSpecified;
     }      
   }
+  inline void tcp_timing (bool bState) {
+    if (bState) {
+      flags |=  IP_TCP_Timing;
+    } else {
+      flags &= ~IP_TCP_Timing;
+    }      
+  }
+  inline void flush_requested (bool bState) {
+    if (bState) {
+      flags |=  IP_Connection_Flush;
+    } else {
+      flags &= ~IP_Connection_Flush;
+    }      
+  }
+  inline void tcp_send_fin (bool bState) {
+    if (bState) {
+      flags |=  IP_TCP_SendFin;
+    } else {
+      flags &= ~IP_TCP_SendFin;
+    }      
+  }
+  inline void tcp_fin_sent (bool bState) {
+    if (bState) {
+      flags |=  IP_TCP_FinSent;
+    } else {
+      flags &= ~IP_TCP_FinSent;
+    }      
+  }
+  inline void tcp_fin_acked (bool bState) {
+    if (bState) {
+      flags |=  IP_TCP_FinAcked;
+    } else {
+      flags &= ~IP_TCP_FinAcked;
+    }      
+  }
+  inline void tcp_fin_received (bool bState) {
+    if (bState) {
+      flags |=  IP_TCP_FinReceived;
+    } else {
+      flags &= ~IP_TCP_FinReceived;
+    }      
+  }
+  inline void tcp_active_close (bool bState) {
+    if (bState) {
+      flags |=  IP_TCP_ActiveClose;
+    } else {
+      flags &= ~IP_TCP_ActiveClose;
+    }      
+  }
+  inline void tcp_send_probe (bool bState) {
+    if (bState) {
+      flags |=  IP_TCP_SendProbe;
+    } else {
+      flags &= ~IP_TCP_SendProbe;
+    }      
+  }
+  inline void tcp_recovery (bool bState) {
+    if (bState) {
+      flags |=  IP_TCP_Recovery;
+    } else {
+      flags &= ~IP_TCP_Recovery;
+    }      
+  }
+  inline void tcp_sack_permitted (bool bState) {
+    if (bState) {
+      flags |=  IP_TCP_SackPermitted;
+    } else {
+      flags &= ~IP_TCP_SackPermitted;
+    }      
+  }
   inline void timeout_set (bool bState) {
     if (bState) {
       flags |=  IP_Connection_TimeoutSet;
@@ -212,6 +320,16 @@ private:
       flags &= ~IP_Connection_TimeoutSet;
     }      
   }
+  inline void data_arrived (bool bState) {
+    if (bState) {
+      flags |=  IP_Connection_DataArrived;
+    } else {
+      flags &= ~IP_Connection_DataArrived;
+    }
+  }
+  inline bool data_arrived () const {
+    return (flags & IP_Connection_DataArrived);
+  }
 public:
   inline bool tcp_server () const {
     return (flags & IP_TCP_Server);
@@ -231,6 +349,36 @@ public:
   inline bool tcp_syn_ack_sent () const {
     return (flags & IP_TCP_SynAckSent);
   }
+  inline bool tcp_timing () const {
+    return (flags & IP_TCP_Timing);
+  }
+  inline bool tcp_send_fin () const {
+    return (flags & IP_TCP_SendFin);
+  }
+  inline bool tcp_fin_sent () const {
+    return (flags & IP_TCP_FinSent);
+  }
+  inline bool tcp_fin_acked () const {
+    return (flags & IP_TCP_FinAcked);
+  }
+  inline bool tcp_fin_received () const {
+    return (flags & IP_TCP_FinReceived);
+  }
+  inline bool tcp_active_close () const {
+    return (flags & IP_TCP_ActiveClose);
+  }
+  inline bool tcp_closing () const {   // closed by the application, but not yet by TCP
+    return (flags & (IP_TCP_SendFin | IP_TCP_FinSent));
+  }
+  inline bool tcp_send_probe () const {
+    return (flags & IP_TCP_SendProbe);
+  }
+  inline bool tcp_recovery () const {
+    return (flags & IP_TCP_Recovery);
+  }
+  inline bool tcp_sack_permitted () const {
+    return (flags & IP_TCP_SackPermitted);
+  }
   inline bool is_open () const {
     return (flags & IP_Connection_Open);
   }
@@ -246,15 +394,183 @@ public:
   inline bool timeout_set () const {
     return (flags & IP_Connection_TimeoutSet);
   }
+  inline bool is_corked () const {
+    return (flags & IP_Connection_Corked);
+  }
+  inline bool flush_requested () const {
+    return (flags & IP_Connection_Flush);
+  }
+  inline bool nagle () const {
+    return !(flags & IP_Connection_NoDelay);
+  }
+  inline bool remote_closed () const { // TCP: the remote has closed its side; see EventListener::connection_has_finished()
+    return (flags & IP_TCP_FinReceived);
+  }
+  inline bool is_idle () const {       // neither open nor busy, nor listening as a server
+    return !(flags & (IP_Connection_Open | IP_Connection_Busy | IP_TCP_Server));
+  }
+  inline bool tcp_half_open () const { // TCP: responding to a connection request, but not yet open
+    return (flags & (IP_TCP_SendSynAck | IP_TCP_SynAckSent));
+  }
 
   u16_t read (u8_t * ptr, u16_t length);
 
   u16_t write (const u8_t * ptr, u16_t length);
 
+  /* FIFO capacity: by default, each connection has two FIFO of IP_Connection_FIFO bytes each, but larger (or smaller)
+   * buffers can be supplied instead - see also IP_Connection_Sized. Only the largest power of two (up to 32768) that
+   * fits in each buffer is used. Returns false, and changes nothing, unless the connection is idle.
+   */
+  bool set_fifo_buffers (u8_t * read_buffer, u16_t read_size, u8_t * write_buffer, u16_t write_size);
+
+  inline u16_t read_capacity () const {       // size of the receive FIFO, i.e., the largest window advertised
+    return fifo_read.capacity ();
+  }
+  inline u16_t write_capacity () const {      // size of the send FIFO
+    return fifo_write.capacity ();
+  }
+
+  /* TCP round-trip time statistics (in milliseconds)
+   */
+  inline u16_t rtt_smoothed () const {        // smoothed round-trip time; 0 until the first measurement
+    return (u16_t) (tcp.srtt >> 3);
+  }
+  inline u16_t rtt_variation () const {       // round-trip time variation
+    return (u16_t) (tcp.rttvar >> 2);
+  }
+  inline u16_t rtt_min () const {             // shortest round-trip time measured
+    return tcp_stats.rtt_min;
+  }
+  inline u16_t rtt_max () const {             // longest round-trip time measured
+    return tcp_stats.rtt_max;
+  }
+  inline u32_t rtt_samples () const {         // number of round-trip times measured
+    return tcp_stats.samples;
+  }
+  inline u16_t retransmit_timeout () const {  // current retransmission timeout, including any backoff
+    return tcp.rto;
+  }
+  inline u32_t retransmissions () const {     // number of retransmission timeouts
+    return tcp_stats.retransmits;
+  }
+  inline u32_t fast_retransmissions () const {  // number of fast retransmits, i.e., losses detected by duplicate ACKs
+    return tcp_stats.fast;
+  }
+  inline u32_t partial_retransmissions () const { // number of further losses repaired on partial ACKs during fast recovery
+    return tcp_stats.partial;
+  }
+  inline u32_t window_probes () const {      // number of probes sent while the remote's window was closed
+    return tcp_stats.probes;
+  }
+
+  /* UDP receive: datagrams that arrive before earlier ones have been read are queued, up to a limit (by default,
+   * IP_UDP_Queue); any more are dropped. Normally their data is streamed into the FIFO for read(), but in datagram
+   * mode each is kept whole for receive_from(), which also gives the source address & port.
+   */
+  inline void set_receive_queue (u8_t max_datagrams) {
+    datagram_limit = max_datagrams;
+  }
+  inline void set_datagram_mode (bool bDatagrams) {
+    if (bDatagrams) {
+      flags |=  IP_Connection_Datagrams;
+    } else {
+      flags &= ~IP_Connection_Datagrams;
+    }
+    if (datagram_count) { // to be notified of, or streamed
+      data_arrived (bDatagrams);
+      schedule ();
+    }
+  }
+  inline bool datagram_mode () const {
+    return (flags & IP_Connection_Datagrams);
+  }
+  inline u8_t datagrams_queued () const {
+    return datagram_count;
+  }
+  inline u32_t datagrams_received () const {  // number of datagrams accepted
+    return udp_stats.received;
+  }
+  inline u32_t datagrams_dropped () const {   // number of datagrams dropped because the queue was full
+    return udp_stats.dropped;
+  }
+
+  /* Datagram mode: the length of the next datagram's data, or 0 if none is waiting
+   */
+  u16_t datagram_length () const;
+
+  /* Datagram mode: take the next datagram, copying as much of its data as fits; the rest is discarded. Returns the
+   * number of bytes copied, or 0 (with source_port 0) if none is waiting.
+   */
+  u16_t receive_from (u8_t * ptr, u16_t length, IP_Address & source, u16_t & source_port);
+
   inline u16_t print (const char * str) {
     return write ((const u8_t *) str, strlen (str));
   }
 
+  /* Coalescing of small writes: while corked, output is only sent as full segments (TCP) or full datagrams (UDP);
+   * uncork() sends whatever is left. flush() sends everything buffered so far on the next update(), corked or not.
+   * For TCP, Nagle's algorithm (on by default; see IP_TCP_Nagle) holds back partial segments while earlier data
+   * is unacknowledged; for UDP, partial datagrams wait up to IP_UDP_Coalesce ms for more data.
+   */
+  inline void cork () {
+    flags |= IP_Connection_Corked;
+  }
+  inline void uncork () {
+    flags &= ~IP_Connection_Corked;
+    flush ();
+  }
+  inline void flush () {
+    if (!fifo_write.is_empty ()) {
+      flush_requested (true);
+      schedule ();
+    }
+  }
+  inline void set_nagle (bool bNagle) {
+    if (bNagle) {
+      flags &= ~IP_Connection_NoDelay;
+    } else {
+      flags |=  IP_Connection_NoDelay;
+    }
+  }
+
+  /* Send a UDP datagram in one go, bypassing the FIFO; datagrams too long for a single buffer are sent as
+   * (IPv4) fragments. Returns false if the connection isn't open, or if there aren't enough spare buffers.
+   */
+  bool send_datagram (const u8_t * data, u16_t length);
+
+  /* UDP: send a datagram to any address & port, regardless of the connection's remote (if any), which is unchanged.
+   * An unconnected endpoint is a UDP connection opened with just a local port; in datagram mode, receive_from()
+   * gives the source of each reply. Returns false if the connection isn't open, or if there aren't enough spare buffers.
+   */
+  bool send_to (const IP_Address & destination, u16_t port, const u8_t * data, u16_t length);
+
+  /* UDP: send many datagrams in one call, e.g., commands fanned out to many nodes. The headers are laid out once and
+   * copied; send_to_each(), which sends the same data to every destination, also calculates the data's checksum just
+   * once. Both return the number of datagrams dealt with (any addressed to port 0 are skipped), stopping early if the
+   * spare buffers run out, so that the rest can be sent later (e.g., on the next update()).
+   */
+  struct Datagram {
+    const IP_Address * destination;
+    u16_t              port;
+    const u8_t *       data;
+    u16_t              length;
+  };
+  u16_t send_batch (const Datagram * datagrams, u16_t count);
+  u16_t send_to_each (const IP_Address * destinations, u16_t count, u16_t port, const u8_t * data, u16_t length);
+
+  /* Zero-copy output, bypassing the FIFO: borrow() returns a buffer with the headers laid out, and capacity is set to
+   * the number of bytes of payload it may carry; append the payload (or write it at IP_Buffer::tail() and extend()),
+   * then commit() to send it as a single datagram (UDP) or segment (TCP), or give_back() to abandon it. For TCP, the
+   * buffer is retained until acknowledged. Returns 0 if nothing can be sent at the moment, e.g., if there is no spare
+   * buffer or, for TCP, if the window is full or earlier output is still waiting in the FIFO. commit() returns false
+   * (and the buffer remains borrowed) if the connection has closed, or if the payload no longer fits.
+   */
+  IP_Buffer * borrow (u16_t & capacity);
+
+  bool commit (IP_Buffer * buffer);
+
+  void give_back (IP_Buffer * buffer);
+
   /* Note: reset() closes the connection and doesn't open the new one.
    */
   void reset (IP_Protocol p = p_TCP, u16_t port = 0);
@@ -265,12 +581,28 @@ public:
     timer(this),
     buffer_in(0),
     buffer_tcp(0),
+    datagram_count(0),
+    datagram_limit(IP_UDP_Queue),
     fifo_read(fifo_read_buffer, IP_Connection_FIFO),
     fifo_write(fifo_write_buffer, IP_Connection_FIFO),
     EL(0),
-    bSendRequested(false)
+    owner(0),
+    ready_link(0),
+    bReady(false),
+    bSendRequested(false),
+    tcp_unacked_count(0),
+    tcp_rtx_next(0),
+    tcp_rtx_end(0),
+    tcp_ooo_count(0),
+    tcp_ooo_last(0),
+    CC(&cc_default),
+    write_time(0)
   {
     reset (p, port);
+    tcp_rtt_reset ();
+
+    udp_stats.received = 0;
+    udp_stats.dropped  = 0;
   }
 
   virtual ~IP_Connection () {
@@ -281,19 +613,65 @@ public:
     EL = listener;
   }
 
+  /* Congestion control algorithm for TCP, e.g., an IP_Congestion_Delay; 0 restores the default (IP_Congestion_Reno).
+   * Each connection needs its own instance, and it should be set before connecting.
+   */
+  inline void set_congestion_control (IP_Congestion * cc) {
+    CC = cc ? cc : &cc_default;
+  }
+
+  inline const IP_Congestion & congestion () const {
+    return *CC;
+  }
+
+  /* Bind the connection to its IP_Manager; see IP_Manager::connection_add()
+   */
+  inline void bind (IP_Manager * manager) {
+    owner = manager;
+  }
+
+  /* The IP_Manager the connection belongs to; if unbound, the default IP_Manager::manager()
+   */
+  IP_Manager & manager () const;
+
   inline void request_to_send () { // get a buffer ready for output, then notify
     if (is_open () && has_remote ()) {
       bSendRequested = true;
+      schedule ();
     }
   }
 
-  void update (); // internal management of connection & buffers - call frequently!
+  /* The manager only calls update() for connections in its ready queue (see IP_Manager::connection_ready()); a
+   * connection joins it whenever it has something new to do - a segment or datagram has arrived, the timer has
+   * expired, or the application has read, written, flushed, opened or closed - and stays in it for as long as
+   * update() can't finish, e.g., while a delayed ACK is due, or while waiting for a spare buffer. The event
+   * listener's connection_has_data() is called once for each arrival of new data, so it should read all it can.
+   */
+  void schedule (); // queue for update(), if added to a manager
+
+  inline bool scheduled () const {
+    return bReady;
+  }
+
+  /* The ready queue's link; for IP_Manager only
+   */
+  inline IP_Connection * ready_next () const {
+    return ready_link;
+  }
+  inline void ready_next (IP_Connection * connection, bool bQueued) {
+    ready_link = connection;
+    bReady = bQueued;
+  }
+
+  void update (); // internal management of connection & buffers - called by the manager when scheduled
 
   /* Note: Open connection - UDP only; use connect for TCP
    */
   bool open ();
 
-  /* Note: Close connection
+  /* Note: Close connection; for TCP, once the buffered output has been sent, a FIN is sent, and the connection
+   *       closes (see EventListener::connection_has_closed()) once the remote has closed its side too. A server
+   *       connection then goes back to listening; closing it while it's listening stops it.
    */
   void close ();
 
@@ -307,21 +685,133 @@ public:
 
 private:
   void tcp_prepare (IP_Buffer * buffer);
+  void tcp_stamp (IP_Buffer * buffer);
   bool tcp_ack ();
 
+  u16_t tcp_window () const;                               // receive window, i.e., space in fifo_read
+  u16_t tcp_send_space () const;                           // bytes we may send now, within the remote's window
+  bool  tcp_send_partial () const;                         // whether a partly filled segment may be sent now
+  bool  tcp_send_segment (const u8_t * ptr, u16_t & length, bool bPartial); // send new data from fifo_write, then ptr
+  u16_t tcp_send_limit () const;                           // the most data a new segment may carry now
+  void  tcp_send_new (IP_Buffer * buffer, u16_t count);    // send a new segment, retaining it for retransmission
+  void  tcp_probe ();                                      // push a byte through the remote's closed window
+  void  tcp_acknowledged (u32_t ack_no, u16_t window, u16_t length); // cumulative ACK from the remote; length of data carried
+  void  tcp_duplicate_ack (u16_t in_flight);               // count duplicate ACKs; fast retransmit after IP_TCP_Dup_ACKs
+  u8_t  tcp_holes () const;                                // the number of tcp_unacked to resend in fast recovery
+  void  tcp_receive (IP_Buffer * buffer);                  // data from the remote
+  u16_t tcp_deliver (IP_Buffer * buffer, u16_t offset);    // pass received data on to fifo_read (or discard it, if closed)
+  void  tcp_fin_arrived ();                                // the remote has closed its side
+  void  tcp_close_check ();                                // finish closing, once both FINs have been acknowledged
+  void  tcp_closed (bool bServer);                         // make the connection ready for reuse; a server listens again
+  void  tcp_update ();                                     // send, resend & acknowledge, while open or closing
+  u32_t tcp_seq_end (const IP_Buffer * segment) const;     // sequence number just after a segment, including any FIN
+  void  tcp_retransmit ();
+  void  tcp_unacked_clear ();
+
+  void  tcp_syn_options (IP_Buffer * buffer);              // request selective acknowledgements, if wanted & (for a SYN-ACK) permitted
+  void  tcp_sack_options (IP_Buffer * buffer);             // report the out-of-order segments held
+  void  tcp_sack_received (IP_Buffer * buffer);            // note the segments the remote has selectively acknowledged
+  void  tcp_ooo_insert (IP_Buffer * buffer);               // hold on to an out-of-order segment, if possible
+  void  tcp_ooo_drain ();                                  // pass on held segments that are now in sequence
+  void  tcp_ooo_clear ();
+
+  void  tcp_rtt_reset ();                                  // forget the round-trip time estimate & statistics; for a new connection
+  void  tcp_rtt_start (u32_t seq_no);                      // time the segment with this sequence number, unless already timing one
+  void  tcp_rtt_sample (u32_t ack_no);                     // complete the measurement if ack_no covers the segment being timed
+  bool  tcp_backoff ();                                    // double the timeout for a retransmission; false if it's time to give up
+  void  tcp_abort ();
+
   bool accept_tcp (IP_Buffer * buffer);
   bool accept_udp (IP_Buffer * buffer);
+
+  struct UDP_Template {       // headers laid out once, and copied, for a batch of datagrams
+    u8_t header[IP_Header_Length_IPv6 + IP_Header_Length_UDP];
+    u8_t length;              // 0 until laid out
+    u8_t family;
+  };
+
+  bool        udp_send (const IP_Address & destination, const ns16_t & port, const u8_t * data, u16_t length);
+  IP_Buffer * udp_batch_buffer (UDP_Template & T, const IP_Address & destination, u16_t port);
+
+  void data_in_push ();
+  void data_in_next ();
+  void data_in_clear ();
+
+  bool update_pending () const; // whether update() has more to do, without a further event to prompt it
 public:
   /* Note: Returns true if the connection can & will handle the incoming buffer
    */
   bool accept (IP_Buffer * buffer);
 
+  /* Note: Take on a TCP connection request passed on by an IP_Listener; the connection must be idle, and uses the
+   *       request's local port. Once closed, the connection is idle again, rather than listening.
+   */
+  bool accept_request (IP_Buffer * buffer);
+
   /* Note: Open connection to remote address/port
    */
   void connect (const IP_Address & remote_address, u16_t remote_port);
 
 protected:
   virtual bool timeout (); // return true if the timer should be reset & retained
+
+  /* The application's ends of the FIFO: the connection (on the manager's thread) writes fifo_read and reads
+   * fifo_write, so another thread can read the one and write the other (see FIFO) - see IP_ThreadedConnection.
+   */
+  inline FIFO & fifo_in () {
+    return fifo_read;
+  }
+  inline FIFO & fifo_out () {
+    return fifo_write;
+  }
+  inline const FIFO & fifo_in () const {
+    return fifo_read;
+  }
+  inline const FIFO & fifo_out () const {
+    return fifo_write;
+  }
+
+  /* Called at the end of every update(), on the manager's thread
+   */
+  virtual void io_update () {
+    // ...
+  }
+
+  /* Whether update() should be called on every pass regardless, e.g., because another thread uses the FIFO
+   */
+  virtual bool io_pending () const {
+    return false;
+  }
+
+  /* Called by close(), on the manager's thread, to discard data the application hasn't read; only fifo_read's
+   * consumer can do that, so another thread must drain its own end
+   */
+  virtual void io_discard () {
+    fifo_read.drain ();
+  }
+};
+
+/* A connection with its own FIFO sizes, e.g., large for bulk transfer; both sizes must be powers of two.
+ */
+template<u16_t ReadSize, u16_t WriteSize = ReadSize>
+class IP_Connection_Sized : public IP_Connection {
+private:
+  u8_t read_buffer[ReadSize];
+  u8_t write_buffer[WriteSize];
+
+  static_assert (ReadSize  && !(ReadSize  & (ReadSize  - 1)), "NetIP: FIFO size must be a power of two");
+  static_assert (WriteSize && !(WriteSize & (WriteSize - 1)), "NetIP: FIFO size must be a power of two");
+
+public:
+  IP_Connection_Sized (IP_Protocol p = p_TCP, u16_t port = 0) :
+    IP_Connection(p, port)
+  {
+    set_fifo_buffers (read_buffer, ReadSize, write_buffer, WriteSize);
+  }
+
+  virtual ~IP_Connection_Sized () {
+    // ...
+  }
 };
 
 #endif /* ! __ip_connection_hh__ */
@@ -34,7 +34,7 @@
 #include "ip_config.hh"
 
 #if IP_DEBUG
-#define DEBUG_PRINT(x) IP_Manager::manager().debug_print (x) ///< If IP_DEBUG is set, this routes internal debug statements to IP_Manager::debug_print().
+#define DEBUG_PRINT(x) IP_Manager::active().debug_print (x)  ///< If IP_DEBUG is set, this routes internal debug statements to IP_Manager::debug_print().
 #else
 #define DEBUG_PRINT(x) while (false)                         ///< If IP_DEBUG is set, this routes internal debug statements to IP_Manager::debug_print().
 #endif
@@ -46,16 +46,31 @@
 #define IP_Header_Length_UDP   8 ///< Length of the UDP header
 #define IP_Header_Length_TCP  20 ///< Length of the TCP header
 
-/* Different header types for IPv4 & IPv6
+/* Address families, identified by IP version; the default is IPv4 unless only IPv6 is supported
  */
-#if IP_USE_IPv6
-#define IP_Address_WordCount   8                     ///< Number of two-byte words in an IP address (8 for IPv6; 2 for IPv4)
-#define IP_Header_Length_IP    IP_Header_Length_IPv6 ///< Length of the IP header
+#define IP_Family_IPv4         4 ///< IPv4 address / header
+#define IP_Family_IPv6         6 ///< IPv6 address / header
+
+#if !IP_USE_IPv4 && !IP_USE_IPv6
+#error "NetIP: at least one of IP_USE_IPv4 and IP_USE_IPv6 must be set"
+#endif
+
+#if IP_USE_IPv4
+#define IP_Family_Default      IP_Family_IPv4        ///< The default address family, e.g., of the host address
+#define IP_Header_Length_IP    IP_Header_Length_IPv4 ///< Length of the IP header for the default address family
+#define IP_Address_DefaultHost    IP_Address_DefaultHost4
+#define IP_Address_DefaultGateway IP_Address_DefaultGateway4
+#define IP_Address_DefaultNetmask IP_Address_DefaultNetmask4
 #else
-#define IP_Address_WordCount   2                     ///< Number of two-byte words in an IP address (8 for IPv6; 2 for IPv4)
-#define IP_Header_Length_IP    IP_Header_Length_IPv4 ///< Length of the IP header
+#define IP_Family_Default      IP_Family_IPv6        ///< The default address family, e.g., of the host address
+#define IP_Header_Length_IP    IP_Header_Length_IPv6 ///< Length of the IP header for the default address family
+#define IP_Address_DefaultHost    IP_Address_DefaultHost6
+#define IP_Address_DefaultGateway IP_Address_DefaultGateway6
+#define IP_Address_DefaultNetmask IP_Address_DefaultNetmask6
 #endif
 
+#define IP_Prefix_None      0xFF ///< (IPv6) Prefix index of an address whose /64 prefix couldn't be added to the prefix table
+
 /* TCP (or UDP) is framed within IP...
  */
 #define IP_Header_UDP_IP       (IP_Header_Length_IP + IP_Header_Length_UDP) ///< Length of the IP + UDP headers (48 for IPv6; 28 for IPv4)
@@ -73,12 +88,27 @@
 #define IP_Connection_RemoteSpecified  0x1000 ///< A remote address and port have been specified.
 #define IP_Connection_TimeoutSet       0x0800 ///< The timer has been set and a timeout is expected.
 
-#define IP_TCP_Mask                    0x01FF ///< Bit mask of flags corresponding to the TCP connection state.
+#define IP_Connection_Corked       0x00010000 ///< Partial segments / datagrams are held back until uncorked or flushed.
+#define IP_Connection_Flush        0x00020000 ///< Asynchronous flag, requesting that buffered output be sent regardless.
+#define IP_Connection_NoDelay      0x00040000 ///< TCP: Nagle's algorithm is disabled.
+#define IP_Connection_Datagrams    0x00080000 ///< UDP: received datagrams are kept whole, for receive_from(), rather than streamed.
+#define IP_Connection_DataArrived  0x01000000 ///< New data has been received since the event listener was last notified.
+
+#define IP_TCP_Mask                0x00F007FF ///< Bit mask of flags corresponding to the TCP connection state.
+#define IP_TCP_SendProbe           0x00800000 ///< Asynchronous flag, requesting that the remote's closed window be probed.
+#define IP_TCP_ActiveClose         0x00400000 ///< Flag noting that we closed before the remote did, and so must enter TIME_WAIT.
+#define IP_TCP_FinReceived         0x00200000 ///< Flag noting that the remote's FIN has been received.
+#define IP_TCP_FinAcked            0x00100000 ///< Flag noting that our FIN has been acknowledged.
+#define IP_TCP_SendFin                 0x0400 ///< Asynchronous flag, requesting that a FIN be sent once all buffered output has been sent.
+#define IP_TCP_FinSent                 0x0200 ///< Flag noting that our FIN has been sent.
 #define IP_TCP_Server                  0x0100 ///< The connection is operating in server mode.
 #define IP_TCP_SendSyn                 0x0080 ///< Asynchronous flag, requesting that a SYN should be sent when possible.
 #define IP_TCP_SendSynAck              0x0040 ///< Asynchronous flag, requesting that a SYN-ACK should be sent when possible.
 #define IP_TCP_SendAck                 0x0020 ///< Asynchronous flag, requesting that an ACK should be sent when possible.
 #define IP_TCP_SynSent                 0x0010 ///< Flag noting that a SYN has been sent.
 #define IP_TCP_SynAckSent              0x0008 ///< Flag noting that a SYN-ACK has been sent.
+#define IP_TCP_Timing                  0x0004 ///< Flag noting that a round-trip time measurement is in progress.
+#define IP_TCP_SackPermitted           0x0002 ///< Flag noting that the remote has agreed to selective acknowledgements.
+#define IP_TCP_Recovery                0x0001 ///< Flag noting that fast recovery from a lost segment is in progress.
 
 #endif /* ! __ip_defines_hh__ */
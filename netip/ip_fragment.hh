@@ -0,0 +1,132 @@
+/* Copyright (c) 2018 Francis James Franklin
+ * 
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided
+ * that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and
+ *    the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ *    the following disclaimer in the documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*! \file ip_fragment.hh
+    \brief Reassembly of fragmented (IPv4) datagrams.
+    
+    A datagram larger than a single buffer can be sent as a series of fragments (see IP_Buffer::fragment_defaults()
+    and IP_Connection::send_datagram()). On receipt, IP_Reassembly collects the fragments into one of a fixed number
+    of slots; no memory is allocated, since the fragments stay in the buffers they arrived in, chained together in
+    order of offset through IP_Buffer::fragment_next(). Incomplete datagrams are discarded after a timeout, or as
+    soon as it's clear that there aren't enough buffers to complete them.
+*/
+
+#ifndef __ip_fragment_hh__
+#define __ip_fragment_hh__
+
+#include "ip_buffer.hh"
+
+/** Reassembles fragmented datagrams addressed to us. Overlapping fragments (other than exact duplicates) cause
+ * the whole datagram to be discarded, as is done for IPv6 (RFC 5722). Like IP_Queue, the reassembler doesn't
+ * have access to the pool of spares, so unwanted buffers are handed back to the caller to dispose of.
+ */
+class IP_Reassembly {
+private:
+  struct Slot {
+    IP_Buffer * first;    ///< The fragments received so far, in order of offset; 0 if the slot is unused.
+    u32_t       started;  ///< Time (in milliseconds) at which the first fragment arrived.
+    u16_t       received; ///< Number of payload bytes received so far.
+    u16_t       total;    ///< Total length of the datagram's payload; 0 until the last fragment arrives.
+    u8_t        buffers;  ///< Number of buffers (fragments) held.
+  };
+
+  Slot slots[IP_Reassembly_Slots];
+
+  u16_t length_max; ///< Maximum length of a reassembled datagram's payload.
+  u16_t timeout;    ///< Time (in milliseconds) allowed for all the fragments of a datagram to arrive.
+
+  u8_t buffers_max;  ///< Maximum number of buffers held by all the slots together.
+  u8_t buffers_held; ///< Number of buffers held by all the slots together.
+
+  u32_t stat_completed; ///< Number of datagrams reassembled.
+  u32_t stat_expired;   ///< Number of datagrams discarded because of the timeout.
+  u32_t stat_rejected;  ///< Number of datagrams discarded because of overlaps, or because they were too long.
+  u32_t stat_refused;   ///< Number of fragments discarded because there was no free slot, or too few buffers.
+
+  /** Find the slot for the fragment's datagram, if there is one.
+   */
+  Slot * slot_for (const IP_Buffer * fragment);
+
+  /** Empty the slot, returning its fragments (chained).
+   */
+  IP_Buffer * slot_clear (Slot & slot);
+
+public:
+  IP_Reassembly ();
+
+  ~IP_Reassembly () {
+    // ...
+  }
+
+  /** Set the maximum length of a reassembled datagram's payload, and the time allowed for its fragments to arrive.
+   */
+  inline void set_limits (u16_t max_length, u16_t milliseconds) {
+    length_max = max_length;
+    timeout    = milliseconds;
+  }
+
+  /** Set the maximum number of buffers all the incomplete datagrams together may hold; see IP_Manager, which
+   * limits this to the spares not reserved for any consumer class. A datagram needs at least two buffers, and is
+   * discarded at once, rather than after the timeout, if a fragment arrives when the limit has been reached.
+   */
+  inline void set_buffer_limit (u8_t buffers) {
+    buffers_max = buffers;
+  }
+
+  /** The maximum number of buffers all the incomplete datagrams together may hold.
+   */
+  inline u8_t buffer_limit () const {
+    return buffers_max;
+  }
+
+  /** Add a fragment addressed to us.
+   * \param fragment The fragment; see IP_Buffer::sniff() and IP_Buffer::hs_Fragment.
+   * \param now      The current time (in milliseconds).
+   * \param discard  Returns any buffers no longer needed (chained through IP_Buffer::fragment_next()), or 0.
+   * \return The first fragment of the complete datagram (with the rest chained through IP_Buffer::fragment_next()), or 0.
+   */
+  IP_Buffer * add (IP_Buffer * fragment, u32_t now, IP_Buffer *& discard);
+
+  /** Discard the next datagram that has timed out, if any.
+   * \param now The current time (in milliseconds).
+   * \return The fragments of the expired datagram (chained through IP_Buffer::fragment_next()), or 0 if none.
+   */
+  IP_Buffer * expire (u32_t now);
+
+  /** Statistics
+   */
+  inline u32_t completed () const {
+    return stat_completed;
+  }
+  inline u32_t expired () const {
+    return stat_expired;
+  }
+  inline u32_t rejected () const {
+    return stat_rejected;
+  }
+  inline u32_t refused () const {
+    return stat_refused;
+  }
+};
+
+#endif /* ! __ip_fragment_hh__ */
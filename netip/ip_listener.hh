@@ -0,0 +1,120 @@
+/* Copyright (c) 2018 Francis James Franklin
+ * 
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided
+ * that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and
+ *    the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ *    the following disclaimer in the documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*! \file ip_listener.hh
+    \brief A TCP server port that accepts many clients at once.
+
+    A server IP_Connection (see IP_Connection::open()) latches onto the first client to connect, and other clients
+    are ignored until that connection has closed. An IP_Listener instead hands each connection request on its port
+    to an idle connection from a pool that the application provides, so that there can be as many clients at once
+    as there are connections in the pool. The number of handshakes in progress is limited by the backlog; requests
+    beyond that, or when no connection is idle, are dropped, and the client will try again later.
+*/
+
+#ifndef __ip_listener_hh__
+#define __ip_listener_hh__
+
+#include "ip_connection.hh"
+
+/** Accepts TCP connection requests on a port, and assigns each to a connection from a pool.
+ */
+class IP_Listener : public Link {
+private:
+  IP_Connection * pool[IP_TCP_Listener_Pool];
+
+  IP_Manager * owner;
+
+  ns16_t port;      ///< The local port listened on.
+
+  u8_t pool_count;  ///< The number of connections in the pool.
+  u8_t backlog;     ///< The maximum number of half-open connections.
+
+  u32_t stat_accepted;  ///< Number of connection requests assigned to a connection from the pool.
+  u32_t stat_overflow;  ///< Number of connection requests dropped because the backlog was full.
+  u32_t stat_exhausted; ///< Number of connection requests dropped because no connection in the pool was idle.
+
+public:
+  /** A new listener; add connections to its pool, then add it to the manager (see IP_Manager::listener_add()).
+   * \param local_port  The local port to listen on.
+   * \param max_backlog The maximum number of handshakes in progress at any one time.
+   */
+  IP_Listener (u16_t local_port, u8_t max_backlog = IP_TCP_Backlog);
+
+  ~IP_Listener () {
+    // ...
+  }
+
+  /** Bind the listener to its IP_Manager; see IP_Manager::listener_add()
+   */
+  void bind (IP_Manager * manager);
+
+  /** The IP_Manager the listener belongs to; if unbound, the default IP_Manager::manager()
+   */
+  IP_Manager & manager () const;
+
+  /** Add a connection to the pool; it must not be in use, and must not be added to the manager separately. The
+   * connection's event listener is notified as usual when a client connects (connection_has_opened()), and again
+   * when the connection closes (connection_has_closed()), after which it's idle and can be used for another client.
+   * Returns false if the pool is full.
+   */
+  bool pool_add (IP_Connection * connection);
+
+  /** Set the maximum number of handshakes in progress at any one time.
+   */
+  inline void set_backlog (u8_t max_backlog) {
+    backlog = max_backlog;
+  }
+
+  /** The local port listened on.
+   */
+  inline const ns16_t & listening () const {
+    return port;
+  }
+
+  /** Offer a TCP segment that no connection has accepted; returns true if it was a connection request for this
+   * listener, and a connection from the pool has taken it on.
+   */
+  bool accept (IP_Buffer * buffer);
+
+  /** The number of connections in the pool that are in use, i.e., open, or connecting, or closing.
+   */
+  u8_t active () const;
+
+  /** The number of connections in the pool that are still completing the handshake.
+   */
+  u8_t half_open () const;
+
+  /** Statistics
+   */
+  inline u32_t accepted () const {
+    return stat_accepted;
+  }
+  inline u32_t overflows () const {
+    return stat_overflow;
+  }
+  inline u32_t exhausted () const {
+    return stat_exhausted;
+  }
+};
+
+#endif /* ! __ip_listener_hh__ */
@@ -26,7 +26,10 @@
 
 #include "ip_connection.hh"
 #include "ip_channel.hh"
+#include "ip_fragment.hh"
+#include "ip_listener.hh"
 #include "ip_timer.hh"
+#include "ip_timewait.hh"
 
 class IP_UDP_Connection;
 
@@ -42,34 +45,90 @@ public:
     }
   };
 
+  /* The Gateway interface, for routing packets to and from external networks when we're the gateway.
+   */
+  class Gateway {
+  public:
+    /* offered each packet addressed to an external network; afterwards the buffer is returned to the spares,
+     * so the gateway should copy whatever it needs; fragments are reassembled first, so a UDP datagram may span
+     * several buffers (see IP_Buffer::fragment_next())
+     */
+    virtual void gateway_forward (IP_Manager & manager, const IP_Buffer & buffer) = 0;
+
+    /* called every tick, e.g., to pick up replies from external networks and inject them with IP_Manager::forward()
+     */
+    virtual void gateway_update (IP_Manager & manager) = 0;
+
+    virtual ~Gateway () {
+      // ...
+    }
+  };
+
 private:
   u8_t channel_register[127];
 
   Listener * EL;
+  Gateway *  GW;
 
   IP_Buffer buffers[IP_Buffer_Extras];
 
   Chain<IP_Buffer> chain_buffers_spare;
-  Chain<IP_Buffer> chain_buffers_pending;
+  IP_Queue         queue_pending;
+  IP_Reassembly    reassembler;
+  IP_TimeWait      time_waiting;
+
+  u8_t  spare_count;            // number of buffers in chain_buffers_spare
+  u8_t  pool_size;              // number of buffers in the pool, spare or not
+  u8_t  pool_reserve[bc_Count]; // number of spares reserved for each consumer class
+  u8_t  pool_quota[bc_Count];   // maximum number of buffers each consumer class may hold
+  u8_t  pool_in_use[bc_Count];  // number of buffers each consumer class currently holds
+  u32_t pool_failed[bc_Count];  // number of allocations refused for each consumer class
+
+  u8_t  rx_quota;               // maximum number of received buffers any one channel may have waiting
+  u8_t  rx_in_use[16];          // number of received buffers each channel has waiting
 
   Chain<IP_Connection> chain_connection; // IP connections across network
+  Chain<IP_Listener>   chain_listener;   // TCP servers with a pool of connections
   Chain<IP_Channel>    chain_channel;    // Hardware connections to neighbouring devices
 
+  IP_Connection * ready_first; // connections waiting for update(), in order; see IP_Connection::schedule()
+  IP_Connection * ready_last;
+  u16_t           ready_count;
+
   IP_Timer timer;         // timer for broadcast ping
   u16_t    ping_interval; // how often to broadcast ping on local network
 
   u16_t  ping_next; // counter for generating ping sequence numbers
+  u16_t  ip_id;     // counter for generating IP identification fields, e.g., for fragments
   u16_t  last_port; // counter for generating free port numbers
 
   u8_t   ticker;    // internal cooperative management
 
+  u8_t   pending_batch;  // maximum number of pending buffers to handle per pass
+  u8_t   pending_budget; // maximum time (ms) to spend per pass; 0 for no limit
+
+  u32_t  pending_total;  // total number of pending buffers handled
+  u32_t  pending_overrun; // number of passes cut short by the time budget
+
 public:
-  IP_Address host;
+  IP_Address host;     // addresses in the default family (IPv4, unless only IPv6 is supported)
   IP_Address gateway;
   IP_Address netmask;
-
+#if IP_USE_IPv4 && IP_USE_IPv6
+  IP_Address host6;    // dual stack: addresses in the IPv6 family
+  IP_Address gateway6;
+  IP_Address netmask6;
+#endif
+
+  /* The default instance, for applications with a single stack; additional instances can be created as
+   * required, each with its own channels, connections and buffers.
+   */
   static IP_Manager & manager ();
 
+  /* The instance currently running (i.e., within cycle()) in this thread; otherwise the default instance.
+   */
+  static IP_Manager & active ();
+
   IP_Manager ();
 
   ~IP_Manager () {
@@ -80,6 +139,10 @@ public:
     EL = listener;
   }
 
+  inline void set_gateway (Gateway * gateway) {
+    GW = gateway;
+  }
+
   inline void debug_print (const char * message) {
     if (EL && message) {
       EL->debug_print (message);
@@ -87,21 +150,89 @@ public:
   }
 
   inline void connection_add (IP_Connection * connection) {
+    connection->bind (this);
     chain_connection.chain_prepend (connection);
+    connection_ready (connection);
   }
 
   inline void connection_remove (IP_Connection * connection) {
     chain_connection.chain_remove (connection);
+    ready_remove (connection);
+  }
+
+  /* Queue a connection for update() on the next pass of the connections, unless already queued; connections
+   * normally queue themselves (see IP_Connection::schedule()), and only those queued are updated.
+   */
+  void connection_ready (IP_Connection * connection);
+
+  inline u16_t connections_ready () const { // number of connections waiting for update()
+    return ready_count;
+  }
+
+  /* Add a TCP listener, along with the connections in its pool; connection requests on its port go to the listener
+   * unless a server IP_Connection on the same port is listening.
+   */
+  inline void listener_add (IP_Listener * listener) {
+    listener->bind (this);
+    chain_listener.chain_prepend (listener);
   }
 
   IP_Connection * connection_for_port (const ns16_t & port); // returns 0 if none found
 
   bool channel_add (IP_Channel * channel); // Note: add up to 15 channels; no option to remove channels.
 
+  /* Add buffers to the pool of spares, on top of the IP_Buffer_Extras every manager has, e.g., for a busy router;
+   * the buffers must last as long as the manager. Note: up to 255 spares in all; no option to remove buffers.
+   */
+  void buffers_add (IP_Buffer * extra, u8_t count);
+
   IP_Channel * channel (u8_t number);
 
+  /* The host, gateway & netmask addresses for the specified address family
+   */
+  inline const IP_Address & host_for (u8_t family) const {
+#if IP_USE_IPv4 && IP_USE_IPv6
+    if (family == IP_Family_IPv6)
+      return host6;
+#else
+    (void) family;
+#endif
+    return host;
+  }
+  inline const IP_Address & gateway_for (u8_t family) const {
+#if IP_USE_IPv4 && IP_USE_IPv6
+    if (family == IP_Family_IPv6)
+      return gateway6;
+#else
+    (void) family;
+#endif
+    return gateway;
+  }
+  inline const IP_Address & netmask_for (u8_t family) const {
+#if IP_USE_IPv4 && IP_USE_IPv6
+    if (family == IP_Family_IPv6)
+      return netmask6;
+#else
+    (void) family;
+#endif
+    return netmask;
+  }
+
+  inline bool is_host (const IP_Address & address) const {
+    return address == host_for (address.family ());
+  }
+
   inline bool is_local_network (const IP_Address & address) const {
-    return host.compare (address, netmask);
+    return host_for (address.family ()).compare (address, netmask_for (address.family ()));
+  }
+
+  /* Set the local network ID, i.e., the last byte (1-254), of the host address(es)
+   */
+  inline void set_local_network_id (u8_t id) {
+    host.set_local_network_id (id);
+#if IP_USE_IPv4 && IP_USE_IPv6
+    host6.set_local_network_id (id);
+#endif
   }
 
   u16_t available_port ();
@@ -112,27 +243,142 @@ public:
   bool queue (IP_Buffer *& buffer);
 
   /* 
-   * adds a free buffer to the spares
+   * adds a free buffer to the spares, along with the rest of the datagram if it's a chain of fragments
    */
   inline void add_to_spares (IP_Buffer * buffer) {
-    if (buffer) {
-      if (!buffer->retained ()) {
-	chain_buffers_spare.chain_prepend (buffer);
+    while (buffer) {
+      if (buffer->retained () || (buffer->pool_class () == bc_Spare)) {
+	break;
       }
+      IP_Buffer * next = buffer->fragment_next ();
+      buffer->fragment_next (0);
+
+      pool_release (buffer);
+      buffer->pool_class (bc_Spare);
+
+      chain_buffers_spare.chain_prepend (buffer);
+      ++spare_count;
+
+      buffer = next;
     }
   }
 
   /* 
-   * gets a free buffer from the spares - if there are any
+   * gets a free buffer from the spares - if there are any, and if the consumer class is within its quota
+   * and isn't eating into buffers reserved for the other classes
    */
-  inline IP_Buffer * get_from_spares () {
-    IP_Buffer * B = chain_buffers_spare.chain_pop ();
+  inline IP_Buffer * get_from_spares (IP_BufferClass bc = bc_Transmit) {
+    IP_Buffer * B = 0;
+
+    if (pool_allows (bc)) {
+      B = chain_buffers_spare.chain_pop ();
+      --spare_count;
+
+      B->pool_class (bc);
+      ++pool_in_use[bc];
+    } else {
+      ++pool_failed[bc];
+    }
     return B;
   }
 
+  /* Set the number of spares reserved for a consumer class, and the maximum number of buffers it can hold.
+   */
+  inline void set_buffer_quota (IP_BufferClass bc, u8_t reserve, u8_t quota = 0xFF) {
+    if (bc < bc_Count) {
+      pool_reserve[bc] = reserve;
+      pool_quota[bc]   = quota;
+    }
+    reassembly_limit ();
+  }
+
+  /* Set the maximum number of received buffers any one channel may have waiting.
+   */
+  inline void set_channel_quota (u8_t quota) {
+    rx_quota = quota;
+  }
+
+  /* Buffer pool statistics
+   */
+  inline u8_t buffers_spare () const {                     // number of buffers in the pool of spares
+    return spare_count;
+  }
+  inline u8_t buffers_in_use (IP_BufferClass bc) const {   // number of buffers held by a consumer class
+    return (bc < bc_Count) ? pool_in_use[bc] : 0;
+  }
+  inline u32_t buffer_failures (IP_BufferClass bc) const { // number of allocations refused for a consumer class
+    return (bc < bc_Count) ? pool_failed[bc] : 0;
+  }
+
   void ping (const IP_Address & address, u16_t seq_no);
 
+  /* A single cycle of the manager's clock; with several instances, call each in turn (or run each in its own thread).
+   */
+  virtual void cycle ();
+
+  /* Adjust the processing of the pending queue: at most batch buffers are handled per pass,
+   * and a pass stops early once it has taken longer than milliseconds (if non-zero).
+   */
+  inline void set_pending_budget (u8_t batch, u8_t milliseconds) {
+    pending_batch  = batch ? batch : 1;
+    pending_budget = milliseconds;
+  }
+
+  /* Reassembly of fragmented datagrams, e.g., for adjusting limits or checking statistics
+   */
+  inline IP_Reassembly & reassembly () {
+    return reassembler;
+  }
+
+  /* TCP connections in TIME_WAIT, e.g., for adding a connection that has just closed, or checking statistics
+   */
+  inline IP_TimeWait & time_wait () {
+    return time_waiting;
+  }
+
+  /* Identification for the next outgoing datagram that needs one, e.g., if fragmented
+   */
+  inline u16_t ip_id_next () {
+    return ++ip_id;
+  }
+
+  /* Pending queue, e.g., for adjusting queue management or checking statistics
+   */
+  inline IP_Queue & pending_queue () {
+    return queue_pending;
+  }
+
+  /* Pending queue statistics
+   */
+  inline u16_t pending_depth () const {      // number of buffers currently waiting
+    return queue_pending.length ();
+  }
+  inline u16_t pending_depth_max () const {  // maximum number of buffers waiting at any one time
+    return queue_pending.length_max ();
+  }
+  inline u32_t pending_handled () const {    // total number of buffers handled
+    return pending_total;
+  }
+  inline u32_t pending_overruns () const {   // number of passes stopped early by the time budget
+    return pending_overrun;
+  }
+
 private:
+  IP_Connection * ready_pop ();
+  void ready_remove (IP_Connection * connection);
+
+  bool pool_allows (IP_BufferClass bc, u8_t channel = 0) const;
+  void pool_release (IP_Buffer * buffer);
+  bool pool_reclass (IP_Buffer * buffer, IP_BufferClass bc);
+
+  bool time_wait_accept (IP_Buffer * buffer);
+  void time_wait_ack (const IP_TimeWait::Entry & entry);
+
+  void pending_handle (IP_Buffer * pending);
+  void pending_reassemble (IP_Buffer * fragment);
+  void reassembly_limit ();
+  void pending_pass ();
+
   u16_t ping_seq_no () {
     return ++ping_next;
   }
@@ -156,6 +402,8 @@ private:
 
   RoutingInfo channel_for_destination (u8_t & channel, const IP_Address & destination) const;
 
+  bool for_gateway (const IP_Address & destination) const;
+
   /* clock functions
    */
   void tick ();
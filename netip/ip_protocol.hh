@@ -28,15 +28,12 @@
 #include "ip_address.hh"
 
 enum IP_Protocol {
-#if IP_USE_IPv6
-  p_ICMP = 0x3A,  // IPv6-ICMP
-#else
-  p_ICMP = 0x01,  // Internet Control Message Protocol
-#endif
+  p_ICMP = 0x01,  // Internet Control Message Protocol; IPv6 headers use IPv6-ICMP (0x3A) instead - see IP_Header::defaults()
   p_TCP  = 0x06,
   p_UDP  = 0x11
 };
 
+#if IP_USE_IPv4
 struct IP_Header_IPv4 {
   u8_t buffer[20]; // there may be upto 10 extra header fields, but the first 20 bytes are required
 
@@ -143,18 +140,22 @@ struct IP_Header_IPv4 {
     return *((const ns16_t *) (buffer + 10));
   }
 
-  inline IP_Address & source () {
-    return *((IP_Address *) (buffer + 12));
+  inline IP_Address source () const {
+    IP_Address address;
+    address.read (IP_Family_IPv4, buffer + 12);
+    return address;
   }
-  inline const IP_Address & source () const {
-    return *((const IP_Address *) (buffer + 12));
+  inline void set_source (const IP_Address & address) {
+    address.write (buffer + 12);
   }
 
-  inline IP_Address & destination () {
-    return *((IP_Address *) (buffer + 16));
+  inline IP_Address destination () const {
+    IP_Address address;
+    address.read (IP_Family_IPv4, buffer + 16);
+    return address;
   }
-  inline const IP_Address & destination () const {
-    return *((const IP_Address *) (buffer + 16));
+  inline void set_destination (const IP_Address & address) {
+    address.write (buffer + 16);
   }
 
   /* utility methods
@@ -210,8 +211,8 @@ struct IP_Header_IPv4 {
   }
 
   inline void pseudo_header (Check16 & check) const {
-    source().check (check);
-    destination().check (check);
+    const Buffer B((u8_t *) buffer, 20, true /* full buffer */);
+    B.check_16 (check, 12,  8); // source & destination addresses
 
     check += protocol ();
     check += payload_length ();
@@ -223,7 +224,9 @@ struct IP_Header_IPv4 {
     B.check_16 (check, 12,  8);
   }
 };
+#endif /* IP_USE_IPv4 */
 
+#if IP_USE_IPv6
 struct IP_Header_IPv6 {
   u8_t buffer[40];
 
@@ -293,18 +296,31 @@ struct IP_Header_IPv6 {
     return buffer[7];
   }
 
-  inline IP_Address & source () {
-    return *((IP_Address *) (buffer + 8));
+  /* Note: the address holds a reference to its /64 prefix in IP_Address's prefix table while it exists;
+   *       IP_Address::is_valid() is false if the table is full of other prefixes in use
+   */
+  inline IP_Address source () const {
+    IP_Address address;
+    address.read (IP_Family_IPv6, buffer + 8);
+    return address;
   }
-  inline const IP_Address & source () const {
-    return *((const IP_Address *) (buffer + 8));
+  inline void set_source (const IP_Address & address) {
+    address.write (buffer + 8);
   }
 
-  inline IP_Address & destination () {
-    return *((IP_Address *) (buffer + 24));
+  inline IP_Address destination () const {
+    IP_Address address;
+    address.read (IP_Family_IPv6, buffer + 24);
+    return address;
   }
-  inline const IP_Address & destination () const {
-    return *((const IP_Address *) (buffer + 24));
+  inline void set_destination (const IP_Address & address) {
+    address.write (buffer + 24);
+  }
+
+  /* Whether both addresses' /64 prefixes can be represented, without adding them to the prefix table
+   */
+  inline bool prefixes_available () const {
+    return IP_Address::prefix_available (buffer + 8) && IP_Address::prefix_available (buffer + 24);
   }
 
   /* utility methods
@@ -359,13 +375,152 @@ struct IP_Header_IPv6 {
   }
 
   inline void pseudo_header (Check16 & check) const {
-    source().check (check);
-    destination().check (check);
+    const Buffer B((u8_t *) buffer, 40, true /* full buffer */);
+    B.check_16 (check, 8, 32); // source & destination addresses
 
     check += length ();
     check += protocol ();
   }
 };
+#endif /* IP_USE_IPv6 */
+
+/* Select the IPv4 or IPv6 form of an IP_Header method; resolves at compile-time unless both families are supported
+ */
+#if IP_USE_IPv4 && IP_USE_IPv6
+#define IP_HEADER_SELECT(method) (is_IPv6 () ? v6().method : v4().method)
+#elif IP_USE_IPv6
+#define IP_HEADER_SELECT(method) (v6().method)
+#else
+#define IP_HEADER_SELECT(method) (v4().method)
+#endif
+
+/** A view of the IP header at the start of a packet buffer, dispatching on the IP version to IP_Header_IPv4 or
+ * IP_Header_IPv6 without virtual calls. If only one family is supported, the dispatch is resolved at compile-time.
+ */
+struct IP_Header {
+  u8_t * buffer;
+
+  IP_Header (u8_t * header_buffer) :
+    buffer(header_buffer)
+  {
+    // ...
+  }
+
+  /** The IP version of the header, i.e., its address family (IP_Family_IPv4 or IP_Family_IPv6).
+   */
+  inline u8_t version () const {
+#if IP_USE_IPv4 && IP_USE_IPv6
+    return buffer[0] >> 4;
+#else
+    return IP_Family_Default;
+#endif
+  }
+
+  inline bool is_IPv6 () const {
+    return version () == IP_Family_IPv6;
+  }
+
+#if IP_USE_IPv4
+  inline IP_Header_IPv4 & v4 () {
+    return *((IP_Header_IPv4 *) buffer);
+  }
+  inline const IP_Header_IPv4 & v4 () const {
+    return *((const IP_Header_IPv4 *) buffer);
+  }
+#endif
+#if IP_USE_IPv6
+  inline IP_Header_IPv6 & v6 () {
+    return *((IP_Header_IPv6 *) buffer);
+  }
+  inline const IP_Header_IPv6 & v6 () const {
+    return *((const IP_Header_IPv6 *) buffer);
+  }
+#endif
+
+  inline u8_t & protocol () {
+    return IP_HEADER_SELECT(protocol ());
+  }
+  inline const u8_t & protocol () const {
+    return IP_HEADER_SELECT(protocol ());
+  }
+
+  inline u8_t & ttl () {
+    return IP_HEADER_SELECT(ttl ());
+  }
+  inline const u8_t & ttl () const {
+    return IP_HEADER_SELECT(ttl ());
+  }
+
+  inline IP_Address source () const {
+    return IP_HEADER_SELECT(source ());
+  }
+  inline void set_source (const IP_Address & address) {
+    IP_HEADER_SELECT(set_source (address));
+  }
+
+  inline IP_Address destination () const {
+    return IP_HEADER_SELECT(destination ());
+  }
+  inline void set_destination (const IP_Address & address) {
+    IP_HEADER_SELECT(set_destination (address));
+  }
+
+  /* utility methods
+   */
+
+  inline u8_t header_length () const {
+    return IP_HEADER_SELECT(header_length ());
+  }
+
+  inline void set_total_length (u16_t total) {
+    IP_HEADER_SELECT(set_total_length (total));
+  }
+  inline u16_t total_length () const {
+    return IP_HEADER_SELECT(total_length ());
+  }
+
+  inline u16_t payload_length () const {
+    return IP_HEADER_SELECT(payload_length ());
+  }
+
+  /** Clear and set up a default header for the specified address family.
+   */
+  inline void defaults (u8_t family) {
+#if IP_USE_IPv4 && IP_USE_IPv6
+    if (family == IP_Family_IPv6)
+      v6().defaults ();
+    else
+      v4().defaults ();
+#else
+    (void) family;
+    IP_HEADER_SELECT(defaults ());
+#endif
+  }
+
+  inline u8_t protocol_echo_request () const {
+    return IP_HEADER_SELECT(protocol_echo_request ());
+  }
+
+  inline u8_t protocol_echo_reply () const {
+    return IP_HEADER_SELECT(protocol_echo_reply ());
+  }
+
+  inline bool is_ICMP () const {
+    return IP_HEADER_SELECT(is_ICMP ());
+  }
+  inline bool is_TCP () const {
+    return protocol () == 0x06;
+  }
+  inline bool is_UDP () const {
+    return protocol () == 0x11;
+  }
+
+  inline void pseudo_header (Check16 & check) const {
+    IP_HEADER_SELECT(pseudo_header (check));
+  }
+};
+
+#undef IP_HEADER_SELECT
 
 struct IP_Header_TCP {
   u8_t buffer[20]; // there may be upto 10 extra header fields, but the first 20 bytes are required
@@ -449,6 +604,14 @@ struct IP_Header_TCP {
 #define IP_TCP_FLAG_SYN 0x02
 #define IP_TCP_FLAG_FIN 0x01
 
+  /* Option kinds (in the header, after the first 20 bytes)
+   */
+#define IP_TCP_Option_End            0 // end of options list
+#define IP_TCP_Option_NOP            1 // no-operation (padding)
+#define IP_TCP_Option_MSS            2 // maximum segment size
+#define IP_TCP_Option_SACK_Permitted 4 // selective acknowledgements permitted (SYN only; RFC 2018)
+#define IP_TCP_Option_SACK           5 // selective acknowledgement blocks
+
   ns16_t flags;
 
   inline void flag_ns (bool b) {
@@ -587,6 +750,21 @@ struct IP_Header_TCP {
   }
 };
 
+/* TCP sequence numbers wrap around, modulo 2^32; note that u32_t may be wider than 32 bits
+ */
+inline u32_t tcp_seq_add (u32_t seq, u32_t count) {
+  return (seq + count) & 0xFFFFFFFFUL;
+}
+inline u32_t tcp_seq_diff (u32_t seq_end, u32_t seq_start) { // number of bytes from seq_start up to seq_end
+  return (seq_end - seq_start) & 0xFFFFFFFFUL;
+}
+inline bool tcp_seq_lt (u32_t lhs, u32_t rhs) {
+  return tcp_seq_diff (lhs, rhs) & 0x80000000UL;
+}
+inline bool tcp_seq_le (u32_t lhs, u32_t rhs) {
+  return !tcp_seq_lt (rhs, lhs);
+}
+
 struct IP_Header_UDP {
   u8_t buffer[8];
 
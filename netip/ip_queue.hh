@@ -0,0 +1,165 @@
+/* Copyright (c) 2018 Francis James Franklin
+ * 
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided
+ * that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and
+ *    the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ *    the following disclaimer in the documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*! \file ip_queue.hh
+    \brief A queue of packet buffers with active queue management.
+    
+    IP_Queue is used for the pending queue in IP_Manager and for each IP_Channel's output queue. Buffers are
+    timestamped when queued and, once the time they spend in the queue (their sojourn time) has stayed above a
+    target for a whole interval, buffers are dropped at an increasing rate until the delay comes down again (as
+    in CoDel, RFC 8289). The queue can also have a hard limit on its length.
+*/
+
+#ifndef __ip_queue_hh__
+#define __ip_queue_hh__
+
+#include "ip_buffer.hh"
+
+/** A FIFO queue of IP_Buffer objects with CoDel-style active queue management and statistics. The queue doesn't
+ * have access to the pool of spares, so buffers to be dropped are handed back to the caller to dispose of.
+ */
+class IP_Queue {
+private:
+  Chain<IP_Buffer> chain; ///< The queued buffers.
+
+  u16_t queue_length;     ///< Current number of buffers in the queue.
+  u16_t queue_limit;      ///< Maximum number of buffers in the queue; 0 for no limit.
+
+  u16_t codel_target;     ///< Acceptable standing queue delay (in milliseconds); 0 disables dropping.
+  u16_t codel_interval;   ///< Time (in milliseconds) the delay must stay above target before dropping starts.
+
+  u32_t first_above;      ///< Time at which dropping may start, if the delay is still above target; 0 if not above target.
+  u32_t drop_next;        ///< While dropping, the time of the next drop.
+  u16_t drop_count;       ///< Number of drops since entering the dropping state.
+  u16_t drop_count_last;  ///< Value of drop_count when the dropping state was last entered.
+
+  bool  bDropping;        ///< Whether the queue is in the dropping state.
+
+  u16_t stat_length_max;  ///< Maximum queue length so far.
+  u16_t stat_sojourn;     ///< Sojourn time (in milliseconds) of the last buffer to leave the queue.
+  u16_t stat_sojourn_max; ///< Maximum sojourn time so far.
+  u32_t stat_queued;      ///< Total number of buffers queued.
+  u32_t stat_dropped;     ///< Total number of buffers dropped because of queueing delay.
+  u32_t stat_overflow;    ///< Total number of buffers refused because the queue was full.
+
+  /** Remove the next buffer from the queue, noting whether its sojourn time allows dropping.
+   */
+  IP_Buffer * dequeue (u32_t now, bool & bOkToDrop);
+
+  /** The time of the next drop, which gets closer as drops accumulate.
+   */
+  u32_t control_law (u32_t t) const;
+
+public:
+  IP_Queue ();
+
+  ~IP_Queue () {
+    // ...
+  }
+
+  /** Set the CoDel parameters.
+   * \param target   Acceptable standing queue delay (in milliseconds); 0 disables dropping.
+   * \param interval Time (in milliseconds) the delay must stay above target before dropping starts.
+   */
+  inline void set_codel (u16_t target, u16_t interval) {
+    codel_target   = target;
+    codel_interval = interval ? interval : 1;
+  }
+
+  /** Set the maximum number of buffers in the queue; 0 for no limit.
+   */
+  inline void set_limit (u16_t limit) {
+    queue_limit = limit;
+  }
+
+  /** Add a buffer to the end of the queue, or to the start if it's urgent.
+   * \param buffer  The buffer to add.
+   * \param now     The current time (in milliseconds).
+   * \param bUrgent If true, add to the start of the queue.
+   * \return False if the queue is full (or the buffer is already queued), in which case the caller should drop the buffer.
+   */
+  bool push (IP_Buffer * buffer, u32_t now, bool bUrgent = false);
+
+  /** Remove the next buffer from the queue.
+   * \param now   The current time (in milliseconds).
+   * \param bDrop Set to true if the buffer should be dropped, in which case the caller should dispose of it and call pop() again.
+   * \return The next buffer, or 0 if the queue is empty.
+   */
+  IP_Buffer * pop (u32_t now, bool & bDrop);
+
+  /** Returns true if the queue is empty.
+   */
+  inline bool is_empty () const {
+    return !queue_length;
+  }
+
+  /** Current number of buffers in the queue.
+   */
+  inline u16_t length () const {
+    return queue_length;
+  }
+
+  /** Maximum number of buffers in the queue so far.
+   */
+  inline u16_t length_max () const {
+    return stat_length_max;
+  }
+
+  /** Sojourn time (in milliseconds) of the last buffer to leave the queue.
+   */
+  inline u16_t sojourn () const {
+    return stat_sojourn;
+  }
+
+  /** Maximum sojourn time (in milliseconds) so far.
+   */
+  inline u16_t sojourn_max () const {
+    return stat_sojourn_max;
+  }
+
+  /** Total number of buffers queued.
+   */
+  inline u32_t queued () const {
+    return stat_queued;
+  }
+
+  /** Total number of buffers dropped because of queueing delay.
+   */
+  inline u32_t dropped () const {
+    return stat_dropped;
+  }
+
+  /** Total number of buffers refused because the queue was full.
+   */
+  inline u32_t overflowed () const {
+    return stat_overflow;
+  }
+
+  /** Returns true if the queue is currently dropping buffers to bring the delay down.
+   */
+  inline bool dropping () const {
+    return bDropping;
+  }
+};
+
+#endif /* ! __ip_queue_hh__ */
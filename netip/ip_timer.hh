@@ -79,6 +79,13 @@ public:
    */
   void start (IP_Clock & clock, u32_t interval);
 
+  /** Change the interval (in milliseconds) without restarting; if called from the callback, which then returns true,
+   * the next callback is after the new interval.
+   */
+  inline void set_interval (u32_t interval) {
+    timer_interval = interval;
+  }
+
   /** Check to see whether the timer should be triggered; if so, call the callback.
    * \param current_time The current time.
    * \return True if the timer is periodic and should be kept active.
@@ -162,6 +169,11 @@ public:
     bStop = true;
   }
 
+  /** Single cycle of the infinite loop; check the time, call any timers that are due, then tick().
+   * Applications running several clocks in the one loop can call this directly instead of run().
+   */
+  virtual void cycle ();
+
   /** Start the infinite loop.
    */
   void run ();
@@ -0,0 +1,123 @@
+/* Copyright (c) 2018 Francis James Franklin
+ * 
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided
+ * that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and
+ *    the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ *    the following disclaimer in the documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*! \file ip_timewait.hh
+    \brief Tracking of closed TCP connections in TIME_WAIT.
+    
+    After a TCP connection closes, the side that closed first must wait for twice the maximum segment lifetime
+    before the same addresses and ports are used again, in case its final ACK was lost and the remote resends its
+    FIN, and so that stray segments from the old connection can't be mistaken for part of a new one. Rather than
+    tie up an IP_Connection (with its two FIFOs) for the duration, IP_Connection hands the little that's needed
+    over to IP_TimeWait, which the manager consults for any TCP segment addressed to us.
+*/
+
+#ifndef __ip_timewait_hh__
+#define __ip_timewait_hh__
+
+#include "ip_buffer.hh"
+
+/** A fixed-size table of connections in TIME_WAIT; when full, the oldest entry is dropped to make room.
+ */
+class IP_TimeWait {
+public:
+  struct Entry {
+    IP_Address remote;      ///< The remote address.
+    ns16_t     port_local;  ///< The local port; 0 if the entry is unused.
+    ns16_t     port_remote; ///< The remote port.
+    u32_t      seq_no;      ///< Our next sequence number, i.e., just after our FIN.
+    u32_t      ack_no;      ///< The remote's next sequence number, i.e., just after its FIN.
+    u32_t      started;     ///< Time (in milliseconds) at which TIME_WAIT started, or was last restarted.
+  };
+
+private:
+  Entry entries[IP_TCP_TimeWait_Slots];
+
+  u16_t duration; ///< Time (in milliseconds) spent in TIME_WAIT.
+
+  u32_t stat_added;   ///< Number of connections that have entered TIME_WAIT.
+  u32_t stat_evicted; ///< Number of entries dropped early to make room for another.
+  u32_t stat_reused;  ///< Number of entries ended early by a new connection request.
+
+public:
+  IP_TimeWait ();
+
+  ~IP_TimeWait () {
+    // ...
+  }
+
+  /** Set the time spent in TIME_WAIT.
+   */
+  inline void set_duration (u16_t milliseconds) {
+    duration = milliseconds;
+  }
+
+  /** A connection has closed, and enters TIME_WAIT.
+   * \param remote      The remote address.
+   * \param port_local  The local port.
+   * \param port_remote The remote port.
+   * \param seq_no      Our next sequence number, i.e., just after our FIN.
+   * \param ack_no      The remote's next sequence number, i.e., just after its FIN.
+   * \param now         The current time (in milliseconds).
+   */
+  void add (const IP_Address & remote, const ns16_t & port_local, const ns16_t & port_remote, u32_t seq_no, u32_t ack_no, u32_t now);
+
+  /** Find the entry for a TCP segment addressed to us, if there is one.
+   */
+  Entry * find (const IP_Buffer * buffer);
+
+  /** Start the wait again, e.g., because the remote has resent its FIN.
+   */
+  inline void restart (Entry * entry, u32_t now) {
+    entry->started = now;
+  }
+
+  /** End the wait early, because the remote wants to open a new connection.
+   */
+  inline void reuse (Entry * entry) {
+    entry->port_local = 0;
+    ++stat_reused;
+  }
+
+  /** Remove entries that have waited long enough.
+   * \param now The current time (in milliseconds).
+   */
+  void expire (u32_t now);
+
+  /** The number of connections currently in TIME_WAIT.
+   */
+  u8_t count () const;
+
+  /** Statistics
+   */
+  inline u32_t added () const {
+    return stat_added;
+  }
+  inline u32_t evicted () const {
+    return stat_evicted;
+  }
+  inline u32_t reused () const {
+    return stat_reused;
+  }
+};
+
+#endif /* ! __ip_timewait_hh__ */
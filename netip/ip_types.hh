@@ -446,93 +446,131 @@ public:
   }
 };
 
-/** FIFO is a byte buffer where bytes are added and removed in first-in first-out order.
+/** FIFO is a byte buffer where bytes are added and removed in first-in first-out order. It's a ring whose capacity
+ *  is a power of two, so that positions wrap by masking; the read and write indices run freely (modulo 2^16), so that
+ *  their difference is the number of bytes held, and the full capacity can be used.
+ *
+ *  Where there are threads, one thread (the producer) may push() and write() while another (the consumer) may pop()
+ *  and read(), without locking: each only ever changes its own index, and publishes it only once the bytes have been
+ *  copied (see ip_arch_index_t). clear() and attach() need both threads to be idle.
  */
 class FIFO {
 private:
-  u8_t * buffer_start; ///< Pointer to the start of the buffer.
-  u8_t * buffer_end;   ///< Pointer to the end of the buffer.
-  u8_t * data_start;   ///< Pointer to the start of the data; if start == end, then no data.
-  u8_t * data_end;     ///< Pointer to the end of the data; must point to a writable byte.
+  u8_t * buffer;     ///< Pointer to the start of the buffer.
+  u16_t  mask;       ///< The capacity, less one; the capacity is a power of two, up to 32768.
+
+  ip_arch_index_t index_read;  ///< Free-running index of the next byte to read; changed by the consumer only.
+  ip_arch_index_t index_write; ///< Free-running index of the next byte to write; changed by the producer only.
 
 public:
-  /** Empty the buffer for a fresh start.
+  /** Empty the buffer for a fresh start. (Neither producer nor consumer may be using the buffer.)
    */
   inline void clear () {
-    data_start = buffer_start;
-    data_end   = buffer_start;
+    ip_arch_index_store (index_read,  0);
+    ip_arch_index_store (index_write, 0);
+  }
+
+  /** Discard everything in the buffer. (Consumer only.)
+   */
+  inline void drain () {
+    ip_arch_index_store (index_read, ip_arch_index_load (index_write));
+  }
+
+  /** The producer's position, to mark the end of the data written so far; see drain_to(). (Producer only.)
+   */
+  inline u16_t mark () const {
+    return ip_arch_index_load (index_write);
+  }
+
+  /** Discard the data written before the mark, unless it has been read already. (Consumer only.)
+   * \param index The producer's position, as given by mark().
+   */
+  inline void drain_to (u16_t index) {
+    u16_t index_now = ip_arch_index_load (index_read);
+
+    if ((u16_t) (index - index_now) <= (u16_t) (ip_arch_index_load (index_write) - index_now)) { // not read past it
+      ip_arch_index_store (index_read, index);
+    }
   }
 
   /** Returns true of the buffer is empty.
    */
-  inline bool is_empty () {
-    return (data_start == data_end);
+  inline bool is_empty () const {
+    return ip_arch_index_load (index_read) == ip_arch_index_load (index_write);
   }
 
-  /** Add a byte to the buffer; returns true if there was space.
+  /** Number of bytes in the buffer.
    */
-  inline bool push (u8_t byte) {
-    bool bCanPush = true;
+  inline u16_t count () const {
+    return (u16_t) (ip_arch_index_load (index_write) - ip_arch_index_load (index_read));
+  }
 
-    if (data_start < data_end) {
-      if ((data_start == buffer_start) && (data_end + 1 == buffer_end)) {
-	bCanPush = false;
-      }
-    } else if (data_start > data_end) {
-      if (data_end + 1 == data_start) {
-	bCanPush = false;
-      }
-    } // else (data_start == data_end) // buffer must be empty
+  /** Number of bytes that can be added to the buffer.
+   */
+  inline u16_t available () const {
+    return capacity () - count ();
+  }
 
-    if (bCanPush) {
-      *data_end = byte;
+  /** The maximum number of bytes the buffer can hold.
+   */
+  inline u16_t capacity () const {
+    return buffer ? (mask + 1) : 0;
+  }
 
-      if (++data_end == buffer_end) {
-	data_end = buffer_start;
-      }
+  /** Add a byte to the buffer; returns true if there was space. (Producer only.)
+   */
+  inline bool push (u8_t byte) {
+    u16_t index = ip_arch_index_load (index_write);
+
+    if ((u16_t) (index - ip_arch_index_load (index_read)) == capacity ()) {
+      return false;
     }
-    return bCanPush;
+    buffer[index & mask] = byte;
+    ip_arch_index_store (index_write, index + 1);
+    return true;
   }
 
-  /** Remove a byte from the buffer; returns true if the buffer wasn't empty.
+  /** Remove a byte from the buffer; returns true if the buffer wasn't empty. (Consumer only.)
    */
   inline bool pop (u8_t & byte) {
-    if (data_start == data_end) { // buffer must be empty
-      return false;
-    }
-    byte = *data_start;
+    u16_t index = ip_arch_index_load (index_read);
 
-    if (++data_start == buffer_end) {
-      data_start = buffer_start;
+    if (index == ip_arch_index_load (index_write)) {
+      return false;
     }
+    byte = buffer[index & mask];
+    ip_arch_index_store (index_read, index + 1);
     return true;
   }
 
+  /** Use a different (external) buffer; any data in the FIFO is discarded.
+   * \param byte_buffer Pointer to the external buffer.
+   * \param size        The size (number of bytes) of the external buffer; only the largest power of two that fits
+   *                    (up to 32768) is used.
+   */
+  void attach (u8_t * byte_buffer, u16_t size);
+
   /** The actual buffer exists elsewhere; FIFO merely manages it.
    * \param byte_buffer Pointer to the external buffer.
-   * \param capacity    The size (number of bytes) of the external buffer.
+   * \param size        The size (number of bytes) of the external buffer; only the largest power of two that fits
+   *                    (up to 32768) is used.
    */
-  FIFO (u8_t * byte_buffer, u16_t capacity) :
-    buffer_start(byte_buffer),
-    buffer_end(byte_buffer+capacity),
-    data_start(byte_buffer),
-    data_end(byte_buffer)
-  {
-    // ...
+  FIFO (u8_t * byte_buffer, u16_t size) {
+    attach (byte_buffer, size);
   }
 
   ~FIFO () {
     // ...
   }
 
-  /** Read (and remove) multiple bytes from the buffer.
+  /** Read (and remove) multiple bytes from the buffer. (Consumer only.)
    * \param ptr    Pointer to an external byte array where the data should be written.
    * \param length Number of bytes to read from the buffer, if possible.
    * \return The number of bytes actually read from the buffer.
    */
   u16_t read (u8_t * ptr, u16_t length);
 
-  /** Write multiple bytes to the buffer.
+  /** Write multiple bytes to the buffer. (Producer only.)
    * \param ptr    Pointer to an external byte array where the data should be read from.
    * \param length Number of bytes to write to the buffer, if possible.
    * \return The number of bytes actually written to the buffer.
@@ -631,6 +669,25 @@ public:
     buffer_used = 0;
   }
 
+  /** Returns a pointer to the unused space at the end of the buffer, for writing into directly (up to available()
+   *  bytes); afterwards, call extend() with the number of bytes written.
+   */
+  inline u8_t * tail () {
+    return buffer + buffer_used;
+  }
+
+  /** Add bytes written directly into the buffer (see tail()).
+   * \param length The number of bytes written.
+   * \return The number of bytes actually added, if there is insufficient space.
+   */
+  inline u16_t extend (u16_t length) {
+    if (length > buffer_max - buffer_used) {
+      length = buffer_max - buffer_used;
+    }
+    buffer_used += length;
+    return length;
+  }
+
   /** The actual buffer exists elsewhere; Buffer merely manages it. The initial reference count is zero.
    * \param byte_buffer Pointer to the external buffer.
    * \param capacity    The size (number of bytes) of the external buffer.
@@ -702,11 +759,15 @@ public:
   }
 
   /** Read bytes from a FIFO object and append to the buffer.
-   * \param fifo The FIFO object to read from.
+   * \param fifo   The FIFO object to read from.
+   * \param length The maximum number of bytes to read; by default, as many as will fit.
    * \return The number of bytes actually appended to the buffer from the FIFO object.
    */
-  inline u16_t pull (FIFO & fifo) { // append to buffer from FIFO
-    u16_t count = fifo.read (buffer + buffer_used, buffer_max - buffer_used);
+  inline u16_t pull (FIFO & fifo, u16_t length = 0xFFFF) { // append to buffer from FIFO
+    if (length > buffer_max - buffer_used) {
+      length = buffer_max - buffer_used;
+    }
+    u16_t count = fifo.read (buffer + buffer_used, length);
     buffer_used += count;
     return count;
   }
@@ -24,6 +24,8 @@
 #ifndef __ip_arch_hh__
 #define __ip_arch_hh__
 
+#include <atomic>
+#include <mutex>
 #include <cstdio>
 #include <cstring>
 
@@ -33,6 +35,35 @@ typedef unsigned char  u8_t;
 typedef unsigned short u16_t;
 typedef unsigned long  u32_t;
 
+/* Storage class for per-thread state, e.g., the active IP_Manager
+ */
+#define IP_ARCH_THREAD_LOCAL thread_local
+
+/* Free-running index of a ring shared by one producer thread and one consumer thread (see FIFO); each thread
+ * publishes its own index with a release store, and reads the other thread's with an acquire load
+ */
+typedef std::atomic<u16_t> ip_arch_index_t;
+
+static inline u16_t ip_arch_index_load (const ip_arch_index_t & index) {
+  return index.load (std::memory_order_acquire);
+}
+
+static inline void ip_arch_index_store (ip_arch_index_t & index, u16_t value) {
+  index.store (value, std::memory_order_release);
+}
+
+/* Lock for (brief) access to state shared by all threads, e.g., the IPv6 prefix table (see IP_Address)
+ */
+typedef std::mutex ip_arch_lock_t;
+
+static inline void ip_arch_lock (ip_arch_lock_t & lock) {
+  lock.lock ();
+}
+
+static inline void ip_arch_unlock (ip_arch_lock_t & lock) {
+  lock.unlock ();
+}
+
 extern void  ip_arch_usleep (u16_t us);
 extern u32_t ip_arch_millis ();
 
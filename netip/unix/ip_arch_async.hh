@@ -0,0 +1,252 @@
+/* Copyright (c) 2018 Francis James Franklin
+ * 
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided
+ * that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and
+ *    the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ *    the following disclaimer in the documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __ip_arch_async_hh__
+#define __ip_arch_async_hh__
+
+#if !defined(__cpp_impl_coroutine)
+#error "NetIP: ip_async.hh needs C++20 coroutines (e.g., -std=c++20)"
+#endif
+
+#include <coroutine>
+#include <exception>
+#include <span>
+
+/* A coroutine that runs as soon as it's called, until its first co_await, and is resumed from the manager's loop
+ * (see IP_AsyncConnection); nothing waits for it to finish, and its frame is freed when it does. The frame is the
+ * only allocation, once per coroutine; awaiting is allocation-free.
+ */
+class IP_Task {
+public:
+  struct promise_type {
+    IP_Task get_return_object () {
+      return IP_Task ();
+    }
+    std::suspend_never initial_suspend () noexcept {
+      return std::suspend_never ();
+    }
+    std::suspend_never final_suspend () noexcept {
+      return std::suspend_never ();
+    }
+    void return_void () {
+      // ...
+    }
+    void unhandled_exception () {
+      std::terminate ();
+    }
+  };
+};
+
+/* A connection driven by coroutines rather than by EventListener callbacks:
+ *
+ *   IP_Task echo (IP_AsyncConnection & connection) {
+ *     connection.open ();
+ *     while (co_await connection.opened ()) {  // the next client
+ *       u8_t data[64];
+ *       while (u16_t count = co_await connection.read (data, 64)) {
+ *         co_await connection.write (data, count);
+ *       }
+ *       connection.close ();
+ *       co_await connection.closed ();
+ *     }
+ *   }
+ *
+ * The coroutines run on the manager's thread, and are resumed at the end of the connection's update() once what
+ * they're waiting for has happened; an EventListener can still be set, e.g., for statistics. At most one coroutine
+ * can wait for each of: the connection's state (opened() / closed() / connect()), data (read()) and space (write()).
+ */
+class IP_AsyncConnection : public IP_Connection {
+private:
+  std::coroutine_handle<> wait_state; // waiting in opened(), closed() or connect()
+  std::coroutine_handle<> wait_read;  // waiting in read()
+  std::coroutine_handle<> wait_write; // waiting in write()
+
+  bool bWaitOpen; // wait_state is waiting for the connection to open, rather than close
+
+  const u8_t * write_ptr;    // what's left of the data being written
+  u16_t        write_length;
+
+  inline bool state_ready () const { // opened or failed, or closed
+    return bWaitOpen ? (is_open () || is_idle ()) : (!is_open () && !is_busy ());
+  }
+  inline bool read_ready () const { // data, or none to come
+    return !fifo_in().is_empty () || !is_open () || remote_closed ();
+  }
+
+  inline void write_some () {
+    u16_t count = IP_Connection::write (write_ptr, write_length);
+
+    write_ptr    += count;
+    write_length -= count;
+  }
+
+  static inline void resume (std::coroutine_handle<> & handle) {
+    std::coroutine_handle<> h = handle;
+
+    handle = std::coroutine_handle<> (); // it may well wait again
+    h.resume ();
+  }
+
+protected:
+  virtual void io_update () {
+    if (wait_state && state_ready ()) {
+      resume (wait_state);
+    }
+    if (wait_read && read_ready ()) {
+      resume (wait_read);
+    }
+    if (wait_write) {
+      if (is_open ()) {
+	write_some ();
+      }
+      if (!write_length || !is_open ()) {
+	resume (wait_write);
+      }
+    }
+  }
+
+public:
+  class StateAwaiter {
+  private:
+    IP_AsyncConnection & connection;
+  public:
+    StateAwaiter (IP_AsyncConnection & c) :
+      connection(c)
+    {
+      // ...
+    }
+    bool await_ready () const {
+      return connection.state_ready ();
+    }
+    void await_suspend (std::coroutine_handle<> handle) {
+      connection.wait_state = handle;
+    }
+    bool await_resume () const { // true if open
+      return connection.is_open ();
+    }
+  };
+
+  class ReadAwaiter {
+  private:
+    IP_AsyncConnection & connection;
+    u8_t * ptr;
+    u16_t  length;
+  public:
+    ReadAwaiter (IP_AsyncConnection & c, u8_t * p, u16_t l) :
+      connection(c),
+      ptr(p),
+      length(l)
+    {
+      // ...
+    }
+    bool await_ready () const {
+      return connection.read_ready ();
+    }
+    void await_suspend (std::coroutine_handle<> handle) {
+      connection.wait_read = handle;
+    }
+    u16_t await_resume () { // the number of bytes read; 0 once there's no more data to come
+      return connection.IP_Connection::read (ptr, length);
+    }
+  };
+
+  class WriteAwaiter {
+  private:
+    IP_AsyncConnection & connection;
+    u16_t length;
+  public:
+    WriteAwaiter (IP_AsyncConnection & c, const u8_t * p, u16_t l) :
+      connection(c),
+      length(l)
+    {
+      connection.write_ptr    = p;
+      connection.write_length = l;
+    }
+    bool await_ready () {
+      if (connection.is_open ()) {
+	connection.write_some ();
+      }
+      return !connection.write_length || !connection.is_open ();
+    }
+    void await_suspend (std::coroutine_handle<> handle) {
+      connection.wait_write = handle;
+    }
+    u16_t await_resume () const { // the number of bytes written; all of them, unless the connection closed
+      return length - connection.write_length;
+    }
+  };
+
+  IP_AsyncConnection (IP_Protocol p = p_TCP, u16_t port = 0) :
+    IP_Connection(p, port),
+    bWaitOpen(true),
+    write_ptr(0),
+    write_length(0)
+  {
+    // ...
+  }
+
+  virtual ~IP_AsyncConnection () {
+    // ...
+  }
+
+  /* Wait until the connection opens (e.g., after open() or connect()); true if open, false if it failed to open
+   */
+  inline StateAwaiter opened () {
+    bWaitOpen = true;
+    return StateAwaiter (*this);
+  }
+
+  /* Wait until the connection has finished closing (e.g., after close()); it can then be reused
+   */
+  inline StateAwaiter closed () {
+    bWaitOpen = false;
+    return StateAwaiter (*this);
+  }
+
+  /* Connect to a remote address/port, and wait until the connection opens; true if open
+   */
+  inline StateAwaiter connect (const IP_Address & remote_address, u16_t remote_port) {
+    IP_Connection::connect (remote_address, remote_port);
+    return opened ();
+  }
+
+  /* Wait for data, and read as much as there is, up to length bytes; 0 once no more data will come
+   */
+  inline ReadAwaiter read (u8_t * ptr, u16_t length) {
+    return ReadAwaiter (*this, ptr, length);
+  }
+  inline ReadAwaiter read (std::span<u8_t> data) {
+    return ReadAwaiter (*this, data.data (), (u16_t) data.size ());
+  }
+
+  /* Write all of the data, waiting for space as necessary; fewer bytes are written only if the connection closes
+   */
+  inline WriteAwaiter write (const u8_t * ptr, u16_t length) {
+    return WriteAwaiter (*this, ptr, length);
+  }
+  inline WriteAwaiter write (std::span<const u8_t> data) {
+    return WriteAwaiter (*this, data.data (), (u16_t) data.size ());
+  }
+};
+
+#endif /* ! __ip_arch_async_hh__ */
@@ -0,0 +1,318 @@
+/* Copyright (c) 2018 Francis James Franklin
+ * 
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided
+ * that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and
+ *    the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ *    the following disclaimer in the documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// included from source file ip_gateway.cpp
+
+#include <cstdio>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+typedef struct sockaddr_storage ip_arch_sockaddr; // large enough for either address family
+
+static socklen_t ip_arch_sockaddr_set (ip_arch_sockaddr & sa, const IP_Address & address, u16_t port) {
+  memset (&sa, 0, sizeof (sa));
+
+  if (address.is_IPv6 ()) {
+    struct sockaddr_in6 & sa6 = (struct sockaddr_in6 &) sa;
+
+    sa6.sin6_family = AF_INET6;
+    sa6.sin6_port   = htons (port);
+    address.write ((u8_t *) &sa6.sin6_addr);
+    return sizeof (sa6);
+  }
+  struct sockaddr_in & sa4 = (struct sockaddr_in &) sa;
+
+  sa4.sin_family = AF_INET;
+  sa4.sin_port   = htons (port);
+  address.write ((u8_t *) &sa4.sin_addr);
+  return sizeof (sa4);
+}
+
+/* Returns false if the address family isn't supported, or if an IPv6 address can't be represented
+ */
+static bool ip_arch_sockaddr_get (const ip_arch_sockaddr & sa, IP_Address & address, u16_t & port) {
+#if IP_USE_IPv6
+  if (sa.ss_family == AF_INET6) {
+    const struct sockaddr_in6 & sa6 = (const struct sockaddr_in6 &) sa;
+
+    port = ntohs (sa6.sin6_port);
+    return address.read (IP_Family_IPv6, (const u8_t *) &sa6.sin6_addr);
+  }
+#endif
+#if IP_USE_IPv4
+  if (sa.ss_family == AF_INET) {
+    const struct sockaddr_in & sa4 = (const struct sockaddr_in &) sa;
+
+    port = ntohs (sa4.sin_port);
+    return address.read (IP_Family_IPv4, (const u8_t *) &sa4.sin_addr);
+  }
+#endif
+  return false;
+}
+
+IP_GatewayBridge::IP_GatewayBridge () :
+  idle_timeout(1000 * (u32_t) IP_Gateway_Idle),
+  count_out(0),
+  count_in(0),
+  count_dropped(0),
+  count_oversize(0),
+  count_expired(0)
+{
+  for (int f = 0; f < IP_Gateway_Flows; f++) {
+    flows[f].fd = -1;
+    flows[f].host_port = 0;
+  }
+}
+
+IP_GatewayBridge::~IP_GatewayBridge () {
+  for (int f = 0; f < IP_Gateway_Flows; f++) {
+    flow_close (flows[f]);
+  }
+}
+
+void IP_GatewayBridge::flow_close (Flow & flow) {
+  if (flow.fd >= 0) {
+    close (flow.fd);
+    flow.fd = -1;
+    flow.host_port = 0;
+  }
+}
+
+u8_t IP_GatewayBridge::flows_active () const {
+  u8_t count = 0;
+
+  for (int f = 0; f < IP_Gateway_Flows; f++) {
+    if (flows[f].fd >= 0) {
+      ++count;
+    }
+  }
+  return count;
+}
+
+u16_t IP_GatewayBridge::host_port (const IP_Address & address, u16_t port) const {
+  for (int f = 0; f < IP_Gateway_Flows; f++) {
+    if ((flows[f].fd >= 0) && (flows[f].local_port == port) && (flows[f].local_address == address)) {
+      return flows[f].host_port;
+    }
+  }
+  return 0;
+}
+
+/* Find the flow for a local source address & port, or open a new one; returns 0 if the table is full
+ * or if a host socket can't be opened.
+ */
+IP_GatewayBridge::Flow * IP_GatewayBridge::flow_for (const IP_Address & address, const ns16_t & port, u32_t now) {
+  Flow * unused = 0;
+
+  for (int f = 0; f < IP_Gateway_Flows; f++) {
+    if (flows[f].fd < 0) {
+      if (!unused) {
+	unused = flows + f;
+      }
+    } else if ((flows[f].local_port == port) && (flows[f].local_address == address)) {
+      flows[f].last_used = now;
+      return flows + f;
+    }
+  }
+  if (!unused) {
+    return 0;
+  }
+
+  int family = address.is_IPv6 () ? AF_INET6 : AF_INET; // the host socket matches the local device's address family
+  int fd = socket (family, SOCK_DGRAM, 0);
+
+  if (fd < 0) {
+    fprintf (stderr, "IP_GatewayBridge: Failed to open socket.\n");
+    return 0;
+  }
+  fcntl (fd, F_SETFL, O_NONBLOCK);
+
+  ip_arch_sockaddr sa;
+  memset (&sa, 0, sizeof (sa));
+  sa.ss_family = family; // any address, any port
+
+  socklen_t sa_length = sizeof (sa);
+
+  if (bind (fd, (struct sockaddr *) &sa, (family == AF_INET6) ? sizeof (struct sockaddr_in6) : sizeof (struct sockaddr_in)) ||
+      getsockname (fd, (struct sockaddr *) &sa, &sa_length)) {
+    fprintf (stderr, "IP_GatewayBridge: Failed to bind socket.\n");
+    close (fd);
+    return 0;
+  }
+
+  unused->host_port = (family == AF_INET6) ? ntohs (((struct sockaddr_in6 &) sa).sin6_port) : ntohs (((struct sockaddr_in &) sa).sin_port);
+
+  unused->local_address = address;
+  unused->local_port    = port;
+  unused->fd            = fd;
+  unused->last_used     = now;
+
+  return unused;
+}
+
+void IP_GatewayBridge::gateway_forward (IP_Manager & manager, const IP_Buffer & buffer) {
+  if (!buffer.ip().is_UDP ()) { // only UDP is bridged
+    ++count_dropped;
+    return;
+  }
+#if IP_USE_IPv4
+  if (!buffer.ip().is_IPv6 () && !buffer.fragment_next () && (buffer.fragment_more () || buffer.fragment_offset ())) {
+    ++count_dropped; // a lone fragment, i.e., one that wasn't reassembled; the UDP header may not even be here
+    return;
+  }
+#endif
+
+  Flow * flow = flow_for (buffer.ip().source (), buffer.udp().source (), manager.milliseconds ());
+
+  if (!flow) {
+    ++count_dropped;
+    return;
+  }
+
+  ip_arch_sockaddr sa;
+  socklen_t sa_length = ip_arch_sockaddr_set (sa, buffer.ip().destination (), buffer.udp().destination ());
+
+  const u8_t * data = buffer.bytes () + buffer.udp_data_offset ();
+  u16_t length = buffer.udp_data_length ();
+
+#if IP_USE_IPv4
+  u8_t gather[IP_Reassembly_Length];
+
+  if (buffer.fragment_next ()) { // a reassembled datagram; gather the fragments' payloads, each at its offset
+    length = 0;
+
+    for (const IP_Buffer * B = &buffer; B; B = B->fragment_next ()) {
+      u16_t offset = B->fragment_offset ();
+      u16_t count  = B->ip().payload_length ();
+
+      if (offset + count > 8 + sizeof (gather)) {
+	++count_oversize;
+	return;
+      }
+      if (offset) {
+	memcpy (gather + offset - 8, B->bytes () + B->ip().header_length (), count);
+      } else {
+	memcpy (gather, B->bytes () + B->udp_data_offset (), count - 8);
+      }
+      if (length < offset + count - 8) {
+	length = offset + count - 8;
+      }
+    }
+    data = gather;
+  }
+#endif
+
+  ssize_t result = sendto (flow->fd, data, length, 0, (struct sockaddr *) &sa, sa_length);
+
+  if (result < 0) {
+    ++count_dropped;
+  } else {
+    ++count_out;
+  }
+}
+
+void IP_GatewayBridge::gateway_update (IP_Manager & manager) {
+  u32_t now = manager.milliseconds ();
+
+  u8_t data[IP_Buffer_WordCount << 1];
+
+  for (int f = 0; f < IP_Gateway_Flows; f++) {
+    Flow & flow = flows[f];
+
+    if (flow.fd < 0) {
+      continue;
+    }
+
+    while (true) {
+      IP_Buffer * buffer = manager.get_from_spares (bc_Forward);
+
+      if (!buffer) { // leave any datagrams with the host socket for now
+	break;
+      }
+      buffer->defaults (p_UDP, flow.local_address.family ());
+
+      ip_arch_sockaddr sa;
+
+      struct iovec iov;
+
+      iov.iov_base = data;
+      iov.iov_len  = buffer->available ();
+
+      struct msghdr msg;
+
+      memset (&msg, 0, sizeof (msg));
+
+      msg.msg_name    = &sa;
+      msg.msg_namelen = sizeof (sa);
+      msg.msg_iov     = &iov;
+      msg.msg_iovlen  = 1;
+
+      ssize_t count = recvmsg (flow.fd, &msg, 0);
+
+      if (count < 0) {
+	if (errno != EAGAIN && errno != EWOULDBLOCK) {
+	  fprintf (stderr, "IP_GatewayBridge: Failed to read from socket.\n");
+	}
+	manager.add_to_spares (buffer);
+	break;
+      }
+      if (msg.msg_flags & MSG_TRUNC) { // too long for a buffer; forwarding what's left would corrupt it
+	manager.add_to_spares (buffer);
+	++count_oversize;
+	continue;
+      }
+      IP_Address remote;
+      u16_t remote_port;
+
+      if (!ip_arch_sockaddr_get (sa, remote, remote_port)) { // e.g., the IPv6 prefix table is full
+	manager.add_to_spares (buffer);
+	++count_dropped;
+	continue;
+      }
+      buffer->append (data, count);
+
+      buffer->channel (0);
+
+      buffer->ip().set_destination (flow.local_address);
+
+      buffer->udp().source() = remote_port;
+      buffer->udp().destination() = flow.local_port;
+
+      buffer->udp_finalise (remote); // the reply appears to come directly from the external sender
+
+      manager.forward (buffer);
+
+      flow.last_used = now;
+      ++count_in;
+    }
+
+    if (now - flow.last_used > idle_timeout) {
+      flow_close (flow);
+      ++count_expired;
+    }
+  }
+}
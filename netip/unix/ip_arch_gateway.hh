@@ -0,0 +1,98 @@
+/* Copyright (c) 2018 Francis James Franklin
+ * 
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided
+ * that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and
+ *    the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ *    the following disclaimer in the documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __ip_arch_gateway_hh__
+#define __ip_arch_gateway_hh__
+
+/* A NAT-style bridge from UDP flows on the local network to UDP sockets on the host. Each flow (i.e., each local
+ * source address & port) is given its own host socket, bound to an ephemeral port; datagrams to any external
+ * address are sent from that socket, and replies received on it are injected back into the local network as
+ * if from the external sender. Flows are closed when idle. Other protocols are dropped.
+ */
+class IP_GatewayBridge : public IP_Manager::Gateway {
+private:
+  struct Flow {
+    IP_Address local_address; // source address & port of the flow within the local network
+    ns16_t     local_port;
+
+    int   fd;                 // host socket; -1 if the slot is unused
+    u16_t host_port;          // the translated port, i.e., the port the host socket is bound to
+    u32_t last_used;          // time (in milliseconds) the flow was last active in either direction
+  };
+
+  Flow flows[IP_Gateway_Flows];
+
+  u32_t idle_timeout; // in milliseconds
+
+  u32_t count_out;     // number of datagrams sent to external networks
+  u32_t count_in;      // number of datagrams injected into the local network
+  u32_t count_dropped; // number of packets dropped, e.g., not UDP, a lone fragment, or no free flow
+  u32_t count_oversize; // number of datagrams dropped for being too long for a buffer (or, reassembled, to send)
+  u32_t count_expired; // number of flows closed for being idle
+
+  Flow * flow_for (const IP_Address & address, const ns16_t & port, u32_t now);
+
+  void flow_close (Flow & flow);
+
+public:
+  IP_GatewayBridge ();
+
+  virtual ~IP_GatewayBridge ();
+
+  /* Time (in seconds) after which an idle flow is closed
+   */
+  inline void set_idle_timeout (u16_t seconds) {
+    idle_timeout = 1000 * (u32_t) seconds;
+  }
+
+  /* Number of flows currently mapped to host sockets
+   */
+  u8_t flows_active () const;
+
+  /* The host port a local flow has been translated to; 0 if there is no such flow
+   */
+  u16_t host_port (const IP_Address & address, u16_t port) const;
+
+  /* Statistics
+   */
+  inline u32_t datagrams_out () const {
+    return count_out;
+  }
+  inline u32_t datagrams_in () const {
+    return count_in;
+  }
+  inline u32_t packets_dropped () const {
+    return count_dropped;
+  }
+  inline u32_t datagrams_oversize () const {
+    return count_oversize;
+  }
+  inline u32_t flows_expired () const {
+    return count_expired;
+  }
+
+  virtual void gateway_forward (IP_Manager & manager, const IP_Buffer & buffer);
+  virtual void gateway_update (IP_Manager & manager);
+};
+
+#endif /* ! __ip_arch_gateway_hh__ */
@@ -30,13 +30,11 @@
 #include <errno.h>
 #include <termios.h>
 
-IP_SerialChannel::IP_SerialChannel (const char * device_name, bool bFixBaud) :
-  device_fd(-1)
-{
-  device_fd = open (device_name, O_RDWR | O_NOCTTY | O_NONBLOCK /* O_NDELAY */);
+int ip_arch_serial_open (const char * device_name, bool bFixBaud) {
+  int device_fd = open (device_name, O_RDWR | O_NOCTTY | O_NONBLOCK /* O_NDELAY */);
   if (device_fd == -1) {
     fprintf (stderr, "Failed to open \"%s\" - exiting.\n", device_name);
-    return;
+    return -1;
   }
 
   if (bFixBaud) {
@@ -61,6 +59,13 @@ IP_SerialChannel::IP_SerialChannel (const char * device_name, bool bFixBaud) :
   while (read (device_fd, &byte, 1) > 0) {
     // empty the input buffer
   }
+  return device_fd;
+}
+
+IP_SerialChannel::IP_SerialChannel (const char * device_name, bool bFixBaud) :
+  device_fd(-1)
+{
+  device_fd = ip_arch_serial_open (device_name, bFixBaud);
 }
 
 IP_SerialChannel::~IP_SerialChannel () {
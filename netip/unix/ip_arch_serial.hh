@@ -24,6 +24,10 @@
 #ifndef __ip_arch_serial_hh__
 #define __ip_arch_serial_hh__
 
+/* Open a serial device (non-blocking), optionally fixing the baud rate at 115200; returns -1 on failure
+ */
+extern int ip_arch_serial_open (const char * device_name, bool bFixBaud);
+
 class IP_SerialChannel : public IP_Channel {
 private:
   int device_fd;
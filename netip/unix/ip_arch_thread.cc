@@ -0,0 +1,475 @@
+/* Copyright (c) 2018 Francis James Franklin
+ * 
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided
+ * that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and
+ *    the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ *    the following disclaimer in the documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// included from source file ip_thread.cpp
+
+#include <cstdint>
+#include <cstdio>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+/* Wakeups between threads: an eventfd (Linux), or else a pipe, whose read end (event_fd) is readable once signalled
+ * through its write end (signal_fd)
+ */
+static void ip_thread_event_open (int & event_fd, int & signal_fd) {
+#ifdef __linux__
+  event_fd  = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+  signal_fd = event_fd;
+#else
+  int fds[2];
+
+  if (pipe (fds) == 0) {
+    fcntl (fds[0], F_SETFL, fcntl (fds[0], F_GETFL) | O_NONBLOCK);
+    fcntl (fds[1], F_SETFL, fcntl (fds[1], F_GETFL) | O_NONBLOCK);
+    event_fd  = fds[0];
+    signal_fd = fds[1];
+  }
+#endif
+}
+
+static void ip_thread_event_close (int event_fd, int signal_fd) {
+  if (signal_fd >= 0 && signal_fd != event_fd) {
+    ::close (signal_fd);
+  }
+  if (event_fd >= 0) {
+    ::close (event_fd);
+  }
+}
+
+static void ip_thread_event_signal (int signal_fd) {
+#ifdef __linux__
+  uint64_t one = 1;
+#else
+  u8_t one = 1;
+#endif
+  if (::write (signal_fd, &one, sizeof (one)) < 0) {
+    // already signalled (the pipe is full), or no descriptor
+  }
+}
+
+static void ip_thread_event_drain (int event_fd, int signal_fd) {
+  u8_t drain[8];
+
+  while (::read (event_fd, drain, sizeof (drain)) > 0) { // an eventfd is read in one go; a pipe may need several
+    if (event_fd == signal_fd) {
+      break;
+    }
+  }
+}
+
+IP_ThreadedChannel::IP_ThreadedChannel (int fd) :
+  bStop(false),
+  device_fd(fd),
+  wake_fd(-1),
+  wake_signal_fd(-1),
+  rx_waiting(0),
+  bStarted(false),
+  rx_buffer(0),
+  rx_held(0),
+  tx_release(0),
+  bHangup(false),
+  hangup_time(0),
+  rx_eof(false),
+  rx_flags(0),
+  rx_chunk_length(0),
+  rx_chunk_offset(0),
+  tx_frame_length(0),
+  tx_frame_offset(0)
+{
+  ip_thread_event_open (wake_fd, wake_signal_fd);
+
+  if (wake_fd < 0) {
+    fprintf (stderr, "IP_ThreadedChannel: unable to create event descriptor\n");
+  }
+}
+
+IP_ThreadedChannel::~IP_ThreadedChannel () {
+  io_stop ();
+
+  ip_thread_event_close (wake_fd, wake_signal_fd);
+}
+
+void IP_ThreadedChannel::io_stop () {
+  if (bStarted) {
+    bStop = true;
+    ip_thread_event_signal (wake_signal_fd);
+    io_thread.join ();
+    bStarted = false;
+  }
+}
+
+/* Manager thread: release sent packets, queue received packets (handing back a spare for each), and
+ * move packets from the output queue to the I/O thread.
+ */
+void IP_ThreadedChannel::update () {
+  if (device_fd < 0) {
+    return;
+  }
+  if (!bStarted) {
+    ring_spare.push (slip_detach_buffer ()); // the channel's own buffer is the first to receive into
+
+    bStarted = true;
+    io_thread = std::thread (&IP_ThreadedChannel::io_loop, this);
+  }
+
+  IP_Manager & M = manager ();
+
+  IP_Buffer * buffer;
+
+  bool bWake = false; // whether the I/O thread has something new to do: a spare or a packet, or space in a ring
+
+  while ((buffer = ring_done.pop ())) {
+    buffer->unref ();
+    M.add_to_spares (buffer);
+    bWake = true;
+  }
+
+  while (rx_waiting || (rx_waiting = ring_rx.pop ())) {
+    bWake = true;
+
+    if (!M.queue (rx_waiting)) { // no spare buffer to exchange; try again later
+      break;
+    }
+    rx_waiting->clear ();          // this is now actually a different buffer
+    ring_spare.push (rx_waiting); // can't be full - each channel has only the one receive buffer in play
+    rx_waiting = 0;
+  }
+
+  while (!ring_tx.is_full ()) {
+    bool bDrop;
+
+    if (!(buffer = queue ().pop (M.milliseconds (), bDrop))) {
+      break;
+    }
+    if (bDrop) { // queue management has dropped it
+      buffer->unref ();
+      M.add_to_spares (buffer);
+      continue;
+    }
+    ring_tx.push (buffer);
+    bWake = true;
+  }
+
+  if (bWake) {
+    ip_thread_event_signal (wake_signal_fd);
+  }
+}
+
+/* I/O thread: SLIP-encode the next packet into the frame and write as much as the device will take;
+ * returns true if there was anything to do.
+ */
+bool IP_ThreadedChannel::io_send () {
+  if (tx_release) {
+    if (!ring_done.push (tx_release)) {
+      return false;
+    }
+    tx_release = 0;
+  }
+
+  if (tx_frame_offset == tx_frame_length) {
+    IP_Buffer * buffer = ring_tx.pop ();
+
+    if (!buffer) {
+      return false;
+    }
+
+    const u8_t * ptr = buffer->bytes ();
+    const u8_t * end = ptr + buffer->length ();
+
+    u8_t * frame = tx_frame;
+
+    while (ptr < end) {
+      switch (*ptr) {
+      case IP_SLIP_END:
+	*frame++ = IP_SLIP_ESC;
+	*frame++ = IP_SLIP_ESC_END;
+	break;
+
+      case IP_SLIP_ESC:
+	*frame++ = IP_SLIP_ESC;
+	*frame++ = IP_SLIP_ESC_ESC;
+	break;
+
+      default:
+	*frame++ = *ptr;
+	break;
+      }
+      ++ptr;
+    }
+    *frame++ = IP_SLIP_END;
+
+    tx_frame_length = frame - tx_frame;
+    tx_frame_offset = 0;
+
+    /* the packet has been copied into the frame; hand the buffer back to the manager
+     */
+    if (!ring_done.push (buffer)) {
+      tx_release = buffer;
+    }
+  }
+
+  ssize_t result = write (device_fd, tx_frame + tx_frame_offset, tx_frame_length - tx_frame_offset);
+
+  if (result < 0) {
+    if (errno != EAGAIN) {
+      fprintf (stderr, "IP_ThreadedChannel: Failed to write to device\n");
+      tx_frame_offset = tx_frame_length; // give up on this packet
+      io_hangup ();
+    }
+    return false;
+  }
+  tx_frame_offset += result;
+
+  return true;
+}
+
+/* I/O thread: read from the device and SLIP-decode into the current receive buffer, passing complete packets
+ * to the manager; returns true if there was anything to do.
+ */
+bool IP_ThreadedChannel::io_receive () {
+  if (rx_held) {
+    if (!ring_rx.push (rx_held)) {
+      return false;
+    }
+    rx_held = 0;
+  }
+  if (!rx_buffer) {
+    if (!(rx_buffer = ring_spare.pop ())) {
+      return false; // nothing to receive into; leave the bytes with the device for now
+    }
+  }
+
+  if (rx_chunk_offset == rx_chunk_length) {
+    ssize_t count = read (device_fd, rx_chunk, sizeof (rx_chunk));
+
+    if (count <= 0) {
+      if (!count) {
+	rx_eof = true; // end of file, if the device was reported readable
+      } else if (errno != EAGAIN) {
+	fprintf (stderr, "IP_ThreadedChannel: Failed to read from device.\n");
+	io_hangup ();
+      }
+      return false;
+    }
+    rx_chunk_length = count;
+    rx_chunk_offset = 0;
+  }
+
+  while (rx_chunk_offset < rx_chunk_length) {
+    if (slip_decode (rx_buffer, rx_flags, rx_chunk[rx_chunk_offset++]) && rx_buffer->length ()) {
+      rx_buffer->channel (number ()); // note the buffer's originating channel
+
+      if (!ring_rx.push (rx_buffer)) {
+	rx_held = rx_buffer;
+      }
+      rx_buffer = ring_spare.pop (); // may be 0, in which case wait for the manager to exchange
+      break;
+    }
+  }
+  return true;
+}
+
+/* I/O thread: the device has hung up, reached end of file, or failed; stop polling it for a while, rather than spin
+ */
+void IP_ThreadedChannel::io_hangup () {
+  if (!bHangup) {
+    fprintf (stderr, "IP_ThreadedChannel: Device has hung up; retrying in %d ms\n", IP_Thread_Retry);
+    bHangup = true;
+  }
+  hangup_time = ip_arch_millis ();
+}
+
+void IP_ThreadedChannel::io_loop () {
+  bool bReadable = false; // the last poll() reported the device readable
+
+  while (!bStop) {
+    if (bHangup && (ip_arch_millis () - hangup_time >= IP_Thread_Retry)) {
+      bHangup = false;
+    }
+
+    bool bSent     = !bHangup && io_send ();
+    bool bReceived = !bHangup && io_receive ();
+
+    if (bReadable && rx_eof) {
+      io_hangup ();
+    }
+    bReadable = false;
+    rx_eof    = false;
+
+    if (!bSent && !bReceived) { // nothing doing; wait for the device, or for the manager
+      struct pollfd pfd[2];
+
+      /* only poll for input if there's a buffer to receive into, and nothing held up, or the device will stay
+       * readable and poll() will return straight away; the manager signals wake_fd once it has handed over a spare
+       */
+      pfd[0].fd = bHangup ? -1 : device_fd;
+      pfd[0].events = 0;
+      pfd[0].revents = 0;
+
+      if (rx_buffer && !rx_held) {
+	pfd[0].events |= POLLIN;
+      }
+      if (tx_frame_offset < tx_frame_length) {
+	pfd[0].events |= POLLOUT;
+      }
+
+      pfd[1].fd = wake_fd;
+      pfd[1].events = POLLIN;
+      pfd[1].revents = 0;
+
+      poll (pfd, 2, bHangup ? IP_Thread_Retry : -1);
+
+      if (pfd[0].revents & (POLLHUP | POLLERR | POLLNVAL)) {
+	io_hangup ();
+      } else if (pfd[0].revents & POLLIN) {
+	bReadable = true;
+      }
+      if (pfd[1].revents & POLLIN) {
+	ip_thread_event_drain (wake_fd, wake_signal_fd);
+      }
+    }
+  }
+}
+
+IP_ThreadedSerialChannel::IP_ThreadedSerialChannel (const char * device_name, bool bFixBaud) :
+  IP_ThreadedChannel(ip_arch_serial_open (device_name, bFixBaud))
+{
+  // ...
+}
+
+IP_ThreadedSerialChannel::~IP_ThreadedSerialChannel () {
+  io_stop ();
+
+  if (fd () >= 0) {
+    close (fd ());
+  }
+}
+
+IP_ThreadedConnection::IP_ThreadedConnection (IP_Protocol p, u16_t port) :
+  IP_Connection(p, port),
+  wait_events(0),
+  shared_state(0),
+  bCloseRequested(false),
+  bDiscardRequested(false),
+  discard_mark(0),
+  event_fd(-1),
+  signal_fd(-1)
+{
+  ip_thread_event_open (event_fd, signal_fd);
+
+  if (event_fd < 0) {
+    fprintf (stderr, "IP_ThreadedConnection: unable to create event descriptor\n");
+  }
+}
+
+IP_ThreadedConnection::~IP_ThreadedConnection () {
+  ip_thread_event_close (event_fd, signal_fd);
+}
+
+u8_t IP_ThreadedConnection::ready (u8_t events) const {
+  u8_t state = shared_state.load (std::memory_order_acquire);
+  u8_t ready = 0;
+
+  if ((events & IP_Ready_Read) && (!fifo_in().is_empty () || (state & IP_Shared_Finished))) {
+    ready |= IP_Ready_Read;
+  }
+  if ((events & IP_Ready_Write) && (((state & IP_Shared_Open) && fifo_out().available ()) || (state & IP_Shared_Closed))) {
+    ready |= IP_Ready_Write;
+  }
+  return ready;
+}
+
+void IP_ThreadedConnection::signal () {
+  ip_thread_event_signal (signal_fd);
+}
+
+bool IP_ThreadedConnection::app_arm (u8_t events) {
+  wait_events.store (events, std::memory_order_seq_cst);
+
+  /* the manager's thread publishes to the FIFO, then checks wait_events; we set wait_events, then check the FIFO;
+   * the fences ensure that at least one of us sees the other's change
+   */
+  std::atomic_thread_fence (std::memory_order_seq_cst);
+
+  if (ready (events)) {
+    wait_events.store (0, std::memory_order_relaxed);
+    return true;
+  }
+  return false;
+}
+
+void IP_ThreadedConnection::app_disarm () {
+  wait_events.store (0, std::memory_order_relaxed);
+
+  ip_thread_event_drain (event_fd, signal_fd);
+}
+
+u8_t IP_ThreadedConnection::app_wait (u8_t events, int timeout) {
+  if (!app_arm (events)) {
+    struct pollfd pfd;
+
+    pfd.fd = event_fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    poll (&pfd, 1, timeout);
+
+    app_disarm ();
+  }
+  return ready (events);
+}
+
+void IP_ThreadedConnection::io_discard () {
+  discard_mark.store (fifo_in().mark (), std::memory_order_relaxed);
+  bDiscardRequested.store (true, std::memory_order_release);
+}
+
+void IP_ThreadedConnection::io_update () {
+  if (bCloseRequested.exchange (false, std::memory_order_acquire) && is_open ()) {
+    close ();
+  }
+
+  u8_t state = shared_state.load (std::memory_order_relaxed);
+
+  if (is_open ()) {
+    state = remote_closed () ? (IP_Shared_Open | IP_Shared_Finished) : IP_Shared_Open;
+  } else if (state & IP_Shared_Open) {
+    state = IP_Shared_Finished | IP_Shared_Closed;
+  }
+  shared_state.store (state, std::memory_order_release);
+
+  std::atomic_thread_fence (std::memory_order_seq_cst); // see app_arm()
+
+  u8_t events = wait_events.load (std::memory_order_relaxed);
+
+  if (events && ready (events) && wait_events.compare_exchange_strong (events, 0)) {
+    signal ();
+  }
+}
@@ -0,0 +1,255 @@
+/* Copyright (c) 2018 Francis James Franklin
+ * 
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided
+ * that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and
+ *    the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ *    the following disclaimer in the documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __ip_arch_thread_hh__
+#define __ip_arch_thread_hh__
+
+#include <atomic>
+#include <thread>
+
+/* Lock-free ring of buffer pointers, for handing buffers from one thread (the producer) to one other (the consumer)
+ */
+template<u16_t N> class IP_Ring {
+private:
+  static_assert ((N & (N - 1)) == 0, "IP_Ring size must be a power of two");
+
+  IP_Buffer * slots[N];
+
+  std::atomic<u16_t> ring_head; // next slot to write; only changed by the producer
+  std::atomic<u16_t> ring_tail; // next slot to read; only changed by the consumer
+
+public:
+  IP_Ring () :
+    ring_head(0),
+    ring_tail(0)
+  {
+    // ...
+  }
+
+  ~IP_Ring () {
+    // ...
+  }
+
+  inline bool is_full () const { // producer only
+    return (u16_t) (ring_head.load (std::memory_order_relaxed) - ring_tail.load (std::memory_order_acquire)) == N;
+  }
+
+  /* returns false if the ring is full; producer only
+   */
+  inline bool push (IP_Buffer * buffer) {
+    u16_t head = ring_head.load (std::memory_order_relaxed);
+
+    if ((u16_t) (head - ring_tail.load (std::memory_order_acquire)) == N) {
+      return false;
+    }
+    slots[head & (N - 1)] = buffer;
+    ring_head.store ((u16_t) (head + 1), std::memory_order_release);
+    return true;
+  }
+
+  /* returns 0 if the ring is empty; consumer only
+   */
+  inline IP_Buffer * pop () {
+    u16_t tail = ring_tail.load (std::memory_order_relaxed);
+
+    if (tail == ring_head.load (std::memory_order_acquire)) {
+      return 0;
+    }
+    IP_Buffer * buffer = slots[tail & (N - 1)];
+    ring_tail.store ((u16_t) (tail + 1), std::memory_order_release);
+    return buffer;
+  }
+};
+
+/* A channel on a file descriptor (e.g., a serial device) where reading, writing and SLIP encoding/decoding run on
+ * a dedicated I/O thread, so that a slow device doesn't hold up the manager. Buffers pass between the I/O thread and
+ * the manager's thread through four rings:
+ *   ring_rx    - I/O thread -> manager: complete received packets, which the manager queues;
+ *   ring_spare - manager -> I/O thread: empty buffers to receive into, in exchange for each received packet;
+ *   ring_tx    - manager -> I/O thread: packets from the channel's output queue, to be sent;
+ *   ring_done  - I/O thread -> manager: packets that have been sent, to be released back to the spares.
+ * The manager keeps ownership of the pool, reference counts and queue management; the I/O thread only ever touches
+ * the buffers it has been handed. The thread is started with the first update() after IP_Manager::channel_add().
+ */
+class IP_ThreadedChannel : public IP_Channel {
+private:
+  IP_Ring<IP_Thread_Ring> ring_rx;
+  IP_Ring<IP_Thread_Ring> ring_spare;
+  IP_Ring<IP_Thread_Ring> ring_tx;
+  IP_Ring<IP_Thread_Ring> ring_done;
+
+  std::thread       io_thread;
+  std::atomic<bool> bStop;
+
+  int device_fd;
+
+  int wake_fd;        // readable once the manager has handed the I/O thread something to do (see update())
+  int wake_signal_fd; // eventfd (Linux) again, or the write end of a pipe
+
+  /* manager thread only
+   */
+  IP_Buffer * rx_waiting; // received packet that the manager couldn't queue yet
+
+  bool bStarted;
+
+  /* I/O thread only
+   */
+  IP_Buffer * rx_buffer;  // current receive buffer
+  IP_Buffer * rx_held;    // complete packet waiting for space in ring_rx
+  IP_Buffer * tx_release; // sent packet waiting for space in ring_done
+
+  bool  bHangup;          // the device has hung up (or failed); left alone until IP_Thread_Retry ms after...
+  u32_t hangup_time;      // ... this time
+  bool  rx_eof;           // the last read() returned 0
+
+  u8_t rx_flags;          // SLIP decoding state
+
+  u16_t rx_chunk_length;
+  u16_t rx_chunk_offset;
+  u8_t  rx_chunk[IP_Buffer_WordCount << 1];
+
+  u16_t tx_frame_length;
+  u16_t tx_frame_offset;
+  u8_t  tx_frame[(IP_Buffer_WordCount << 2) + 1]; // SLIP-encoded packet, worst case
+
+  void io_loop ();
+  bool io_send ();
+  bool io_receive ();
+  void io_hangup ();
+
+protected:
+  void io_stop (); // stop and join the I/O thread; call before closing the file descriptor
+
+public:
+  IP_ThreadedChannel (int fd = -1);
+
+  virtual ~IP_ThreadedChannel ();
+
+  /* Set the (non-blocking) file descriptor, before the thread starts
+   */
+  inline void set_fd (int fd) {
+    device_fd = fd;
+  }
+
+  inline int fd () const {
+    return device_fd;
+  }
+
+  virtual void update ();
+};
+
+/* Readiness for IP_ThreadedConnection::app_wait() etc.
+ */
+#define IP_Ready_Read  0x01 // data waiting in fifo_read, or no more data will come
+#define IP_Ready_Write 0x02 // space in fifo_write (while open), or the connection has closed
+
+/* The connection's state, as published to the application thread
+ */
+#define IP_Shared_Open     0x01 // open, and not (yet) closed by the application
+#define IP_Shared_Finished 0x02 // the remote has closed its side, or the connection has closed; no more data will come
+#define IP_Shared_Closed   0x04 // the connection was open, and has closed
+
+/* A connection whose application I/O runs on another thread, while the manager's thread runs the connection: the
+ * application thread only ever touches the two FIFO, through app_read() and app_write(), which never block and never
+ * take a lock. The manager's thread sends what has been written, and takes in more data as space is freed, with each
+ * update(); IP_Connection::read() and IP_Connection::write() must not be used. Set the connection up (open(),
+ * connect(), etc.) before the manager's thread starts, or from that thread. UDP output is sent on the next update()
+ * rather than coalesced. Each thread empties only its own end of a FIFO: if the connection closes, any data left
+ * unread is dropped by the next app_read().
+ *
+ * To wait for data or space, the application thread calls app_wait(); or, to wait alongside other descriptors, calls
+ * app_arm() and, if that returns false, polls fd() for reading, then calls app_disarm(). The manager's thread only
+ * signals fd() while the application thread is waiting.
+ */
+class IP_ThreadedConnection : public IP_Connection {
+private:
+  std::atomic<u8_t> wait_events;  // the readiness the application thread is waiting for; 0 if not waiting
+  std::atomic<u8_t> shared_state; // the connection's state, as seen by the application thread
+  std::atomic<bool> bCloseRequested;
+  std::atomic<bool> bDiscardRequested; // close() has discarded fifo_read's contents, up to discard_mark
+  std::atomic<u16_t> discard_mark;
+
+  int event_fd;  // eventfd (Linux), or the read end of a pipe, which is readable once signalled
+  int signal_fd; // the eventfd again, or the write end of the pipe
+
+  u8_t ready (u8_t events) const;
+
+  void signal ();
+
+protected:
+  virtual void io_update (); // manager's thread: act on app_close(), publish state & wake the application thread
+
+  virtual bool io_pending () const { // the application thread may have read or written, so update() with every pass
+    return is_open () || is_busy ();
+  }
+
+  virtual void io_discard ();  // manager's thread: leave the application thread to drain fifo_read, see app_read()
+
+public:
+  IP_ThreadedConnection (IP_Protocol p = p_TCP, u16_t port = 0);
+
+  virtual ~IP_ThreadedConnection ();
+
+  /* Application thread only
+   */
+  inline u16_t app_read (u8_t * ptr, u16_t length) {
+    if (bDiscardRequested.exchange (false, std::memory_order_acquire)) { // closed since; drop what was left unread
+      fifo_in().drain_to (discard_mark.load (std::memory_order_relaxed));
+    }
+    return fifo_in().read (ptr, length);
+  }
+  inline u16_t app_write (const u8_t * ptr, u16_t length) {
+    return app_is_open () ? fifo_out().write (ptr, length) : 0;
+  }
+  inline bool app_is_open () const {
+    return (shared_state.load (std::memory_order_acquire) & IP_Shared_Open);
+  }
+  inline bool app_has_finished () const { // once fifo_read is empty, no more data
+    return (shared_state.load (std::memory_order_acquire) & IP_Shared_Finished);
+  }
+  inline bool app_has_closed () const {
+    return (shared_state.load (std::memory_order_acquire) & IP_Shared_Closed);
+  }
+  inline void app_close () {             // the manager's thread closes the connection with its next update()
+    bCloseRequested.store (true, std::memory_order_release);
+  }
+  inline int fd () const {
+    return event_fd;
+  }
+
+  bool app_arm (u8_t events);  // start waiting for the readiness; returns true (and doesn't wait) if already ready
+  void app_disarm ();          // stop waiting, and clear any signal
+
+  /* Wait up to timeout milliseconds (-1 for no limit) until ready; returns the readiness (0 if timed out)
+   */
+  u8_t app_wait (u8_t events, int timeout);
+};
+
+class IP_ThreadedSerialChannel : public IP_ThreadedChannel {
+public:
+  IP_ThreadedSerialChannel (const char * device_name, bool bFixBaud = false);
+
+  virtual ~IP_ThreadedSerialChannel ();
+};
+
+#endif /* ! __ip_arch_thread_hh__ */